@@ -0,0 +1,110 @@
+#pragma once
+#ifndef INC_BENCH_H
+#define INC_BENCH_H
+
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+using std::string;
+using std::vector;
+
+#include "main.h"
+
+
+//every suite compares the plugin's implementation with the one it replaced (or with libmysqlclient),
+//prints its timings and returns the number of differing results
+
+
+//the boost::spirit conversions used up to R35, kept as reference
+bool SpiritStrToInt(const char *src, const char *end, int &dest);
+bool SpiritStrToFloat(const char *src, const char *end, float &dest);
+template<unsigned int B> //B = base/radix
+bool SpiritIntToStr(int src, char *dest);
+
+unsigned int BenchConvert();
+//needs a MySQL server, mysql_real_escape_string only knows the character set of a connection
+unsigned int BenchEscape(const char *host, const char *user, const char *pass, const char *db, unsigned int port);
+//"%e" is only tested with a server, the old mysql_format escaped through mysql_real_escape_string
+unsigned int BenchFormat(const char *host, const char *user, const char *pass, const char *db, unsigned int port);
+//has to be the last suite, the log can't be restarted
+unsigned int BenchLog(unsigned int logtype, unsigned int seconds);
+
+
+//xorshift, so every run tests the same inputs
+class CRandom
+{
+public:
+	CRandom(boost::uint32_t seed = 2463534242U) :
+		m_State(seed)
+	{ }
+
+	inline boost::uint32_t Next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+	//0 <= value < max
+	inline unsigned int Next(unsigned int max)
+	{
+		return Next() % max;
+	}
+
+private:
+	boost::uint32_t m_State;
+};
+
+
+class CStopwatch
+{
+public:
+	CStopwatch() :
+		m_Start(boost::posix_time::microsec_clock::universal_time())
+	{ }
+
+	//in microseconds
+	inline unsigned int Elapsed() const
+	{
+		const boost::int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - m_Start).total_microseconds();
+		return static_cast<unsigned int>(elapsed > 0 ? elapsed : 1);
+	}
+
+private:
+	boost::posix_time::ptime m_Start;
+};
+
+//prints one timing line: operations per second of both implementations and the speedup
+void PrintTiming(const char *name, unsigned int num_ops, unsigned int old_time, unsigned int new_time);
+
+
+//stands in for a script: amx_GetAddr is served from its own data segment, addresses are byte offsets like in the AMX;
+//strings are stored unpacked, like Pawn passes them usually
+class CFakeAmx
+{
+public:
+	CFakeAmx();
+	~CFakeAmx();
+
+	AMX *GetAmx()
+	{
+		return &m_Amx;
+	}
+
+	//values are passed by reference to variadic natives, so all of these return an address
+	cell PushCell(cell value);
+	cell PushFloat(float value);
+	cell PushString(const char *str);
+	void Clear();
+
+private:
+	AMX m_Amx;
+	vector<cell> m_Data;
+	size_t m_DataUsed;
+};
+
+
+#endif // INC_BENCH_H
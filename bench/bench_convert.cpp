@@ -0,0 +1,255 @@
+#pragma once
+
+#include "bench.h"
+#include "misc.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <boost/spirit/include/qi.hpp>
+#include <boost/spirit/include/karma.hpp>
+
+using namespace boost::spirit;
+
+
+bool SpiritStrToInt(const char *src, const char *end, int &dest)
+{
+	return qi::parse(src, end, qi::int_, dest);
+}
+
+bool SpiritStrToFloat(const char *src, const char *end, float &dest)
+{
+	return qi::parse(src, end, qi::float_, dest);
+}
+
+template<unsigned int B>
+bool SpiritIntToStr(int src, char *dest)
+{
+	bool ReturnVal = karma::generate(dest, karma::int_generator<int, B>(), src);
+	*dest = 0;
+	return ReturnVal;
+}
+template bool SpiritIntToStr<16>(int src, char *dest);
+template bool SpiritIntToStr<10>(int src, char *dest);
+template bool SpiritIntToStr<2>(int src, char *dest);
+
+
+//inputs spirit handled in its own way: prefix parses, overflows, signs, nan/inf spellings and incomplete exponents
+static const char *EdgeCases[] =
+{
+	"", " ", " 1", "+", "-", "+-1", "--1", "0", "-0", "+0", "00012", "12abc", "1 2", "1,5", "0x10", "1e", "1e+", "1e-", "1E5",
+	"2147483647", "2147483648", "-2147483648", "-2147483649", "99999999999", "4294967296", "000000000000002147483647",
+	".", ".5", "5.", "-.5", "+.5e1", "1.5e3x", "1.2.3", "1e39", "-1e39", "3.4028235e38", "3.4028236e38", "1e-38", "1e-45", "1e-46", "1e-50",
+	"0.000000000000000000000000000000000000000000001", "123456789012345678901234567890", "1.00000005960464477539", "16777217",
+	"nan", "NaN", "NAN", "-nan", "+nan", "nan(123)", "1nan", "nana", "na", "inf", "INF", "-inf", "+Inf", "infinity", "INFINITY",
+	"infinit", "infx", "in", "1inf", "i", "n", "e5", "-e5", ".e5", "5e5.5", "1e0000000000000005", "1e-0000000005", "1e99999999999"
+};
+
+
+//random strings of number characters, and random numbers printed in different notations
+static void BuildCorpus(vector<string> &corpus)
+{
+	for(size_t i = 0; i < sizeof(EdgeCases) / sizeof(EdgeCases[0]); ++i)
+		corpus.push_back(EdgeCases[i]);
+
+	CRandom Random;
+	static const char Alphabet[] = "0123456789+-.eEnaifNAIFty x";
+	for(unsigned int i = 0; i < 200000; ++i)
+	{
+		string str;
+		for(unsigned int len = Random.Next(13); len > 0; --len)
+			str += Alphabet[Random.Next(sizeof(Alphabet) - 1)];
+		corpus.push_back(str);
+	}
+
+	char buf[64];
+	for(unsigned int i = 0; i < 200000; ++i)
+	{
+		switch(i % 4)
+		{
+			case 0:
+				sprintf(buf, "%d", static_cast<int>(Random.Next()) >> Random.Next(32));
+				break;
+			case 1:
+			{
+				boost::uint32_t bits = Random.Next();
+				float value;
+				memcpy(&value, &bits, sizeof(float));
+				sprintf(buf, "%.*g", 1 + Random.Next(10), value);
+				break;
+			}
+			case 2:
+				sprintf(buf, "%.*f", Random.Next(8), (static_cast<int>(Random.Next()) >> Random.Next(32)) / 1000.0f);
+				break;
+			case 3:
+				sprintf(buf, "%.*e", Random.Next(12), (static_cast<int>(Random.Next()) >> Random.Next(32)) * 1.5e-10);
+				break;
+		}
+		corpus.push_back(buf);
+	}
+}
+
+//the results of the timed loops, so they can't be optimized away
+static volatile unsigned int Sink = 0;
+
+
+//the new parsers fail on overflows, the vendored spirit wraps around; true if the digits (after an optional sign) don't fit into an int
+static bool IsIntOverflow(const char *str)
+{
+	bool IsNegative = false;
+	if(*str == '+' || *str == '-')
+		IsNegative = (*(str++) == '-');
+
+	double Value = 0.0;
+	bool HasDigits = false;
+	for( ; *str >= '0' && *str <= '9'; ++str, HasDigits = true)
+		Value = Value * 10.0 + (*str - '0');
+	return HasDigits && Value > (IsNegative ? 2147483648.0 : 2147483647.0);
+}
+
+//the new parser rounds correctly, spirit didn't always; a different value is only an error if it's not the correctly rounded one
+static bool IsSameFloat(float lhs, float rhs)
+{
+	return (lhs != lhs && rhs != rhs) || memcmp(&lhs, &rhs, sizeof(float)) == 0;
+}
+
+static unsigned int CheckStrToNumber(const vector<string> &corpus)
+{
+	unsigned int NumMismatches = 0, NumOverflows = 0, NumRoundingFixes = 0;
+	for(size_t i = 0; i < corpus.size(); ++i)
+	{
+		//the length versions mustn't read past the given length, so a digit follows it
+		const string &str = corpus[i];
+		const string padded = str + '7';
+		const char *src = str.c_str();
+
+		int SpiritInt = 0, NewInt = 0, NewLenInt = 0;
+		const bool
+			SpiritIntRet = SpiritStrToInt(src, src + str.length(), SpiritInt),
+			NewIntRet = ConvertStrToInt(src, NewInt),
+			NewLenIntRet = ConvertStrToInt(padded.c_str(), str.length(), NewLenInt);
+		if(SpiritIntRet && !NewIntRet && !NewLenIntRet && IsIntOverflow(src))
+			++NumOverflows;
+		else if(SpiritIntRet != NewIntRet || SpiritIntRet != NewLenIntRet || (SpiritIntRet && (SpiritInt != NewInt || SpiritInt != NewLenInt)))
+		{
+			if(NumMismatches++ < 20)
+				printf("  int mismatch for \"%s\": spirit %d (%d), new %d (%d), new with length %d (%d)\n", src, SpiritIntRet, SpiritInt, NewIntRet, NewInt, NewLenIntRet, NewLenInt);
+		}
+
+		float SpiritFloat = 0.0f, NewFloat = 0.0f, NewLenFloat = 0.0f;
+		const bool
+			SpiritFloatRet = SpiritStrToFloat(src, src + str.length(), SpiritFloat),
+			NewFloatRet = ConvertStrToFloat(src, NewFloat),
+			NewLenFloatRet = ConvertStrToFloat(padded.c_str(), str.length(), NewLenFloat);
+		const char *Exponent = strpbrk(src, "eE");
+		if(SpiritFloatRet && !NewFloatRet && !NewLenFloatRet && Exponent != NULL && IsIntOverflow(Exponent + 1))
+			++NumOverflows;
+		else if(SpiritFloatRet != NewFloatRet || SpiritFloatRet != NewLenFloatRet || (NewFloatRet && !IsSameFloat(NewFloat, NewLenFloat)))
+		{
+			if(NumMismatches++ < 20)
+				printf("  float mismatch for \"%s\": spirit %d (%g), new %d (%g), new with length %d (%g)\n", src, SpiritFloatRet, SpiritFloat, NewFloatRet, NewFloat, NewLenFloatRet, NewLenFloat);
+		}
+		else if(SpiritFloatRet && !IsSameFloat(SpiritFloat, NewFloat))
+		{
+			//strtof rounds correctly; it accepts more than spirit (hex, whitespace), but not for strings both parsers accepted
+			if(IsSameFloat(strtof(src, NULL), NewFloat))
+				++NumRoundingFixes;
+			else if(NumMismatches++ < 20)
+				printf("  float value mismatch for \"%s\": spirit %.9g, new %.9g, strtof %.9g\n", src, SpiritFloat, NewFloat, strtof(src, NULL));
+		}
+	}
+	printf("  %u strings parsed, %u mismatches, %u overflows rejected where spirit wrapped around, %u values rounded correctly where spirit didn't\n",
+		static_cast<unsigned int>(corpus.size()), NumMismatches, NumOverflows, NumRoundingFixes);
+	return NumMismatches;
+}
+
+template<unsigned int B>
+static unsigned int CheckIntToStr(const vector<int> &values)
+{
+	unsigned int NumMismatches = 0;
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		char SpiritBuf[36], NewBuf[36], DefaultBuf[36];
+		const bool
+			SpiritRet = SpiritIntToStr<B>(values[i], SpiritBuf),
+			NewRet = ConvertIntToStr<B>(values[i], NewBuf),
+			DefaultRet = (B == 10) ? ConvertIntToStr(values[i], DefaultBuf) : NewRet; //the non-template version is base 10
+		if(B != 10)
+			strcpy(DefaultBuf, NewBuf);
+		if(SpiritRet != NewRet || SpiritRet != DefaultRet || strcmp(SpiritBuf, NewBuf) != 0 || strcmp(SpiritBuf, DefaultBuf) != 0)
+		{
+			if(NumMismatches++ < 20)
+				printf("  base %u mismatch for %d: spirit \"%s\", new \"%s\" / \"%s\"\n", B, values[i], SpiritBuf, NewBuf, DefaultBuf);
+		}
+	}
+	return NumMismatches;
+}
+
+template<unsigned int B>
+static void TimeIntToStr(const char *name, const vector<int> &values)
+{
+	char buf[36];
+	CStopwatch SpiritTimer;
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		SpiritIntToStr<B>(values[i], buf);
+		Sink += buf[0];
+	}
+	const unsigned int SpiritTime = SpiritTimer.Elapsed();
+
+	CStopwatch NewTimer;
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		ConvertIntToStr<B>(values[i], buf);
+		Sink += buf[0];
+	}
+	PrintTiming(name, static_cast<unsigned int>(values.size()), SpiritTime, NewTimer.Elapsed());
+}
+
+
+unsigned int BenchConvert()
+{
+	printf("\nnumber conversions (boost::spirit -> own parsers and formatters)\n");
+
+	vector<string> Corpus;
+	BuildCorpus(Corpus);
+	unsigned int NumMismatches = CheckStrToNumber(Corpus);
+
+	vector<int> Values;
+	static const int EdgeValues[] = { 0, 1, -1, 9, 10, -10, 15, 16, 255, 256, 2147483647, -2147483647, -2147483647 - 1 };
+	Values.assign(EdgeValues, EdgeValues + sizeof(EdgeValues) / sizeof(EdgeValues[0]));
+	CRandom Random;
+	for(unsigned int i = 0; i < 1000000; ++i)
+		Values.push_back(static_cast<int>(Random.Next()) >> Random.Next(32));
+	const unsigned int NumIntMismatches = CheckIntToStr<10>(Values) + CheckIntToStr<16>(Values) + CheckIntToStr<2>(Values);
+	printf("  %u integers formatted in base 10, 16 and 2, %u mismatches\n", static_cast<unsigned int>(Values.size()), NumIntMismatches);
+	NumMismatches += NumIntMismatches;
+
+	//valid numbers only, that's what the cache natives usually see
+	vector<string> Numbers(Corpus.end() - 200000, Corpus.end());
+	int IntVal = 0;
+	float FloatVal = 0.0f;
+	CStopwatch SpiritIntTimer;
+	for(size_t i = 0; i < Numbers.size(); ++i)
+		Sink += SpiritStrToInt(Numbers[i].c_str(), Numbers[i].c_str() + Numbers[i].length(), IntVal) ? IntVal : 0;
+	const unsigned int SpiritIntTime = SpiritIntTimer.Elapsed();
+	CStopwatch NewIntTimer;
+	for(size_t i = 0; i < Numbers.size(); ++i)
+		Sink += ConvertStrToInt(Numbers[i].c_str(), Numbers[i].length(), IntVal) ? IntVal : 0;
+	PrintTiming("string -> int", static_cast<unsigned int>(Numbers.size()), SpiritIntTime, NewIntTimer.Elapsed());
+
+	CStopwatch SpiritFloatTimer;
+	for(size_t i = 0; i < Numbers.size(); ++i)
+		Sink += SpiritStrToFloat(Numbers[i].c_str(), Numbers[i].c_str() + Numbers[i].length(), FloatVal) ? 1 : 0;
+	const unsigned int SpiritFloatTime = SpiritFloatTimer.Elapsed();
+	CStopwatch NewFloatTimer;
+	for(size_t i = 0; i < Numbers.size(); ++i)
+		Sink += ConvertStrToFloat(Numbers[i].c_str(), Numbers[i].length(), FloatVal) ? 1 : 0;
+	PrintTiming("string -> float", static_cast<unsigned int>(Numbers.size()), SpiritFloatTime, NewFloatTimer.Elapsed());
+
+	TimeIntToStr<10>("int -> string (base 10)", Values);
+	TimeIntToStr<16>("int -> string (base 16)", Values);
+	TimeIntToStr<2>("int -> string (base 2)", Values);
+	return NumMismatches;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "bench.h"
+#include "misc.h"
+
+#ifdef WIN32
+	#include <WinSock2.h>
+#endif
+#include "mysql_include/mysql.h"
+
+#include <cstdio>
+#include <cstring>
+
+
+struct SCharset
+{
+	const char *Name;
+	e_EscapeCharset EscapeCharset;
+};
+
+static const SCharset Charsets[] =
+{
+	{ "latin1", ESCAPE_CHARSET_SINGLE_BYTE },
+	{ "utf8", ESCAPE_CHARSET_UTF8 },
+	{ "utf8mb4", ESCAPE_CHARSET_UTF8MB4 }
+};
+
+
+//byte sequences around the multi-byte checks: truncated characters, bad continuation bytes, overlong forms,
+//surrogates, code points above U+10FFFF and 4-byte characters (invalid in utf8), each followed by a quote
+static const char *InvalidSequences[] =
+{
+	"\x80", "\xbf", "\xc0\xaf", "\xc1\xbf", "\xc2", "\xc2\x7f", "\xc2\xc0", "\xdf\xbf", "\xe0\x80\x80", "\xe0\x9f\xbf", "\xe0\xa0\x80",
+	"\xe1\x80", "\xed\xa0\x80", "\xef\xbf\xbf", "\xf0\x8f\xbf\xbf", "\xf0\x90\x80\x80", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf",
+	"\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xf0\x90\x80", "\xf8\x88\x80\x80\x80", "\xfe", "\xff"
+};
+
+static void AddRandomBytes(CRandom &random, size_t len, string &str)
+{
+	for(size_t i = 0; i < len; ++i)
+		str += static_cast<char>(random.Next(256));
+}
+
+//text with rare special characters and some multi-byte characters, long enough for the SSE2 blocks
+static void AddRandomText(CRandom &random, size_t len, string &str)
+{
+	static const char *Chars[] = { "'", "\"", "\\", "\n", "\r", "\032", "\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+	while(str.length() < len)
+	{
+		const unsigned int r = random.Next(64);
+		if(r < sizeof(Chars) / sizeof(Chars[0]))
+			str += Chars[r];
+		else if(r == 63)
+			str += '\0';
+		else
+			str += static_cast<char>('0' + r);
+	}
+}
+
+static void BuildCorpus(vector<string> &corpus)
+{
+	CRandom Random;
+	for(unsigned int i = 0; i < 100000; ++i)
+	{
+		string str;
+		AddRandomBytes(Random, Random.Next(48), str);
+		corpus.push_back(str);
+	}
+	for(unsigned int i = 0; i < 5000; ++i)
+	{
+		string str;
+		AddRandomText(Random, Random.Next(2048), str);
+		corpus.push_back(str);
+	}
+	//invalid sequences at every position of a 16 byte block, and at the end of the string
+	for(size_t s = 0; s < sizeof(InvalidSequences) / sizeof(InvalidSequences[0]); ++s)
+	{
+		for(size_t pos = 0; pos < 40; ++pos)
+		{
+			string str(pos, 'a');
+			str += InvalidSequences[s];
+			corpus.push_back(str);
+			corpus.push_back(str + "'" + string(20, 'b'));
+			corpus.push_back(str + "\\" + InvalidSequences[(s + pos) % (sizeof(InvalidSequences) / sizeof(InvalidSequences[0]))]);
+		}
+	}
+}
+
+
+static unsigned int CompareEscaper(MYSQL *mysql, e_EscapeCharset charset, bool no_backslash_escapes, const vector<string> &corpus)
+{
+	unsigned int NumMismatches = 0;
+	vector<char> MySQLBuf, NewBuf;
+	for(size_t i = 0; i < corpus.size(); ++i)
+	{
+		const string &str = corpus[i];
+		MySQLBuf.resize(str.length() * 2 + 1);
+		NewBuf.resize(str.length() * 2 + 1);
+		const size_t
+			MySQLLen = mysql_real_escape_string(mysql, &MySQLBuf[0], str.data(), str.length()),
+			NewLen = EscapeSQLString(str.data(), str.length(), &NewBuf[0], charset, no_backslash_escapes);
+		if(MySQLLen != NewLen || memcmp(&MySQLBuf[0], &NewBuf[0], NewLen + 1) != 0)
+		{
+			if(NumMismatches++ < 5)
+			{
+				printf("  mismatch for input #%u (%u bytes):", static_cast<unsigned int>(i), static_cast<unsigned int>(str.length()));
+				for(size_t c = 0; c < str.length() && c < 48; ++c)
+					printf(" %02x", static_cast<unsigned char>(str[c]));
+				printf("\n");
+			}
+		}
+	}
+	return NumMismatches;
+}
+
+static void TimeEscaper(MYSQL *mysql, e_EscapeCharset charset, const char *name)
+{
+	//1 KiB strings of text, 16 MiB in total
+	CRandom Random;
+	string Text;
+	AddRandomText(Random, 1024, Text);
+	Text.resize(1024);
+	static const unsigned int NumRuns = 16 * 1024;
+	vector<char> Buf(Text.length() * 2 + 1);
+
+	size_t checksum = 0;
+	CStopwatch MySQLTimer;
+	for(unsigned int r = 0; r < NumRuns; ++r)
+		checksum += mysql_real_escape_string(mysql, &Buf[0], Text.data(), Text.length());
+	const unsigned int MySQLTime = MySQLTimer.Elapsed();
+
+	CStopwatch NewTimer;
+	for(unsigned int r = 0; r < NumRuns; ++r)
+		checksum -= EscapeSQLString(Text.data(), Text.length(), &Buf[0], charset, false);
+	const unsigned int NewTime = NewTimer.Elapsed();
+
+	char Name[48];
+	sprintf(Name, "%s, 1 KiB strings", name);
+	PrintTiming(Name, NumRuns, MySQLTime, NewTime);
+	printf("  %-32s old: %7.1f MiB/s    new: %7.1f MiB/s\n", "", NumRuns / 1024.0 / (MySQLTime / 1000000.0), NumRuns / 1024.0 / (NewTime / 1000000.0));
+	if(checksum != 0)
+		printf("  (checksum %u)\n", static_cast<unsigned int>(checksum));
+}
+
+
+unsigned int BenchEscape(const char *host, const char *user, const char *pass, const char *db, unsigned int port)
+{
+	printf("\nescaper (mysql_real_escape_string -> built-in SSE2 escaper)\n");
+
+	vector<string> Corpus;
+	BuildCorpus(Corpus);
+
+	unsigned int NumMismatches = 0;
+	for(size_t c = 0; c < sizeof(Charsets) / sizeof(Charsets[0]); ++c)
+	{
+		//mysql_real_escape_string uses the character set of the connection, so every one gets its own
+		MYSQL *mysql = mysql_init(NULL);
+		mysql_options(mysql, MYSQL_SET_CHARSET_NAME, Charsets[c].Name);
+		if(mysql_real_connect(mysql, host, user, pass, db, port, NULL, 0) == NULL)
+		{
+			printf("  could not connect with character set %s: (error #%d) %s\n", Charsets[c].Name, mysql_errno(mysql), mysql_error(mysql));
+			mysql_close(mysql);
+			++NumMismatches;
+			continue;
+		}
+
+		//libmysqlclient reads NO_BACKSLASH_ESCAPES from the server status, which is updated by every query
+		for(int mode = 0; mode < 2; ++mode)
+		{
+			const bool NoBackslashEscapes = (mode == 1);
+			const char *SqlMode = NoBackslashEscapes ? "SET SESSION sql_mode = 'NO_BACKSLASH_ESCAPES'" : "SET SESSION sql_mode = ''";
+			if(mysql_query(mysql, SqlMode) != 0)
+			{
+				printf("  could not set sql_mode: (error #%d) %s\n", mysql_errno(mysql), mysql_error(mysql));
+				++NumMismatches;
+				continue;
+			}
+
+			const unsigned int NumCharsetMismatches = CompareEscaper(mysql, Charsets[c].EscapeCharset, NoBackslashEscapes, Corpus);
+			printf("  %s%s: %u strings escaped, %u mismatches\n", Charsets[c].Name, NoBackslashEscapes ? " (NO_BACKSLASH_ESCAPES)" : "",
+				static_cast<unsigned int>(Corpus.size()), NumCharsetMismatches);
+			NumMismatches += NumCharsetMismatches;
+
+			if(!NoBackslashEscapes)
+				TimeEscaper(mysql, Charsets[c].EscapeCharset, Charsets[c].Name);
+		}
+		mysql_close(mysql);
+	}
+	return NumMismatches;
+}
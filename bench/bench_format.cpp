@@ -0,0 +1,366 @@
+#pragma once
+
+#include "bench.h"
+#include "CFormatter.h"
+#include "CMySQLHandle.h"
+#include "misc.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+
+//mysql_format as it was up to R35 (without the native's checks and logging), the format string is parsed on every call
+//and the output length is measured for every character
+static void LegacyFormat(AMX *amx, cell *params, MYSQL *mysql, size_t dest_len, string &output)
+{
+	char *format_str = NULL;
+	amx_StrParam(amx, params[4], format_str);
+
+	char *output_str = (char *)calloc(dest_len * 2, sizeof(char)); //*2 just for safety, what if user specified wrong DestLen?
+	char *org_output_str = output_str;
+
+	const unsigned int first_param_idx = 5;
+	const unsigned int num_args = (params[0] / sizeof(cell));
+	const unsigned int num_dyn_args = num_args - (first_param_idx - 1);
+	unsigned int param_counter = 0;
+
+	for( ; format_str != NULL && *format_str != '\0'; ++format_str)
+	{
+		if(strlen(org_output_str) >= dest_len)
+			break;
+
+		if(*format_str == '%')
+		{
+			++format_str;
+
+			if(*format_str == '%')
+			{
+				*output_str = '%';
+				++output_str;
+				continue;
+			}
+
+			if(param_counter >= num_dyn_args)
+				continue;
+
+			bool SpaceWidth = true;
+			int Width = -1;
+			int Precision = -1;
+
+			if(*format_str == '0')
+			{
+				SpaceWidth = false;
+				++format_str;
+			}
+			if(*format_str > '0' && *format_str <= '9')
+			{
+				Width = 0;
+				while(*format_str >= '0' && *format_str <= '9')
+				{
+					Width *= 10;
+					Width += *format_str - '0';
+					++format_str;
+				}
+			}
+
+			if(*format_str == '.')
+			{
+				++format_str;
+				Precision = *format_str - '0';
+				++format_str;
+			}
+
+			cell *amx_address = NULL;
+			amx_GetAddr(amx, params[first_param_idx + param_counter], &amx_address);
+
+			switch (*format_str)
+			{
+				case 'i':
+				case 'I':
+				case 'd':
+				case 'D':
+				{
+					char NumBuf[13];
+					SpiritIntToStr<10>(*amx_address, NumBuf);
+					size_t NumBufLen = strlen(NumBuf);
+					for(int len = (int)NumBufLen; Width > len; ++len)
+					{
+						if(SpaceWidth == true)
+							*output_str = ' ';
+						else
+							*output_str = '0';
+						++output_str;
+					}
+
+					for(size_t c=0; c < NumBufLen; ++c)
+					{
+						*output_str = NumBuf[c];
+						++output_str;
+					}
+					break;
+				}
+				case 'z':
+				case 'Z':
+				case 's':
+				case 'S':
+				{
+					char *StrBuf = NULL;
+					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
+					if(StrBuf != NULL)
+					{
+						for(size_t c=0, len = strlen(StrBuf); c < len; ++c)
+						{
+							*output_str = StrBuf[c];
+							++output_str;
+						}
+					}
+
+					break;
+				}
+				case 'f':
+				case 'F':
+				{
+					float FloatVal = amx_ctof(*amx_address);
+					char
+						FloatBuf[84+1],
+						SpecBuf[13];
+
+					SpiritIntToStr<10>((int)floor(FloatVal), FloatBuf);
+					for(int len = (int)strlen(FloatBuf); Width > len; ++len)
+					{
+						if(SpaceWidth == true)
+							*output_str = ' ';
+						else
+							*output_str = '0';
+						++output_str;
+					}
+
+					if(Precision <= 6 && Precision >= 0)
+						sprintf(SpecBuf, "%%.%df", Precision);
+					else
+						sprintf(SpecBuf, "%%f");
+
+					sprintf(FloatBuf, SpecBuf, FloatVal);
+
+					for(size_t c=0, len = strlen(FloatBuf); c < len; ++c)
+					{
+						*output_str = FloatBuf[c];
+						++output_str;
+					}
+					break;
+				}
+				case 'e':
+				case 'E':
+				{
+					char *StrBuf = NULL;
+					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
+					if(StrBuf != NULL)
+					{
+						//CMySQLConnection::EscapeString of R35
+						string escaped_str;
+						size_t src_len = strlen(StrBuf);
+						char *escaped_buf = (char *)malloc((src_len*2 + 1) * sizeof(char));
+						mysql_real_escape_string(mysql, escaped_buf, StrBuf, src_len);
+						escaped_str.assign(escaped_buf);
+						free(escaped_buf);
+
+						for(size_t c=0, len = escaped_str.length(); c < len; ++c)
+						{
+							*output_str = escaped_str.at(c);
+							++output_str;
+						}
+					}
+					break;
+				}
+				case 'X':
+				{
+					char HexBuf[17];
+					memset(HexBuf, 0, 17);
+					SpiritIntToStr<16>(*amx_address, HexBuf);
+
+					for(size_t c=0, len = strlen(HexBuf); c < len; ++c)
+					{
+						if(HexBuf[c] >= 'a' && HexBuf[c] <= 'f')
+							HexBuf[c] = toupper(HexBuf[c]);
+
+						*output_str = HexBuf[c];
+						++output_str;
+					}
+
+					break;
+				}
+				case 'x':
+				{
+					char HexBuf[17];
+					memset(HexBuf, 0, 17);
+					SpiritIntToStr<16>(*amx_address, HexBuf);
+
+					for(size_t c=0, len = strlen(HexBuf); c < len; ++c)
+					{
+						*output_str = HexBuf[c];
+						++output_str;
+					}
+					break;
+				}
+				case 'b':
+				case 'B':
+				{
+					char BinBuf[33];
+					memset(BinBuf, 0, 33);
+					SpiritIntToStr<2>(*amx_address, BinBuf);
+
+					for(size_t c=0, len = strlen(BinBuf); c < len; ++c)
+					{
+						*output_str = BinBuf[c];
+						++output_str;
+					}
+					break;
+				}
+			}
+			param_counter++;
+		}
+		else
+		{
+			*output_str = *format_str;
+			++output_str;
+		}
+	}
+
+	*output_str = '\0';
+	//amx_SetCString cuts the output to the destination size
+	output.assign(org_output_str, std::min(strlen(org_output_str), dest_len - 1));
+	free(org_output_str);
+}
+
+
+struct SFormatCase
+{
+	const char *Format;
+	const char *Args; //specifier of every argument: i(nt), f(loat), s(tring), e(scaped string)
+};
+
+//typical queries of gamemodes, and every specifier with widths and precisions
+static const SFormatCase FormatCases[] =
+{
+	{ "SELECT * FROM `players` WHERE `name` = '%s' LIMIT 1", "s" },
+	{ "UPDATE `players` SET `money` = %d, `score` = %d, `kills` = %d, `deaths` = %d, `x` = %f, `y` = %f, `z` = %f WHERE `id` = %d", "iiiifffi" },
+	{ "INSERT INTO `log` (`time`, `player`, `action`, `value`) VALUES (%d, %d, '%s', %.2f)", "iisf" },
+	{ "%d|%i|%5d|%05d|%x|%X|%b|%10.3f|%08.1f|%.0f|%f|%s|%%|%z", "iiiiiiiffffss" },
+	{ "SELECT `id` FROM `bans` WHERE `ip` = '%e' OR `name` = '%e'", "ee" }
+};
+
+static void AddRandomString(CFakeAmx &fake_amx, CRandom &random, vector<cell> &params)
+{
+	//printable characters, quotes and backslashes included
+	char buf[64];
+	const unsigned int len = random.Next(sizeof(buf));
+	for(unsigned int c = 0; c < len; ++c)
+		buf[c] = static_cast<char>(' ' + random.Next(95));
+	buf[len] = '\0';
+	params.push_back(fake_amx.PushString(buf));
+}
+
+static void BuildParams(CFakeAmx &fake_amx, CRandom &random, const SFormatCase &format_case, vector<cell> &params)
+{
+	params.assign(5, 0);
+	params[4] = fake_amx.PushString(format_case.Format);
+	for(const char *a = format_case.Args; *a != '\0'; ++a)
+	{
+		switch(*a)
+		{
+			case 'i':
+				params.push_back(fake_amx.PushCell(static_cast<int>(random.Next()) >> random.Next(32)));
+				break;
+			case 'f':
+				params.push_back(fake_amx.PushFloat((static_cast<int>(random.Next()) >> random.Next(32)) / 997.0f));
+				break;
+			default:
+				AddRandomString(fake_amx, random, params);
+		}
+	}
+	params[0] = static_cast<cell>((params.size() - 1) * sizeof(cell));
+}
+
+
+unsigned int BenchFormat(const char *host, const char *user, const char *pass, const char *db, unsigned int port)
+{
+	printf("\nmysql_format (R35 -> cached formats, single pass)\n");
+
+	CMySQLConnection *Connection = NULL;
+	if(host != NULL)
+	{
+		string Host(host), User(user), Pass(pass), Database(db);
+		Connection = CMySQLConnection::Create(Host, User, Pass, Database, port, false);
+		Connection->Connect();
+		if(!Connection->IsConnected())
+		{
+			printf("  could not connect to the MySQL server\n");
+			Connection->Destroy();
+			return 1;
+		}
+	}
+	const size_t NumCases = sizeof(FormatCases) / sizeof(FormatCases[0]) - (Connection == NULL ? 1 : 0);
+	if(Connection == NULL)
+		printf("  \"%%e\" skipped, no server given\n");
+
+	//the parameter sets are built once, the timed loops only format
+	static const size_t DestLen = 4096;
+	static const unsigned int NumParamSets = 500, NumRounds = 40;
+	CFakeAmx FakeAmx;
+	unsigned int NumMismatches = 0;
+	for(size_t f = 0; f < NumCases; ++f)
+	{
+		CRandom Random;
+		FakeAmx.Clear();
+		vector<vector<cell> > ParamSets(NumParamSets);
+		for(unsigned int p = 0; p < NumParamSets; ++p)
+			BuildParams(FakeAmx, Random, FormatCases[f], ParamSets[p]);
+		const string Format(FormatCases[f].Format);
+
+		string LegacyOutput, NewOutput;
+		unsigned int NumCaseMismatches = 0;
+		for(unsigned int p = 0; p < NumParamSets; ++p)
+		{
+			LegacyFormat(FakeAmx.GetAmx(), &ParamSets[p][0], Connection != NULL ? Connection->GetMySQLPointer() : NULL, DestLen, LegacyOutput);
+			CFormatter::Format(FakeAmx.GetAmx(), &ParamSets[p][0], 5, Format.c_str(), Connection, DestLen - 1, NewOutput);
+			if(LegacyOutput != NewOutput && NumCaseMismatches++ < 5)
+				printf("  mismatch for \"%s\":\n    old: \"%s\"\n    new: \"%s\"\n", Format.c_str(), LegacyOutput.c_str(), NewOutput.c_str());
+		}
+		NumMismatches += NumCaseMismatches;
+
+		CStopwatch LegacyTimer;
+		for(unsigned int r = 0; r < NumRounds; ++r)
+			for(unsigned int p = 0; p < NumParamSets; ++p)
+				LegacyFormat(FakeAmx.GetAmx(), &ParamSets[p][0], Connection != NULL ? Connection->GetMySQLPointer() : NULL, DestLen, LegacyOutput);
+		const unsigned int LegacyTime = LegacyTimer.Elapsed();
+
+		//the native reads the format string from the script too
+		CStopwatch NewTimer;
+		for(unsigned int r = 0; r < NumRounds; ++r)
+		{
+			for(unsigned int p = 0; p < NumParamSets; ++p)
+			{
+				string FormatStr;
+				amx_GetStdString(FakeAmx.GetAmx(), ParamSets[p][4], FormatStr);
+				CFormatter::Format(FakeAmx.GetAmx(), &ParamSets[p][0], 5, FormatStr.c_str(), Connection, DestLen - 1, NewOutput);
+			}
+		}
+		const unsigned int NewTime = NewTimer.Elapsed();
+
+		char Name[40];
+		sprintf(Name, "format #%u (%u specifiers)", static_cast<unsigned int>(f + 1), static_cast<unsigned int>(strlen(FormatCases[f].Args)));
+		PrintTiming(Name, NumParamSets * NumRounds, LegacyTime, NewTime);
+	}
+	printf("  %u mismatches\n", NumMismatches);
+
+	if(Connection != NULL)
+	{
+		Connection->Disconnect();
+		Connection->Destroy();
+	}
+	return NumMismatches;
+}
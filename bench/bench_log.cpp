@@ -0,0 +1,111 @@
+#pragma once
+
+#include "bench.h"
+#include "CLog.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+
+
+//the messages contain quotes and backslashes, the HTML log has to escape them;
+//every burst is followed by a short pause, so the log thread gets its share of the CPU on single core machines too
+static void LogMessages(boost::atomic<bool> *running, unsigned int *num_calls)
+{
+	unsigned int calls = 0;
+	while(*running)
+	{
+		for(unsigned int i = 0; i < 32; ++i, calls += 2)
+		{
+			CLOG_FUNCTION(LOG_DEBUG, "BenchLog", "query \"SELECT * FROM `players` WHERE `name` = 'C:\\\\path' AND `id` = %d\" was successful", calls);
+			CLOG_FUNCTION(LOG_WARNING, "BenchLog", "%d rows fetched, %d bytes received (connection: %d)", calls, calls * 64, 1);
+		}
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+	(*num_calls) = calls;
+}
+
+//counts the entries written by LogMessages
+static unsigned int CountEntries(const char *filename, unsigned int logtype)
+{
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL)
+		return 0;
+
+	const char *Marker = (logtype == LOG_TYPE_HTML) ? "Log(\"" : "BenchLog";
+	const size_t MarkerLen = strlen(Marker);
+	unsigned int count = 0;
+	char buf[64 * 1024];
+	string carry;
+	size_t len;
+	while((len = fread(buf, 1, sizeof(buf), file)) > 0)
+	{
+		carry.append(buf, len);
+		for(size_t pos = 0; (pos = carry.find(Marker, pos)) != string::npos; pos += MarkerLen)
+			++count;
+		//a marker may be split between two reads
+		carry.erase(0, carry.length() > MarkerLen ? carry.length() - MarkerLen + 1 : 0);
+	}
+	fclose(file);
+	return count;
+}
+
+
+unsigned int BenchLog(unsigned int logtype, unsigned int seconds)
+{
+	const bool IsHtml = (logtype == LOG_TYPE_HTML);
+	printf("\n%s log, sustained throughput (%u seconds, 4 threads logging in bursts of 64 entries per millisecond)\n", IsHtml ? "HTML" : "text", seconds);
+
+	const char *FileName = IsHtml ? "bench_log.html" : "bench_log.txt";
+	remove(FileName);
+	CLog::Get()->Initialize("bench_log.txt");
+	CLog::Get()->SetLogType(logtype);
+	CLog::Get()->SetLogLevel(LOG_ERROR | LOG_WARNING | LOG_DEBUG);
+
+	//the main thread also marks callbacks, like ProcessCallbacks does
+	static const unsigned int NumThreads = 3;
+	boost::atomic<bool> Running(true);
+	unsigned int NumCalls[NumThreads + 1] = { 0 };
+	vector<boost::thread *> Threads;
+	CStopwatch Timer;
+	for(unsigned int t = 0; t < NumThreads; ++t)
+		Threads.push_back(new boost::thread(&LogMessages, &Running, &NumCalls[t + 1]));
+
+	unsigned int MainCalls = 0;
+	while(Timer.Elapsed() < seconds * 1000000)
+	{
+		CLog::Get()->StartCallback("OnBenchLog");
+		for(unsigned int i = 0; i < 64; ++i, ++MainCalls)
+			CLOG_FUNCTION(LOG_DEBUG, "BenchLog", "cache_get_field_content(%d, \"name\") = \"%s\"", i, "Player_\\\"Name\\\"");
+		CLog::Get()->EndCallback();
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+	NumCalls[0] = MainCalls;
+	Running = false;
+	for(unsigned int t = 0; t < NumThreads; ++t)
+	{
+		Threads[t]->join();
+		delete Threads[t];
+	}
+	const unsigned int LogTime = Timer.Elapsed();
+
+	//the log thread writes everything queued before it stops
+	CLog::Delete();
+	const unsigned int TotalTime = Timer.Elapsed();
+
+	unsigned int TotalCalls = 0;
+	for(unsigned int t = 0; t <= NumThreads; ++t)
+		TotalCalls += NumCalls[t];
+	const unsigned int NumWritten = CountEntries(FileName, logtype);
+	if(NumWritten == 0)
+	{
+		printf("  no entries found in \"%s\"\n", FileName);
+		return 1;
+	}
+
+	printf("  %u log calls (%.0f calls/s), %u entries written (%.0f entries/s), %.1f%% dropped because the log thread couldn't keep up\n",
+		TotalCalls, TotalCalls / (LogTime / 1000000.0), NumWritten, NumWritten / (TotalTime / 1000000.0),
+		100.0 * (TotalCalls - std::min(NumWritten, TotalCalls)) / TotalCalls);
+	return 0;
+}
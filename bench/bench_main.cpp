@@ -0,0 +1,114 @@
+#pragma once
+
+#include "bench.h"
+#include "CLog.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+extern void *pAMXFunctions;
+
+
+static int AMXAPI FakeGetAddr(AMX *amx, cell amx_addr, cell **phys_addr)
+{
+	(*phys_addr) = reinterpret_cast<cell *>(amx->base + amx_addr);
+	return AMX_ERR_NONE;
+}
+
+
+CFakeAmx::CFakeAmx() :
+	m_Data(1024 * 1024), //never grows, addresses have to stay valid
+	m_DataUsed(0)
+{
+	memset(&m_Amx, 0, sizeof(AMX));
+	m_Amx.base = reinterpret_cast<unsigned char *>(&m_Data[0]);
+}
+
+CFakeAmx::~CFakeAmx()
+{ }
+
+cell CFakeAmx::PushCell(cell value)
+{
+	if(m_DataUsed + 1 > m_Data.size())
+	{
+		fprintf(stderr, "fake AMX data segment is full\n");
+		exit(1);
+	}
+	m_Data[m_DataUsed] = value;
+	return static_cast<cell>(m_DataUsed++ * sizeof(cell));
+}
+
+cell CFakeAmx::PushFloat(float value)
+{
+	return PushCell(amx_ftoc(value));
+}
+
+cell CFakeAmx::PushString(const char *str)
+{
+	const cell address = PushCell(static_cast<cell>(static_cast<unsigned char>(*str)));
+	if(*str != '\0')
+	{
+		while(*(++str) != '\0')
+			PushCell(static_cast<cell>(static_cast<unsigned char>(*str)));
+		PushCell(0);
+	}
+	return address;
+}
+
+void CFakeAmx::Clear()
+{
+	m_DataUsed = 0;
+}
+
+
+void PrintTiming(const char *name, unsigned int num_ops, unsigned int old_time, unsigned int new_time)
+{
+	printf("  %-32s old: %10.0f ops/s  new: %10.0f ops/s  speedup: %5.2fx\n", name,
+		num_ops / (old_time / 1000000.0), num_ops / (new_time / 1000000.0), static_cast<double>(old_time) / new_time);
+}
+
+
+int main(int argc, char *argv[])
+{
+	//only amx_GetAddr is used, all strings are unpacked
+	static void *AmxFunctions[PLUGIN_AMX_EXPORT_UTF8Put + 1] = { NULL };
+	AmxFunctions[PLUGIN_AMX_EXPORT_GetAddr] = reinterpret_cast<void *>(&FakeGetAddr);
+	pAMXFunctions = AmxFunctions;
+
+	unsigned int LogType = LOG_TYPE_HTML;
+	if(argc > 1 && strcmp(argv[1], "--text-log") == 0)
+	{
+		LogType = LOG_TYPE_TEXT;
+		--argc;
+		++argv;
+	}
+	if(argc != 1 && argc != 5 && argc != 6)
+	{
+		printf("usage: bench [--text-log] [host user password database [port]]\n");
+		printf("without a server the escaper and the \"%%e\" specifier aren't compared\n");
+		return 1;
+	}
+	const char
+		*Host = argc > 1 ? argv[1] : NULL,
+		*User = argc > 1 ? argv[2] : NULL,
+		*Pass = argc > 1 ? argv[3] : NULL,
+		*Database = argc > 1 ? argv[4] : NULL;
+	const unsigned int Port = argc > 5 ? static_cast<unsigned int>(atoi(argv[5])) : 3306;
+
+	//the plugin's own error messages would only slow the suites down
+	CLog::Get()->SetLogLevel(LOG_NONE);
+
+	unsigned int NumMismatches = 0;
+	NumMismatches += BenchConvert();
+	NumMismatches += BenchFormat(Host, User, Pass, Database, Port);
+	if(Host != NULL)
+		NumMismatches += BenchEscape(Host, User, Pass, Database, Port);
+	else
+		printf("\nescaper: skipped, no server given\n");
+	NumMismatches += BenchLog(LogType, 5);
+
+	printf("\n%u mismatches\n", NumMismatches);
+	return NumMismatches == 0 ? 0 : 1;
+}
@@ -10,26 +10,56 @@
 
 #include "misc.h"
 #include <cstdio>
+#include <cstring>
 
 
-boost::lockfree::queue<
-		CMySQLQuery*, 
-		boost::lockfree::fixed_sized<true>,
-		boost::lockfree::capacity<8192>
-	> CCallback::m_CallbackQueue;
+boost::lockfree::queue<CMySQLQuery*> CCallback::m_CallbackQueue(1024);
+deque<CMySQLQuery*> CCallback::m_DetachQueue;
+CMySQLQuery *CCallback::m_ActiveQuery = NULL;
 
 list<AMX *> CCallback::m_AmxList;
+boost::unordered_map<AMX *, boost::unordered_map<string, int> > CCallback::m_PublicCache;
+
+boost::atomic<unsigned int> 
+	CCallback::m_PendingCount(0),
+	CCallback::m_HighWater(0),
+	CCallback::m_Overflows(0);
+unsigned int 
+	CCallback::m_CarryOverTicks = 0,
+	CCallback::m_OverrunTicks = 0,
+	CCallback::m_MaxTickTime = 0;
 
 
 void CCallback::ProcessCallbacks() 
 {
+	const unsigned int 
+		TimeBudget = MySQLOptions.CallbackTimeBudget,
+		CountBudget = MySQLOptions.CallbackCountBudget;
+	const bool HasBudget = (TimeBudget != 0 || CountBudget != 0);
+	
+	boost::posix_time::ptime StartTime;
+	if(HasBudget)
+		StartTime = boost::posix_time::microsec_clock::universal_time();
+	unsigned int ElapsedTime = 0;
+	unsigned int NumProcessed = 0;
+
 	CMySQLQuery *Query = NULL;
 	while( (Query = GetNextQuery()) != NULL) 
 	{
 		CCallback *Callback = Query->Callback;
+		const boost::posix_time::ptime CallbackTime = boost::posix_time::microsec_clock::universal_time();
+		//the handle was closed before the result could be processed
+		if(Query->ConnHandle == NULL)
+		{
+			if(Callback != NULL && Callback->Name.length() > 0)
+				CLOG_FUNCTION(LOG_WARNING, "CCallback::ProcessCallbacks", "connection handle was closed, callback \"%s\" is not called", Callback->Name.c_str());
+		}
+		else
+			Query->ConnHandle->GetMetrics().AddTime(TIMER_CALLBACK_WAIT, static_cast<unsigned int>((CallbackTime - Query->CallbackQueueTime).total_microseconds()));
 		 
-		if(Callback != NULL && (Callback->Name.length() > 0 || Query->OrmObject != NULL) ) 
+		if(Query->ConnHandle != NULL && Callback != NULL && (Callback->Name.length() > 0 || Query->OrmObject != NULL) ) 
 		{
+			m_ActiveQuery = Query;
 			if(Query->OrmObject != NULL) //orm, update the variables with the given result
 			{
 				switch(Query->OrmQueryType) 
@@ -51,28 +81,29 @@ void CCallback::ProcessCallbacks()
 				int amx_index;
 				cell amx_mem_addr = -1;
 
-				if (amx_FindPublic(amx, Callback->Name.c_str(), &amx_index) == AMX_ERR_NONE) 
+				if (FindPublic(amx, Callback->Name, &amx_index)) 
 				{
 					CLog::Get()->StartCallback(Callback->Name.c_str());
 
-					while(!Callback->Parameters.empty())
+					//the last parameter has to be pushed first
+					for(size_t p = Callback->Params.size(); p-- > 0; )
 					{
 						cell tmpAddress = -1;
-						boost::variant<cell, string> &param_value = Callback->Parameters.top();
-						if(param_value.type() == typeid(cell))
+						const char *param_data = &Callback->ParamData[Callback->Params[p].Offset];
+						if(Callback->Params[p].IsString == false)
 						{
+							cell param_value;
+							memcpy(&param_value, param_data, sizeof(cell));
 							if(Query->Callback->IsInline == false)
-								amx_Push(amx, boost::get<cell>(param_value));
+								amx_Push(amx, param_value);
 							else
-								amx_PushArray(amx, &tmpAddress, NULL, static_cast<cell*>(&boost::get<cell>(param_value)), 1);
+								amx_PushArray(amx, &tmpAddress, NULL, &param_value, 1);
 						}
 						else
-							amx_PushString(amx, &tmpAddress, NULL, boost::get<string>(param_value).c_str(), 0, 0);
+							amx_PushString(amx, &tmpAddress, NULL, param_data, 0, 0);
 						
 						if(tmpAddress != -1 && amx_mem_addr < NULL)
 							amx_mem_addr = tmpAddress;
-
-						Callback->Parameters.pop();
 					}
 
 
@@ -86,30 +117,104 @@ void CCallback::ProcessCallbacks()
 
 					CMySQLHandle::ActiveHandle = NULL;
 
-					if(Query->ConnHandle->IsActiveResultSaved() == false)
-						Query->ConnHandle->GetActiveResult()->Destroy();
-
-					Query->ConnHandle->SetActiveResult((CMySQLResult *)NULL);
-
 					CLog::Get()->EndCallback();
+					//the callback may have closed the handle
+					if(Query->ConnHandle != NULL)
+					{
+						Query->ConnHandle->ResetActiveResult();
+						Query->ConnHandle->GetMetrics().AddTime(TIMER_CALLBACK_EXEC, static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - CallbackTime).total_microseconds()));
+					}
 					
 					break; //we have found our callback, exit loop
 				}
 			}
+			m_ActiveQuery = NULL;
 		}
 		Query->Destroy();
+		++NumProcessed;
+
+		if(HasBudget)
+		{
+			ElapsedTime = static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - StartTime).total_microseconds());
+			if((CountBudget != 0 && NumProcessed >= CountBudget) || (TimeBudget != 0 && ElapsedTime >= TimeBudget))
+			{
+				//the remaining results stay in the queue for the next tick
+				if(m_PendingCount > 0)
+				{
+					++m_CarryOverTicks;
+					CLOG_FUNCTION(LOG_DEBUG, "CCallback::ProcessCallbacks", "budget used up after %d callbacks (%d microseconds), %d left for the next tick", NumProcessed, ElapsedTime, static_cast<unsigned int>(m_PendingCount));
+				}
+				break;
+			}
+		}
+	}
+
+	if(HasBudget && NumProcessed > 0)
+	{
+		if(TimeBudget != 0 && ElapsedTime > TimeBudget)
+			++m_OverrunTicks;
+		if(ElapsedTime > m_MaxTickTime)
+			m_MaxTickTime = ElapsedTime;
+	}
+}
+
+
+
+void CCallback::AddQueryToQueue(CMySQLQuery *cb) 
+{
+	cb->CallbackQueueTime = boost::posix_time::microsec_clock::universal_time();
+	const unsigned int num_pending = ++m_PendingCount;
+	//the queue only fails if no memory could be allocated; results are never dropped, 
+	//the worker waits until the main thread has freed some memory
+	if(!m_CallbackQueue.push(cb))
+	{
+		m_Overflows++;
+		CLOG_FUNCTION(LOG_ERROR, "CCallback::AddQueryToQueue", "could not queue result, out of memory; retrying");
+		do
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		while(!m_CallbackQueue.push(cb));
+	}
+
+	unsigned int high_water = m_HighWater;
+	while(num_pending > high_water)
+	{
+		if(m_HighWater.compare_exchange_weak(high_water, num_pending))
+		{
+			if(num_pending >= 1024 && (num_pending & (num_pending - 1)) == 0)
+				CLOG_FUNCTION(LOG_WARNING, "CCallback::AddQueryToQueue", "%d results waiting for their callbacks", num_pending);
+			break;
+		}
 	}
 }
 
+bool CCallback::FindPublic(AMX *amx, const string &name, int *index) 
+{
+	boost::unordered_map<string, int> &amx_publics = m_PublicCache[amx];
+	boost::unordered_map<string, int>::iterator p = amx_publics.find(name);
+	if(p == amx_publics.end())
+	{
+		int amx_index = -1;
+		if(amx_FindPublic(amx, name.c_str(), &amx_index) != AMX_ERR_NONE)
+			amx_index = -1;
+		p = amx_publics.insert(std::make_pair(name, amx_index)).first;
+	}
+
+	if(p->second < 0)
+		return false;
+	(*index) = p->second;
+	return true;
+}
 
 
 void CCallback::AddAmx( AMX *amx ) 
 {
 	m_AmxList.push_back(amx);
+	m_PublicCache.erase(amx);
 }
 
 void CCallback::EraseAmx( AMX *amx ) 
 {
+	m_PublicCache.erase(amx);
 	for (list<AMX *>::iterator a = m_AmxList.begin(); a != m_AmxList.end(); ++a) 
 	{
 		if ( (*a) == amx) 
@@ -120,9 +225,29 @@ void CCallback::EraseAmx( AMX *amx )
 	}
 }
 
-void CCallback::ClearAll() {
+void CCallback::DetachHandle(CMySQLHandle *handle)
+{
+	//the lock-free queue can't be searched, so everything is moved over to the detach queue;
+	//newer results are pushed to the lock-free queue, the order is kept this way
 	CMySQLQuery *query = NULL;
 	while(m_CallbackQueue.pop(query))
+		m_DetachQueue.push_back(query);
+
+	for(deque<CMySQLQuery*>::iterator q = m_DetachQueue.begin(), end = m_DetachQueue.end(); q != end; ++q)
+	{
+		if((*q)->ConnHandle == handle)
+		{
+			(*q)->ConnHandle = NULL;
+			(*q)->Connection = NULL;
+		}
+	}
+	if(m_ActiveQuery != NULL && m_ActiveQuery->ConnHandle == handle)
+		m_ActiveQuery->ConnHandle = NULL;
+}
+
+void CCallback::ClearAll() {
+	CMySQLQuery *query = NULL;
+	while( (query = GetNextQuery()) != NULL)
 		query->Destroy();
 }
 
@@ -144,18 +269,48 @@ void CCallback::FillCallbackParams(AMX* amx, cell* params, const char *param_for
 			case 'd':
 			case 'f':
 				amx_GetAddr(amx, params[ConstParamCount + param_idx++], &AddressPtr);
-				Parameters.push(*AddressPtr);
+				AddParam(*AddressPtr);
 				break;
 
 			case 'z':
 			case 's':
 				amx_StrParam(amx, params[ConstParamCount + param_idx++], StrBuf);
-				Parameters.push(StrBuf != NULL ? StrBuf : string());
+				AddParam(StrBuf != NULL ? StrBuf : string());
 				break;
 
 			default:
-				Parameters.push("NULL");
+				AddParam("NULL");
 		} 
 
 	} while(*(++param_format));
 }
+
+void CCallback::AddParam(cell value) 
+{
+	SParam param;
+	param.Offset = ParamData.size();
+	param.IsString = false;
+	Params.push_back(param);
+
+	ParamData.resize(param.Offset + sizeof(cell));
+	memcpy(&ParamData[param.Offset], &value, sizeof(cell));
+}
+
+void CCallback::AddParam(const string &value) 
+{
+	SParam param;
+	param.Offset = ParamData.size();
+	param.IsString = true;
+	Params.push_back(param);
+
+	ParamData.insert(ParamData.end(), value.begin(), value.end());
+	ParamData.push_back('\0');
+}
+
+void CCallback::Reset() 
+{
+	ParamData.clear();
+	Params.clear();
+	Name.clear();
+	IsInline = false;
+}
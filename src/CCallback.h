@@ -4,50 +4,108 @@
 
 
 #include <list>
-#include <stack>
+#include <deque>
+#include <vector>
 #include <string>
 #include <boost/lockfree/queue.hpp>
-#include <boost/variant.hpp>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
 
 using std::list;
-using std::stack;
+using std::deque;
+using std::vector;
 using std::string;
 
 #include "main.h"
+#include "CObjectPool.h"
 
 
 class CMySQLQuery;
+class CMySQLHandle;
 
 
 class CCallback 
 {
 public:
+	friend class CObjectPool<CCallback>;
+
+	static inline CCallback *Create()
+	{
+		return CObjectPool<CCallback>::Acquire();
+	}
+	inline void Destroy()
+	{
+		CObjectPool<CCallback>::Release(this);
+	}
 
 	void FillCallbackParams(AMX* amx, cell* params, const char *param_format, const int ConstParamCount);
 
-	CCallback() :
-		IsInline(false)
-	{}
-	~CCallback() {}
+	//parameters have to be added in the order of the callback's parameter list
+	void AddParam(cell value);
+	void AddParam(const string &value);
 
+	struct SParam
+	{
+		size_t Offset;
+		bool IsString;
+	};
+	//all parameter values packed into one buffer, strings are null-terminated
+	vector<char> ParamData;
+	vector<SParam> Params;
 
-	stack<boost::variant<cell, string> > Parameters;
 	string Name;
 	bool IsInline;
 
 	
 	static void ProcessCallbacks();
 	
-	static inline void AddQueryToQueue(CMySQLQuery *cb) 
-	{
-		m_CallbackQueue.push(cb);
-	}
+	static void AddQueryToQueue(CMySQLQuery *cb);
 	static inline CMySQLQuery *GetNextQuery() 
 	{
 		CMySQLQuery *NextQuery = NULL;
-		m_CallbackQueue.pop(NextQuery);
+		if(!m_DetachQueue.empty())
+		{
+			NextQuery = m_DetachQueue.front();
+			m_DetachQueue.pop_front();
+			m_PendingCount--;
+		}
+		else if(m_CallbackQueue.pop(NextQuery))
+			m_PendingCount--;
 		return NextQuery;
 	}
+	//called by a handle which is about to be deleted (main thread only, after its workers have stopped);
+	//its waiting results lose the handle and are destroyed without calling their callbacks
+	static void DetachHandle(CMySQLHandle *handle);
+
+	static inline unsigned int GetPendingCount() 
+	{
+		return m_PendingCount;
+	}
+	//number of ticks which left callbacks for the next tick because the budget was used up
+	static inline unsigned int GetCarryOverTicks() 
+	{
+		return m_CarryOverTicks;
+	}
+	//number of ticks which took longer than the time budget
+	static inline unsigned int GetOverrunTicks() 
+	{
+		return m_OverrunTicks;
+	}
+	//longest time (in microseconds) spent in one tick
+	static inline unsigned int GetMaxTickTime() 
+	{
+		return m_MaxTickTime;
+	}
+	//highest number of waiting results so far
+	static inline unsigned int GetHighWater() 
+	{
+		return m_HighWater;
+	}
+	//number of times a result couldn't be queued at first try
+	static inline unsigned int GetOverflows() 
+	{
+		return m_Overflows;
+	}
 
 	static void AddAmx(AMX *amx);
 	static void EraseAmx(AMX *amx);
@@ -55,13 +113,35 @@ public:
 	static void ClearAll();
 
 private:
-	static boost::lockfree::queue<
-			CMySQLQuery*, 
-			boost::lockfree::fixed_sized<true>,
-			boost::lockfree::capacity<8192>
-		> m_CallbackQueue;
+	CCallback() :
+		IsInline(false)
+	{}
+	~CCallback() {}
+
+	void Reset();
+
+	//grows on demand, the reserved nodes only avoid allocations for usual loads
+	static boost::lockfree::queue<CMySQLQuery*> m_CallbackQueue;
+	//results taken out of the queue by DetachHandle, they keep their order and go first
+	static deque<CMySQLQuery*> m_DetachQueue;
+	//result whose callback is being executed right now
+	static CMySQLQuery *m_ActiveQuery;
 
 	static list<AMX *> m_AmxList;
+
+	//resolves a public name through a per-AMX cache, the public table of an AMX never changes after it's loaded
+	static bool FindPublic(AMX *amx, const string &name, int *index);
+	//callback name -> public index (-1 if the AMX doesn't have the public)
+	static boost::unordered_map<AMX *, boost::unordered_map<string, int> > m_PublicCache;
+
+	static boost::atomic<unsigned int> 
+		m_PendingCount,
+		m_HighWater,
+		m_Overflows;
+	static unsigned int 
+		m_CarryOverTicks,
+		m_OverrunTicks,
+		m_MaxTickTime;
 };
 
 
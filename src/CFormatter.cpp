@@ -0,0 +1,387 @@
+#pragma once
+
+#include "CFormatter.h"
+#include "CMySQLHandle.h"
+#include "CLog.h"
+
+#include "misc.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+
+unordered_map<string, CFormatter::SFormat> CFormatter::m_Cache;
+
+
+//both return false if the text doesn't fit anymore, the output is filled up then
+static inline bool Append(string &output, size_t max_len, const char *str, size_t len)
+{
+	if(output.length() + len > max_len)
+	{
+		output.append(str, max_len - output.length());
+		return false;
+	}
+	output.append(str, len);
+	return true;
+}
+
+static inline bool AppendPadding(string &output, size_t max_len, char padding, int len)
+{
+	if(len <= 0)
+		return true;
+	if(output.length() + len > max_len)
+	{
+		output.append(max_len - output.length(), padding);
+		return false;
+	}
+	output.append(len, padding);
+	return true;
+}
+
+
+const CFormatter::SFormat &CFormatter::GetFormat(const char *format)
+{
+	static string key;
+	key.assign(format);
+
+	unordered_map<string, SFormat>::iterator f = m_Cache.find(key);
+	if(f == m_Cache.end())
+	{
+		//formats built at runtime could fill the cache endlessly
+		if(m_Cache.size() >= MAX_FORMAT_CACHE_SIZE)
+			m_Cache.clear();
+
+		f = m_Cache.insert(std::make_pair(key, SFormat())).first;
+		f->second.Text = key;
+		Parse(f->second);
+	}
+	return f->second;
+}
+
+void CFormatter::Parse(SFormat &format)
+{
+	const string &text = format.Text;
+	const size_t len = text.length();
+	size_t literal_start = 0;
+
+	SToken literal;
+	literal.IsLiteral = true;
+	literal.Specifier = '\0';
+	literal.Width = -1;
+	literal.ZeroPadding = false;
+	literal.Precision = -1;
+
+	for(size_t i = 0; i < len; ++i)
+	{
+		if(text[i] != '%')
+			continue;
+
+		//"%%" is part of the literal text, without the second '%'
+		const bool is_escaped = (i + 1 < len && text[i + 1] == '%');
+		const size_t literal_end = is_escaped ? i + 1 : i;
+		if(literal_end > literal_start)
+		{
+			literal.Offset = literal_start;
+			literal.Length = literal_end - literal_start;
+			format.Tokens.push_back(literal);
+		}
+		if(is_escaped)
+		{
+			literal_start = ++i + 1;
+			continue;
+		}
+
+		SToken spec;
+		spec.IsLiteral = false;
+		spec.Offset = spec.Length = 0;
+		spec.Width = -1;
+		spec.ZeroPadding = false;
+		spec.Precision = -1;
+
+		size_t pos = i + 1;
+		if(pos < len && text[pos] == '0')
+		{
+			spec.ZeroPadding = true;
+			++pos;
+		}
+		if(pos < len && isdigit(static_cast<unsigned char>(text[pos])))
+		{
+			spec.Width = 0;
+			while(pos < len && isdigit(static_cast<unsigned char>(text[pos])))
+				spec.Width = spec.Width * 10 + (text[pos++] - '0');
+		}
+		if(pos < len && text[pos] == '.')
+		{
+			spec.Precision = 0;
+			++pos;
+			while(pos < len && isdigit(static_cast<unsigned char>(text[pos])))
+				spec.Precision = spec.Precision * 10 + (text[pos++] - '0');
+		}
+		spec.Specifier = pos < len ? text[pos] : '\0';
+		format.Tokens.push_back(spec);
+
+		i = pos;
+		literal_start = pos + 1;
+	}
+
+	if(len > literal_start)
+	{
+		literal.Offset = literal_start;
+		literal.Length = len - literal_start;
+		format.Tokens.push_back(literal);
+	}
+}
+
+bool CFormatter::AppendInt(const SToken &token, int value, size_t max_len, string &output)
+{
+	switch(token.Specifier)
+	{
+		case 'i':
+		case 'I':
+		case 'd':
+		case 'D':
+		{
+			char NumBuf[13];
+			ConvertIntToStr<10>(value, NumBuf);
+			const size_t NumBufLen = strlen(NumBuf);
+			return AppendPadding(output, max_len, token.ZeroPadding ? '0' : ' ', token.Width - static_cast<int>(NumBufLen))
+				&& Append(output, max_len, NumBuf, NumBufLen);
+		}
+		case 'X':
+		case 'x':
+		{
+			char HexBuf[17];
+			memset(HexBuf, 0, 17);
+			ConvertIntToStr<16>(value, HexBuf);
+			if(token.Specifier == 'X')
+			{
+				for(char *c = HexBuf; *c != '\0'; ++c)
+					*c = toupper(*c);
+			}
+			return Append(output, max_len, HexBuf, strlen(HexBuf));
+		}
+		case 'b':
+		case 'B':
+		{
+			char BinBuf[34];
+			memset(BinBuf, 0, 34);
+			ConvertIntToStr<2>(value, BinBuf);
+			return Append(output, max_len, BinBuf, strlen(BinBuf));
+		}
+	}
+	return true;
+}
+
+bool CFormatter::AppendFloat(const SToken &token, float value, size_t max_len, string &output)
+{
+	const int Precision = (token.Precision >= 0 && token.Precision <= 6) ? token.Precision : 6;
+	char FloatBuf[84+1];
+	const int FloatBufLen = sprintf(FloatBuf, "%.*f", Precision, value);
+
+	//the width only applies to the integral part, measured as the value rounded down (like before R36: "%08.1f" of -9.5 is "00000-9.5")
+	char IntegralBuf[13];
+	ConvertIntToStr((int)floor(value), IntegralBuf);
+	const int IntegralLen = static_cast<int>(strlen(IntegralBuf));
+	return AppendPadding(output, max_len, token.ZeroPadding ? '0' : ' ', token.Width - IntegralLen)
+		&& Append(output, max_len, FloatBuf, FloatBufLen);
+}
+
+bool CFormatter::AppendEscaped(const char *str, size_t len, CMySQLConnection *connection, size_t max_len, string &output)
+{
+	//escaped directly into the output
+	const size_t OutputPos = output.length();
+	output.resize(OutputPos + len * 2 + 1);
+	output.resize(OutputPos + connection->EscapeString(str, len, &output[OutputPos]));
+	if(output.length() > max_len)
+	{
+		output.resize(max_len);
+		return false;
+	}
+	return true;
+}
+
+
+bool CFormatter::Format(AMX *amx, cell *params, unsigned int first_param_idx, const char *format,
+	CMySQLConnection *connection, size_t max_len, string &output)
+{
+	const SFormat &Format = GetFormat(format);
+
+	const unsigned int num_args = (params[0] / sizeof(cell));
+	const unsigned int num_dyn_args = num_args >= first_param_idx ? num_args - (first_param_idx - 1) : 0;
+	unsigned int param_counter = 0;
+
+	output.clear();
+	for(vector<SToken>::const_iterator t = Format.Tokens.begin(), end = Format.Tokens.end(); t != end; ++t)
+	{
+		bool fits = true;
+		if(t->IsLiteral)
+			fits = Append(output, max_len, Format.Text.c_str() + t->Offset, t->Length);
+		else
+		{
+			if(param_counter >= num_dyn_args)
+			{
+				CLOG_FUNCTION(LOG_ERROR, "mysql_format", "no value for specifier \"%%%c\" available", t->Specifier);
+				continue;
+			}
+
+			cell *amx_address = NULL;
+			char *StrBuf = NULL;
+			switch(t->Specifier)
+			{
+				case 'i':
+				case 'I':
+				case 'd':
+				case 'D':
+				case 'X':
+				case 'x':
+				case 'b':
+				case 'B':
+					amx_GetAddr(amx, params[first_param_idx + param_counter], &amx_address);
+					fits = AppendInt(*t, *amx_address, max_len, output);
+					break;
+				case 'z':
+				case 'Z':
+				case 's':
+				case 'S':
+					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
+					if(StrBuf != NULL)
+						fits = Append(output, max_len, StrBuf, strlen(StrBuf));
+					break;
+				case 'f':
+				case 'F':
+					amx_GetAddr(amx, params[first_param_idx + param_counter], &amx_address);
+					fits = AppendFloat(*t, amx_ctof(*amx_address), max_len, output);
+					break;
+				case 'e':
+				case 'E':
+					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
+					if(StrBuf != NULL)
+						fits = AppendEscaped(StrBuf, strlen(StrBuf), connection, max_len, output);
+					break;
+				default:
+					CLOG_FUNCTION(LOG_ERROR, "mysql_format", "invalid format specifier \"%%%c\"", t->Specifier);
+			}
+			param_counter++;
+		}
+
+		if(!fits)
+		{
+			CLOG_FUNCTION(LOG_ERROR, "mysql_format", "destination size is too small");
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool CFormatter::CopyValues(AMX *amx, cell *params, unsigned int first_param_idx, unsigned int num_args, const char *format,
+	vector<boost::variant<int, float, string> > &values, unsigned int &num_values)
+{
+	const SFormat &Format = GetFormat(format);
+
+	num_values = 0;
+	for(vector<SToken>::const_iterator t = Format.Tokens.begin(), end = Format.Tokens.end(); t != end; ++t)
+	{
+		if(t->IsLiteral == false)
+			num_values++;
+	}
+	if(num_values > num_args)
+	{
+		CLOG_FUNCTION(LOG_ERROR, "CFormatter::CopyValues", "not enough values for %d format specifiers", num_values);
+		return false;
+	}
+
+	values.reserve(num_values);
+	for(vector<SToken>::const_iterator t = Format.Tokens.begin(), end = Format.Tokens.end(); t != end; ++t)
+	{
+		if(t->IsLiteral == true)
+			continue;
+
+		const cell param = params[first_param_idx + values.size()];
+		cell *amx_address = NULL;
+		char *StrBuf = NULL;
+		switch(t->Specifier)
+		{
+			case 'i':
+			case 'I':
+			case 'd':
+			case 'D':
+			case 'X':
+			case 'x':
+			case 'b':
+			case 'B':
+				amx_GetAddr(amx, param, &amx_address);
+				values.push_back(static_cast<int>(*amx_address));
+				break;
+			case 'f':
+			case 'F':
+				amx_GetAddr(amx, param, &amx_address);
+				values.push_back(amx_ctof(*amx_address));
+				break;
+			case 'z':
+			case 'Z':
+			case 's':
+			case 'S':
+			case 'e':
+			case 'E':
+				amx_StrParam(amx, param, StrBuf);
+				values.push_back(string(StrBuf != NULL ? StrBuf : ""));
+				break;
+			default:
+				CLOG_FUNCTION(LOG_ERROR, "CFormatter::CopyValues", "invalid format specifier \"%%%c\"", t->Specifier);
+				return false;
+		}
+	}
+	return true;
+}
+
+void CFormatter::FormatValues(const string &format, const vector<boost::variant<int, float, string> > &values,
+	CMySQLConnection *connection, string &output)
+{
+	SFormat Format;
+	Format.Text = format;
+	Parse(Format);
+
+	const size_t max_len = string::npos;
+	size_t value_idx = 0;
+
+	output.clear();
+	output.reserve(format.length() * 2);
+	for(vector<SToken>::const_iterator t = Format.Tokens.begin(), end = Format.Tokens.end(); t != end; ++t)
+	{
+		if(t->IsLiteral)
+		{
+			output.append(Format.Text, t->Offset, t->Length);
+			continue;
+		}
+		if(value_idx >= values.size())
+			break;
+
+		//the value types were checked by CopyValues
+		const boost::variant<int, float, string> &value = values[value_idx++];
+		switch(t->Specifier)
+		{
+			case 'f':
+			case 'F':
+				AppendFloat(*t, boost::get<float>(value), max_len, output);
+				break;
+			case 'z':
+			case 'Z':
+			case 's':
+			case 'S':
+				output.append(boost::get<string>(value));
+				break;
+			case 'e':
+			case 'E':
+			{
+				const string &str = boost::get<string>(value);
+				AppendEscaped(str.c_str(), str.length(), connection, max_len, output);
+				break;
+			}
+			default:
+				AppendInt(*t, boost::get<int>(value), max_len, output);
+		}
+	}
+}
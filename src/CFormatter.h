@@ -0,0 +1,76 @@
+#pragma once
+#ifndef INC_CFORMATTER_H
+#define INC_CFORMATTER_H
+
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/variant.hpp>
+
+using std::string;
+using std::vector;
+using boost::unordered_map;
+
+#include "main.h"
+
+
+class CMySQLConnection;
+
+
+#define MAX_FORMAT_CACHE_SIZE 256
+
+
+//mysql_format implementation; format strings are parsed once into a list of tokens,
+//which is cached by the format string, so frequently used formats aren't parsed again (main thread only)
+class CFormatter
+{
+public:
+	//formats the arguments starting at params[first_param_idx] into output, which is limited to max_len characters;
+	//returns false if the output had to be cut
+	static bool Format(AMX *amx, cell *params, unsigned int first_param_idx, const char *format,
+		CMySQLConnection *connection, size_t max_len, string &output);
+
+	//parameterized queries; the values for the specifiers of format are copied on the main thread,
+	//the query is built (and escaped) by the executing thread
+	//returns false if a specifier is invalid or has no value, num_values is the number of specifiers
+	static bool CopyValues(AMX *amx, cell *params, unsigned int first_param_idx, unsigned int num_args, const char *format,
+		vector<boost::variant<int, float, string> > &values, unsigned int &num_values);
+	static void FormatValues(const string &format, const vector<boost::variant<int, float, string> > &values,
+		CMySQLConnection *connection, string &output);
+
+	static inline void ClearCache()
+	{
+		m_Cache.clear();
+	}
+
+private:
+	struct SToken
+	{
+		bool IsLiteral;
+		size_t Offset, Length; //literal text in the format string
+		char Specifier;
+		int Width;
+		bool ZeroPadding;
+		int Precision;
+	};
+	struct SFormat
+	{
+		string Text;
+		vector<SToken> Tokens;
+	};
+
+	static const SFormat &GetFormat(const char *format);
+	//doesn't use the cache, so it can be called from every thread
+	static void Parse(SFormat &format);
+
+	//all return false if the output had to be cut
+	static bool AppendInt(const SToken &token, int value, size_t max_len, string &output);
+	static bool AppendFloat(const SToken &token, float value, size_t max_len, string &output);
+	static bool AppendEscaped(const char *str, size_t len, CMySQLConnection *connection, size_t max_len, string &output);
+
+	static unordered_map<string, SFormat> m_Cache;
+};
+
+
+#endif // INC_CFORMATTER_H
@@ -15,28 +15,101 @@ CLog *CLog::m_Instance = NULL;
 
 void CLog::ProcessLog() 
 {
+	FILE *LogFile = NULL;
+	unsigned int LogFileType = LOG_NONE;
+	long LogFileSize = 0;
+
 	bool 
 		IsCallbackActive = false,
 		IsCallbackUsed = false;
-	string CallbackMsg;
-	
-	FILE *LogFile = fopen(m_LogFileName, "w");
+	string 
+		CallbackMsg,
+		LogMsg;
 
-	char StartLogTime[32];
-	time_t StartLogTimeRaw;
-	time(&StartLogTimeRaw);
-	const tm * StartLogTimeInfo = localtime(&StartLogTimeRaw);
-	strftime(StartLogTime, sizeof(StartLogTime), "%H:%M, %d.%m.%Y", StartLogTimeInfo);
+	bool IsRunning = true;
+	do
+	{
+		//read before draining the queue, so entries queued before the shutdown are still written
+		IsRunning = m_LogThreadAlive;
 
-	fprintf(LogFile, "<html><head><title>MySQL Plugin log</title><style>table {border: 1px solid black; border-collapse: collapse; line-height: 23px; table-layout: fixed; width: 863px;}th, td {border: 1px solid black; word-wrap: break-word;}thead {background-color: #C0C0C0;}		tbody {text-align: center;}		table.left1 {position: relative; left: 36px;}		table.left2 {position: relative; left: 72px;}		.time {width: 80px;}		.func {width: 200px;}		.stat {width: 75px;}		.msg {width: 400px;}	</style>	<script>		var 			LOG_ERROR = 1,			LOG_WARNING = 2,			LOG_DEBUG = 4;				var			FirstRun = true,			IsCallbackActive = false,			IsTableOpen = false,			IsThreadActive = false;				function StartCB(cbname) {			StartTable(1, 0, cbname);		}		function EndCB() {			EndTable();			IsCallbackActive = false;		}		function StartTable(iscallback, isthreaded, cbname) {			if(IsTableOpen == true || isthreaded != IsThreadActive)				EndTable();						if(iscallback == true) {				document.write(					\"<table class=left2>\" +						\"<th bgcolor=#C0C0C0 >In callback \\\"\"+cbname+\"\\\"</th>\" +					\"</table>\"				);			}						document.write(\"<table\");			if(iscallback == true || (isthreaded != IsThreadActive && isthreaded == false && IsCallbackActive == true) ) {				document.write(\" class=left2\");				IsCallbackActive = true;			}			else if(isthreaded == true) 				document.write(\" class=left1\");						IsThreadActive = isthreaded;			document.write(\">\");						if(FirstRun == true) {				FirstRun = false;				document.write(\"<thead><th class=time>Time</th><th class=func>Function</th><th class=stat>Status</th><th class=msg>Message</th></thead>\");			}			document.write(\"<tbody>\");			IsTableOpen = true;		}				function EndTable() {			document.write(\"</tbody></table>\");			IsTableOpen = false;		}						function Log(time, func, status, msg, isthreaded) {			isthreaded = typeof isthreaded !== 'undefined' ? isthreaded : 0;			if(IsTableOpen == false || isthreaded != IsThreadActive)				StartTable(false, isthreaded, \"\");			var StatColor, StatText;			switch(status) {			case LOG_ERROR:				StatColor = \"RED\";				StatText = \"ERROR\";				break;			case LOG_WARNING:				StatColor = \"#FF9900\";				StatText = \"WARNING\";				break;			case LOG_DEBUG:				StatColor = \"#00DD00\";				StatText = \"OK\";				break;			}			document.write(				\"<tr bgcolor=\"+StatColor+\">\" + 					\"<td class=time>\"+time+\"</td>\" + 					\"<td class=func>\"+func+\"</td>\" + 					\"<td class=stat>\"+StatText+\"</td>\" + 					\"<td class=msg>\"+msg+\"</td>\" + 				\"</tr>\"			);		}	</script></head><body bgcolor=grey>	<h2>Logging started at %s</h2><script>\n", StartLogTime);
-	fflush(LogFile);
+		const unsigned int LogType = m_LogType;
+		if(LogType != LogFileType)
+		{
+			CloseLogFile(LogFile, LogFileType);
+			LogFile = OpenLogFile(LogType);
+			LogFileType = LogType;
+			LogFileSize = (LogFile != NULL) ? ftell(LogFile) : 0;
+			IsCallbackActive = false;
+			IsCallbackUsed = false;
+		}
 
-	while(m_LogThreadAlive) 
-	{
+		bool IsWritten = false;
 		m_SLogData *LogData = NULL;
 		while(m_LogQueue.pop(LogData)) 
 		{
-			if(LogData->Info == LOG_INFO_CALLBACK_BEGIN)
+			if(LogFile == NULL)
+			{
+				ReleaseLogData(LogData);
+				continue;
+			}
+
+			if(LogFileType == LOG_TYPE_TEXT)
+			{
+				//callback markers of the HTML log, queued before the log type was switched
+				if(LogData->Info == LOG_INFO_CALLBACK_BEGIN || LogData->Info == LOG_INFO_CALLBACK_END)
+				{
+					ReleaseLogData(LogData);
+					continue;
+				}
+
+				const unsigned int MaxFileSize = m_MaxFileSize;
+				if(MaxFileSize != 0 && LogFileSize >= static_cast<long>(MaxFileSize))
+				{
+					fclose(LogFile);
+					const string LogFileName(m_LogBaseName + ".txt"), BackupFileName(m_LogBaseName + ".1.txt");
+					remove(BackupFileName.c_str());
+					rename(LogFileName.c_str(), BackupFileName.c_str());
+					LogFile = OpenLogFile(LOG_TYPE_TEXT);
+					LogFileSize = 0;
+					if(LogFile == NULL)
+					{
+						ReleaseLogData(LogData);
+						continue;
+					}
+				}
+
+				const char *Prefix = "";
+				switch(LogData->Status) 
+				{
+					case LOG_ERROR:
+						Prefix = "ERROR";
+						break;
+					case LOG_WARNING:
+						Prefix = "WARNING";
+						break;
+					case LOG_DEBUG:
+						Prefix = "DEBUG";
+						break;
+				}
+
+				char timeform[16];
+				time_t rawtime;
+				time(&rawtime);
+				strftime(timeform, sizeof(timeform), "%X", localtime(&rawtime));
+
+				int Written = 0;
+				if(LogData->Name[0] != '\0')
+					Written = fprintf(LogFile, "[%s] [%s] %s - %s\n", timeform, Prefix, LogData->Name, LogData->Msg);
+				else
+					Written = fprintf(LogFile, "[%s] [%s] %s\n", timeform, Prefix, LogData->Msg);
+				if(Written > 0)
+					LogFileSize += Written;
+				IsWritten = true;
+
+				if(LogData->Status == LOG_ERROR && m_FlushOnError)
+					fflush(LogFile);
+			}
+			else if(LogData->Info == LOG_INFO_CALLBACK_BEGIN)
 			{
 				IsCallbackActive = true;
 				IsCallbackUsed = false;
@@ -49,6 +122,10 @@ void CLog::ProcessLog()
 				IsCallbackActive = false;
 				IsCallbackUsed = false;
 			}
+			else if(LogData->Name[0] == '\0')
+			{
+				//text log entry, queued before the log type was switched
+			}
 			else 
 			{
 				if(IsCallbackActive == true && IsCallbackUsed == false)
@@ -63,169 +140,177 @@ void CLog::ProcessLog()
 				strftime(timeform, sizeof(timeform), "%X", localtime(&rawtime));
 
 				//escape "'s in Msg
-				string LogMsg(LogData->Msg);
-				for(size_t s = 0; s < LogMsg.length(); ++s) 
+				LogMsg.clear();
+				for(const char *Char = LogData->Msg; *Char != '\0'; ++Char) 
 				{
-					char Char = LogMsg.at(s);
-					if(Char == '\\')
-						LogMsg.replace(s, 1, "\\\\"), s++;
-					else if(Char == '"')
-						LogMsg.replace(s, 1, "\\\""), s++;
-					
+					if(*Char == '\\' || *Char == '"')
+						LogMsg += '\\';
+					LogMsg += *Char;
 				}
 
 				fprintf(LogFile, "Log(\"%s\",\"%s\",%d,\"%s\",%d);\n", timeform, LogData->Name, LogData->Status, LogMsg.c_str(), LogData->Info == LOG_INFO_THREADED ? 1 : 0);//LogData->IsThreaded == false ? 0 : 1);
 			}
-			fputs("</script>", LogFile); //append this tag, or else the JS functions won't work
-			fflush(LogFile);
-			fseek(LogFile, ftell(LogFile)-9, SEEK_SET); //set position before </script>-tag to overwrite it next time
+			if(LogFileType == LOG_TYPE_HTML)
+				IsWritten = true;
 
-			delete LogData;
+			ReleaseLogData(LogData);
 		}
-		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
-		
+
+		//both logs are written in batches, once per queue drain
+		if(IsWritten == true)
+		{
+			if(LogFileType == LOG_TYPE_HTML)
+			{
+				fputs("</script>", LogFile); //append this tag, or else the JS functions won't work
+				fflush(LogFile);
+				fseek(LogFile, ftell(LogFile)-9, SEEK_SET); //set position before </script>-tag to overwrite it next time
+			}
+			else
+				fflush(LogFile);
+		}
+
+		const unsigned int DroppedCount = m_DroppedCount.exchange(0);
+		if(DroppedCount > 0 && LogFile != NULL && LogFileType == LOG_TYPE_TEXT)
+			fprintf(LogFile, "[WARNING] %u log messages were dropped, the log queue was full\n", DroppedCount);
+
+		if(IsRunning)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	} while(IsRunning);
+
+	CloseLogFile(LogFile, LogFileType);
+}
+
+FILE *CLog::OpenLogFile(unsigned int logtype) 
+{
+	FILE *logfile = NULL;
+	if(logtype == LOG_TYPE_HTML) 
+	{
+		logfile = fopen((m_LogBaseName + ".html").c_str(), "w");
+		if(logfile == NULL)
+			return NULL;
+
+		char StartLogTime[32];
+		time_t StartLogTimeRaw;
+		time(&StartLogTimeRaw);
+		const tm * StartLogTimeInfo = localtime(&StartLogTimeRaw);
+		strftime(StartLogTime, sizeof(StartLogTime), "%H:%M, %d.%m.%Y", StartLogTimeInfo);
+
+		setvbuf(logfile, NULL, _IOFBF, 64 * 1024);
+		fprintf(logfile, "<html><head><title>MySQL Plugin log</title><style>table {border: 1px solid black; border-collapse: collapse; line-height: 23px; table-layout: fixed; width: 863px;}th, td {border: 1px solid black; word-wrap: break-word;}thead {background-color: #C0C0C0;}		tbody {text-align: center;}		table.left1 {position: relative; left: 36px;}		table.left2 {position: relative; left: 72px;}		.time {width: 80px;}		.func {width: 200px;}		.stat {width: 75px;}		.msg {width: 400px;}	</style>	<script>		var 			LOG_ERROR = 1,			LOG_WARNING = 2,			LOG_DEBUG = 4;				var			FirstRun = true,			IsCallbackActive = false,			IsTableOpen = false,			IsThreadActive = false;				function StartCB(cbname) {			StartTable(1, 0, cbname);		}		function EndCB() {			EndTable();			IsCallbackActive = false;		}		function StartTable(iscallback, isthreaded, cbname) {			if(IsTableOpen == true || isthreaded != IsThreadActive)				EndTable();						if(iscallback == true) {				document.write(					\"<table class=left2>\" +						\"<th bgcolor=#C0C0C0 >In callback \\\"\"+cbname+\"\\\"</th>\" +					\"</table>\"				);			}						document.write(\"<table\");			if(iscallback == true || (isthreaded != IsThreadActive && isthreaded == false && IsCallbackActive == true) ) {				document.write(\" class=left2\");				IsCallbackActive = true;			}			else if(isthreaded == true) 				document.write(\" class=left1\");						IsThreadActive = isthreaded;			document.write(\">\");						if(FirstRun == true) {				FirstRun = false;				document.write(\"<thead><th class=time>Time</th><th class=func>Function</th><th class=stat>Status</th><th class=msg>Message</th></thead>\");			}			document.write(\"<tbody>\");			IsTableOpen = true;		}				function EndTable() {			document.write(\"</tbody></table>\");			IsTableOpen = false;		}						function Log(time, func, status, msg, isthreaded) {			isthreaded = typeof isthreaded !== 'undefined' ? isthreaded : 0;			if(IsTableOpen == false || isthreaded != IsThreadActive)				StartTable(false, isthreaded, \"\");			var StatColor, StatText;			switch(status) {			case LOG_ERROR:				StatColor = \"RED\";				StatText = \"ERROR\";				break;			case LOG_WARNING:				StatColor = \"#FF9900\";				StatText = \"WARNING\";				break;			case LOG_DEBUG:				StatColor = \"#00DD00\";				StatText = \"OK\";				break;			}			document.write(				\"<tr bgcolor=\"+StatColor+\">\" + 					\"<td class=time>\"+time+\"</td>\" + 					\"<td class=func>\"+func+\"</td>\" + 					\"<td class=stat>\"+StatText+\"</td>\" + 					\"<td class=msg>\"+msg+\"</td>\" + 				\"</tr>\"			);		}	</script></head><body bgcolor=grey>	<h2>Logging started at %s</h2><script>\n", StartLogTime);
+		fflush(logfile);
 	}
-	fputs("</script></body></html>", LogFile);
-	fclose(LogFile);
-	//m_LogThreadAlive = true;
+	else if(logtype == LOG_TYPE_TEXT) 
+	{
+		logfile = fopen((m_LogBaseName + ".txt").c_str(), "a");
+		if(logfile == NULL)
+			return NULL;
+
+		//bigger buffer, the whole batch is written at once
+		setvbuf(logfile, NULL, _IOFBF, 64 * 1024);
+		fseek(logfile, 0, SEEK_END);
+	}
+	return logfile;
+}
+
+void CLog::CloseLogFile(FILE *logfile, unsigned int logtype) 
+{
+	if(logfile == NULL)
+		return ;
+
+	if(logtype == LOG_TYPE_HTML)
+		fputs("</script></body></html>", logfile);
+	fclose(logfile);
+}
+
+CLog::m_SLogData *CLog::AcquireLogData(unsigned int loglevel, unsigned int info) 
+{
+	m_SLogData *logdata = NULL;
+	if(!m_FreeLogData.pop(logdata))
+	{
+		//the log thread can't keep up
+		m_DroppedCount++;
+		return NULL;
+	}
+	logdata->Status = loglevel;
+	logdata->Info = info;
+	logdata->Name[0] = '\0';
+	logdata->Msg[0] = '\0';
+	return logdata;
+}
+
+void CLog::QueueLogData(m_SLogData *logdata) 
+{
+	//can't fail, the queue's capacity includes its dummy node, so it has room for all entries
+	m_LogQueue.push(logdata);
+}
+
+void CLog::ReleaseLogData(m_SLogData *logdata) 
+{
+	m_FreeLogData.push(logdata);
 }
 
 void CLog::Initialize(const char *logfile) 
 {
-	strcpy(m_LogFileName, logfile);
-	SetLogType(m_LogType);
+	m_LogBaseName.assign(logfile);
+	m_LogBaseName.erase(m_LogBaseName.find_first_of("."));
 	m_MainThreadID = boost::this_thread::get_id();
+
+	m_LogThread = new boost::thread(&CLog::ProcessLog, this);
 }
 
 void CLog::SetLogType(unsigned int logtype)  
 {
 	if(logtype != LOG_TYPE_HTML && logtype != LOG_TYPE_TEXT)
 		return ;
-	if(logtype == m_LogType)
-		return ;
 
+	//the log thread switches the log file
 	m_LogType = logtype;
-
-	string filename(m_LogFileName);
-	int Pos = filename.find_first_of(".");
-	filename.erase(Pos, filename.size() - Pos);
-
-	if(logtype == LOG_TYPE_HTML) 
-	{
-		if(m_LogThread == NULL)
-			m_LogThread = new boost::thread(&CLog::ProcessLog, this);
-
-		filename.append(".html");
-	}
-	else if(logtype == LOG_TYPE_TEXT) 
-		filename.append(".txt");
-
-	strcpy(m_LogFileName, filename.c_str());
 }
 
 
 int CLog::LogFunction(unsigned int loglevel, char *funcname, char *msg, ...) 
 {
-	if(m_LogLevel != LOG_NONE)
+	if (m_LogLevel & loglevel) 
 	{
-		switch(m_LogType) 
-		{
-			case LOG_TYPE_HTML: 
-			{
-				if (m_LogLevel & loglevel) 
-				{
-					m_SLogData *log_data = new m_SLogData;
+		m_SLogData *log_data = AcquireLogData(loglevel, (boost::this_thread::get_id() != m_MainThreadID) ? LOG_INFO_THREADED : LOG_INFO_NONE);
+		if(log_data == NULL)
+			return 0;
 
-					log_data->Info = (boost::this_thread::get_id() != m_MainThreadID) ? LOG_INFO_THREADED : LOG_INFO_NONE;
-					log_data->Status = loglevel;
+		va_list args;
+		va_start(args, msg);
+		vsnprintf(log_data->Msg, sizeof(log_data->Msg), msg, args);
+		va_end (args);
+		log_data->Msg[sizeof(log_data->Msg) - 1] = '\0';
 
-					log_data->Msg = (char *)malloc(2048 * sizeof(char));
-					va_list args;
-					va_start(args, msg);
-					vsprintf(log_data->Msg, msg, args);
-					va_end (args);
+		strncpy(log_data->Name, funcname, sizeof(log_data->Name) - 1);
+		log_data->Name[sizeof(log_data->Name) - 1] = '\0';
 
-					log_data->Name = (char *)malloc((strlen(funcname)+1) * sizeof(char));
-					strcpy(log_data->Name, funcname);
-
-					m_LogQueue.push(log_data);
-				}
-			} 
-			break;
-			case LOG_TYPE_TEXT: 
-			{
-				char msg_buf[2048];
-				int real_msg_len=0;
-
-				va_list args;
-				va_start(args, msg);
-				real_msg_len = vsprintf(msg_buf, msg, args);
-				va_end (args);
-			
-				char *log_text = (char *)malloc((strlen(funcname) + real_msg_len + 8) * sizeof(char));
-				sprintf(log_text, "%s - %s", funcname, msg_buf);
-				LogText(loglevel, log_text);
-				free(log_text);
-			} 
-			break;
-		}
+		QueueLogData(log_data);
 	}
 	return 0;
 }
 
-int CLog::LogText(unsigned int loglevel, char* text) 
-{
-    if (m_LogLevel & loglevel) 
-	{
-        char prefix[16];
-        switch(loglevel) {
-			case LOG_ERROR:
-				sprintf(prefix, "ERROR");
-				break;
-			case LOG_WARNING:
-				sprintf(prefix, "WARNING");
-				break;
-			case LOG_DEBUG:
-				sprintf(prefix, "DEBUG");
-				break;
-        }
-        char timeform[16];
-        time_t rawtime;
-        time(&rawtime);
-        struct tm * timeinfo;
-        timeinfo = localtime(&rawtime);
-        strftime(timeform, sizeof(timeform), "%X", timeinfo);
-
-        FILE *log_file = fopen(m_LogFileName, "a");
-        if(log_file != NULL) 
-		{
-            fprintf(log_file, "[%s] [%s] %s\n", timeform, prefix, text);
-            fclose(log_file);
-        }
-                
-    }
-	return 0;
-}
-
 void CLog::StartCallback(const char *cbname) 
 {
 	if(m_LogLevel == LOG_NONE)
 		return ;
 	if(m_LogType == LOG_TYPE_HTML) 
 	{
-		m_SLogData *log_data = new m_SLogData;
+		m_SLogData *log_data = AcquireLogData(LOG_NONE, LOG_INFO_CALLBACK_BEGIN);
+		if(log_data == NULL)
+			return ;
 
-		log_data->Info = LOG_INFO_CALLBACK_BEGIN;
-		log_data->Msg = (char *)malloc((strlen(cbname)+20) * sizeof(char));
-		sprintf(log_data->Msg, "StartCB(\"%s\");", cbname);
-
-		m_LogQueue.push(log_data);
+		sprintf(log_data->Msg, "StartCB(\"%.2000s\");", cbname);
+		QueueLogData(log_data);
 	}
-	else if(m_LogType == LOG_TYPE_TEXT) 
+	else if(m_LogType == LOG_TYPE_TEXT && (m_LogLevel & LOG_DEBUG)) 
 	{
-		char log_text[64];
-		sprintf(log_text, "Calling callback \"%s\"..", cbname);
-		LogText(LOG_DEBUG, log_text);
+		m_SLogData *log_data = AcquireLogData(LOG_DEBUG, LOG_INFO_NONE);
+		if(log_data == NULL)
+			return ;
+
+		sprintf(log_data->Msg, "Calling callback \"%.2000s\"..", cbname);
+		QueueLogData(log_data);
 	}
 }
 
@@ -237,9 +322,9 @@ void CLog::EndCallback()
 	if(m_LogLevel == LOG_NONE)
 		return ;
 	
-	m_SLogData *log_data = new m_SLogData;
-	log_data->Info = LOG_INFO_CALLBACK_END;
-	m_LogQueue.push(log_data);
+	m_SLogData *log_data = AcquireLogData(LOG_NONE, LOG_INFO_CALLBACK_END);
+	if(log_data != NULL)
+		QueueLogData(log_data);
 }
 
 
@@ -255,6 +340,7 @@ CLog::~CLog()
 		m_LogThread->join();
 		delete m_LogThread;
 	}
+	delete[] m_LogData;
 }
 
 
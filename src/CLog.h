@@ -3,10 +3,20 @@
 #define INC_CLOG_H
 
 
+#include <cstdio>
+#include <string>
 #include <boost/lockfree/queue.hpp>
 #include <boost/atomic.hpp>
 #include <boost/thread/thread.hpp>
 
+using std::string;
+
+
+//checks the log level before the arguments are evaluated and formatted, 
+//so a disabled log level costs nothing but this check
+#define CLOG_FUNCTION(loglevel, funcname, ...) \
+	(CLog::Get()->IsLogLevel(loglevel) ? CLog::Get()->LogFunction(loglevel, funcname, __VA_ARGS__) : 0)
+
 
 enum e_LogLevel 
 {
@@ -48,7 +58,6 @@ public:
 
 	void Initialize(const char *logfile);
 	int LogFunction(unsigned loglevel, char *funcname, char *msg, ...);
-	int LogText(unsigned int loglevel, char* text);
 	void StartCallback(const char *cbname);
 	void EndCallback();
 
@@ -61,28 +70,29 @@ public:
 		return !!(m_LogLevel & loglevel);
 	}
 	void SetLogType(unsigned int logtype);
+
+	//text log only: the log file is renamed to "<name>.1.txt" and started again once it reaches size bytes (0 = never)
+	inline void SetMaxFileSize(unsigned int size) 
+	{
+		m_MaxFileSize = size;
+	}
+	//text log only: errors are written to disk immediately instead of with the next batch
+	inline void SetFlushOnError(bool flush) 
+	{
+		m_FlushOnError = flush;
+	}
 	
 private:
 	static CLog *m_Instance;
 	
+	//log entries are preallocated, logging never allocates memory
+	static const unsigned int LogDataCount = 1024;
 	struct m_SLogData 
 	{
-		m_SLogData() :
-			Status(LOG_NONE),
-			Name(NULL), Msg(NULL),
-			Info(LOG_INFO_NONE)
-		{}
-
 		unsigned int Status;
-		char *Name, *Msg;
+		char Name[64], Msg[2048];
 		
 		unsigned int Info;
-
-		~m_SLogData() 
-		{
-			free(Name);
-			free(Msg);
-		}
 	};
 
 
@@ -90,26 +100,50 @@ private:
 		m_LogLevel(LOG_ERROR | LOG_WARNING), 
 		m_LogThread(NULL), 
 		m_LogThreadAlive(true),
-		m_LogType(LOG_TYPE_TEXT)
-	{}
+		m_LogType(LOG_TYPE_TEXT),
+		m_MaxFileSize(0),
+		m_FlushOnError(false),
+		m_DroppedCount(0),
+		m_LogData(new m_SLogData[LogDataCount])
+	{
+		for(unsigned int i = 0; i < LogDataCount; ++i)
+			m_FreeLogData.push(&m_LogData[i]);
+	}
 	~CLog();
 
+	//all log entries are written by this thread, the logging threads only queue them
 	void ProcessLog();
+	FILE *OpenLogFile(unsigned int logtype);
+	void CloseLogFile(FILE *logfile, unsigned int logtype);
+	//returns a free log entry or NULL if all are in use
+	m_SLogData *AcquireLogData(unsigned int loglevel, unsigned int info);
+	void QueueLogData(m_SLogData *logdata);
+	void ReleaseLogData(m_SLogData *logdata);
 
 	
-	char m_LogFileName[32];
-	unsigned int m_LogType;
+	string m_LogBaseName; //file name without extension
+	boost::atomic<unsigned int> m_LogType;
 	unsigned int m_LogLevel;
 
+	boost::atomic<unsigned int> m_MaxFileSize;
+	boost::atomic<bool> m_FlushOnError;
+	//entries which didn't fit into the queue
+	boost::atomic<unsigned int> m_DroppedCount;
+
 	boost::thread *m_LogThread;
 	boost::atomic<bool> m_LogThreadAlive;
 	boost::thread::id m_MainThreadID;
 
+	m_SLogData *m_LogData;
+	//both queues have to hold all entries at once; 
+	//a fixed-sized queue holds one element less than its capacity (one node is always in use)
 	boost::lockfree::queue<
 			m_SLogData*, 
 			boost::lockfree::fixed_sized<true>,
-			boost::lockfree::capacity<32678>
-		> m_LogQueue;
+			boost::lockfree::capacity<LogDataCount + 1>
+		> 
+		m_LogQueue,
+		m_FreeLogData;
 };
 
 
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "CMetrics.h"
+#include "CLog.h"
+
+#include <algorithm>
+
+
+const unsigned int CHistogram::BucketBounds[CHistogram::NumBuckets - 1] =
+{
+	50, 100, 250, 500,
+	1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000
+};
+
+vector<CMetrics *> CMetrics::m_Registry;
+boost::mutex CMetrics::m_RegistryMtx;
+
+boost::thread *CMetrics::m_WriterThread = NULL;
+boost::mutex CMetrics::m_WriterMtx;
+boost::condition_variable CMetrics::m_WriterCond;
+string CMetrics::m_WriterFile;
+unsigned int CMetrics::m_WriterInterval = 0;
+
+
+//names and descriptions used in the metrics file
+static const char *TimerNames[TIMER_COUNT][2] =
+{
+	{"queue_wait", "Time threaded queries waited for a worker thread."},
+	{"execution", "Time queries took to execute on the server, including the transfer."},
+	{"result_fetch", "Time spent copying results."},
+	{"callback_wait", "Time results waited for the main thread."},
+	{"callback_exec", "Time spent executing Pawn callbacks."}
+};
+static const char *CounterNames[COUNTER_COUNT][2] =
+{
+	{"queries", "Executed queries."},
+	{"received_bytes", "Bytes of result data received."},
+	{"fetched_rows", "Result rows fetched."},
+	{"errors", "Failed queries."}
+};
+
+
+CHistogram::CHistogram() :
+	m_Count(0),
+	m_Max(0),
+	m_Sum(0)
+{
+	for(unsigned int b = 0; b < NumBuckets; ++b)
+		m_Buckets[b] = 0;
+}
+
+unsigned int CHistogram::GetBucket(unsigned int time)
+{
+	return static_cast<unsigned int>(std::lower_bound(BucketBounds, BucketBounds + (NumBuckets - 1), time) - BucketBounds);
+}
+
+void CHistogram::Add(unsigned int time)
+{
+	m_Buckets[GetBucket(time)]++;
+	m_Sum += time;
+	m_Count++;
+
+	unsigned int max_time = m_Max;
+	while(time > max_time && !m_Max.compare_exchange_weak(max_time, time));
+}
+
+unsigned int CHistogram::GetPercentile(unsigned int percentile) const
+{
+	const unsigned int count = m_Count;
+	if(count == 0)
+		return 0;
+
+	const boost::uint64_t rank = (static_cast<boost::uint64_t>(count) * percentile + 99) / 100;
+	boost::uint64_t num_values = 0;
+	for(unsigned int b = 0; b < NumBuckets - 1; ++b)
+	{
+		num_values += m_Buckets[b];
+		if(num_values >= rank)
+			return std::min(BucketBounds[b], static_cast<unsigned int>(m_Max));
+	}
+	return m_Max;
+}
+
+
+CMetrics::CMetrics(int handle_id) :
+	m_HandleID(handle_id)
+{
+	for(unsigned int c = 0; c < COUNTER_COUNT; ++c)
+		m_Counters[c] = 0;
+
+	boost::mutex::scoped_lock lock(m_RegistryMtx);
+	m_Registry.push_back(this);
+}
+
+CMetrics::~CMetrics()
+{
+	boost::mutex::scoped_lock lock(m_RegistryMtx);
+	m_Registry.erase(std::find(m_Registry.begin(), m_Registry.end(), this));
+}
+
+void CMetrics::AddError(unsigned int error_id)
+{
+	m_Counters[COUNTER_ERRORS]++;
+
+	boost::mutex::scoped_lock lock(m_ErrorsMtx);
+	m_Errors[error_id]++;
+}
+
+unsigned int CMetrics::GetErrorCount(unsigned int error_id)
+{
+	boost::mutex::scoped_lock lock(m_ErrorsMtx);
+	unordered_map<unsigned int, unsigned int>::iterator e = m_Errors.find(error_id);
+	return e != m_Errors.end() ? e->second : 0;
+}
+
+
+void CMetrics::StartWriter(const string &filename, unsigned int interval)
+{
+	StopWriter();
+	if(interval == 0)
+		return ;
+
+	m_WriterFile = filename;
+	m_WriterInterval = interval;
+	m_WriterThread = new boost::thread(&CMetrics::ProcessWriter);
+}
+
+void CMetrics::StopWriter()
+{
+	if(m_WriterThread == NULL)
+		return ;
+
+	{
+		boost::mutex::scoped_lock lock(m_WriterMtx);
+		m_WriterInterval = 0;
+	}
+	m_WriterCond.notify_all();
+	m_WriterThread->join();
+	delete m_WriterThread;
+	m_WriterThread = NULL;
+}
+
+void CMetrics::ProcessWriter()
+{
+	boost::mutex::scoped_lock lock(m_WriterMtx);
+	while(m_WriterInterval > 0)
+	{
+		const boost::system_time next_write = boost::get_system_time() + boost::posix_time::milliseconds(m_WriterInterval);
+
+		if(!WriteFile(m_WriterFile))
+			CLOG_FUNCTION(LOG_ERROR, "CMetrics::ProcessWriter", "could not write metrics file \"%s\"", m_WriterFile.c_str());
+
+		while(m_WriterInterval > 0 && boost::get_system_time() < next_write)
+			m_WriterCond.timed_wait(lock, next_write);
+	}
+}
+
+bool CMetrics::WriteFile(const string &filename)
+{
+	//the file is replaced at once, so the exporter never reads a half written one
+	const string tmp_filename = filename + ".tmp";
+	FILE *file = fopen(tmp_filename.c_str(), "w");
+	if(file == NULL)
+		return false;
+
+	boost::mutex::scoped_lock lock(m_RegistryMtx);
+	for(unsigned int t = 0; t < TIMER_COUNT; ++t)
+	{
+		fprintf(file, "# HELP samp_mysql_%s_seconds %s\n", TimerNames[t][0], TimerNames[t][1]);
+		fprintf(file, "# TYPE samp_mysql_%s_seconds histogram\n", TimerNames[t][0]);
+		for(vector<CMetrics *>::iterator m = m_Registry.begin(), end = m_Registry.end(); m != end; ++m)
+		{
+			const CHistogram &timer = (*m)->m_Timers[t];
+			//the total count is read first, so the buckets are never smaller than the count
+			const unsigned int count = timer.GetCount();
+			const boost::uint64_t sum = timer.GetSum();
+			unsigned int num_values = 0;
+			for(unsigned int b = 0; b < CHistogram::NumBuckets - 1; ++b)
+			{
+				num_values += timer.GetBucketCount(b);
+				fprintf(file, "samp_mysql_%s_seconds_bucket{handle=\"%d\",le=\"%g\"} %u\n", TimerNames[t][0], (*m)->m_HandleID, CHistogram::BucketBounds[b] / 1000000.0, num_values);
+			}
+			num_values += timer.GetBucketCount(CHistogram::NumBuckets - 1);
+			fprintf(file, "samp_mysql_%s_seconds_bucket{handle=\"%d\",le=\"+Inf\"} %u\n", TimerNames[t][0], (*m)->m_HandleID, std::max(num_values, count));
+			fprintf(file, "samp_mysql_%s_seconds_sum{handle=\"%d\"} %.6f\n", TimerNames[t][0], (*m)->m_HandleID, sum / 1000000.0);
+			fprintf(file, "samp_mysql_%s_seconds_count{handle=\"%d\"} %u\n", TimerNames[t][0], (*m)->m_HandleID, std::max(num_values, count));
+		}
+	}
+
+	for(unsigned int c = 0; c < COUNTER_COUNT; ++c)
+	{
+		fprintf(file, "# HELP samp_mysql_%s_total %s\n", CounterNames[c][0], CounterNames[c][1]);
+		fprintf(file, "# TYPE samp_mysql_%s_total counter\n", CounterNames[c][0]);
+		for(vector<CMetrics *>::iterator m = m_Registry.begin(), end = m_Registry.end(); m != end; ++m)
+		{
+			if(c != COUNTER_ERRORS)
+			{
+				fprintf(file, "samp_mysql_%s_total{handle=\"%d\"} %llu\n", CounterNames[c][0], (*m)->m_HandleID, static_cast<unsigned long long>((*m)->m_Counters[c]));
+				continue;
+			}
+
+			//errors are split up by error id
+			boost::mutex::scoped_lock errors_lock((*m)->m_ErrorsMtx);
+			for(unordered_map<unsigned int, unsigned int>::iterator e = (*m)->m_Errors.begin(), e_end = (*m)->m_Errors.end(); e != e_end; ++e)
+				fprintf(file, "samp_mysql_%s_total{handle=\"%d\",code=\"%u\"} %u\n", CounterNames[c][0], (*m)->m_HandleID, e->first, e->second);
+		}
+	}
+	lock.unlock();
+
+	const bool success = (ferror(file) == 0);
+	fclose(file);
+	if(!success)
+		return false;
+
+#ifdef WIN32
+	remove(filename.c_str()); //rename doesn't replace existing files on Windows
+#endif
+	return rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef INC_CMETRICS_H
+#define INC_CMETRICS_H
+
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+using std::string;
+using std::vector;
+using boost::unordered_map;
+
+
+enum E_METRIC_TIMER
+{
+	TIMER_QUEUE_WAIT, //threaded query waits for a worker thread
+	TIMER_EXECUTION, //query is executed by the server and transferred
+	TIMER_RESULT_FETCH, //result is copied into the plugin's result object
+	TIMER_CALLBACK_WAIT, //result waits for the main thread
+	TIMER_CALLBACK_EXEC, //Pawn callback is executed
+	TIMER_COUNT
+};
+
+enum E_METRIC_COUNTER
+{
+	COUNTER_QUERIES,
+	COUNTER_BYTES_RECEIVED,
+	COUNTER_ROWS_FETCHED,
+	COUNTER_ERRORS,
+	COUNTER_COUNT
+};
+
+
+//latency histogram (in microseconds) with fixed buckets, can be updated from any thread
+class CHistogram
+{
+public:
+	static const unsigned int NumBuckets = 16;
+	//upper bounds of all buckets but the last one, which takes everything else
+	static const unsigned int BucketBounds[NumBuckets - 1];
+
+	CHistogram();
+
+	void Add(unsigned int time);
+	//returns the bucket a time belongs to
+	static unsigned int GetBucket(unsigned int time);
+
+	inline unsigned int GetCount() const
+	{
+		return m_Count;
+	}
+	inline boost::uint64_t GetSum() const
+	{
+		return m_Sum;
+	}
+	inline unsigned int GetMax() const
+	{
+		return m_Max;
+	}
+	inline unsigned int GetBucketCount(unsigned int bucket) const
+	{
+		return m_Buckets[bucket];
+	}
+	inline unsigned int GetAverage() const
+	{
+		unsigned int count = m_Count;
+		return count > 0 ? static_cast<unsigned int>(m_Sum / count) : 0;
+	}
+	//returns the upper bound of the bucket the percentile falls into
+	unsigned int GetPercentile(unsigned int percentile) const;
+
+private:
+	boost::atomic<unsigned int> m_Buckets[NumBuckets];
+	boost::atomic<unsigned int>
+		m_Count,
+		m_Max;
+	boost::atomic<boost::uint64_t> m_Sum;
+};
+
+
+//query pipeline metrics of a connection handle
+class CMetrics
+{
+public:
+	CMetrics(int handle_id);
+	~CMetrics();
+
+	inline void AddTime(E_METRIC_TIMER timer, unsigned int time)
+	{
+		m_Timers[timer].Add(time);
+	}
+	inline void AddCount(E_METRIC_COUNTER counter, boost::uint64_t value = 1)
+	{
+		m_Counters[counter] += value;
+	}
+	void AddError(unsigned int error_id);
+
+	inline const CHistogram &GetTimer(E_METRIC_TIMER timer) const
+	{
+		return m_Timers[timer];
+	}
+	inline boost::uint64_t GetCounter(E_METRIC_COUNTER counter) const
+	{
+		return m_Counters[counter];
+	}
+	unsigned int GetErrorCount(unsigned int error_id);
+
+	//writes the metrics of all handles in Prometheus text format to a file every interval milliseconds;
+	//an interval of 0 stops writing
+	static void StartWriter(const string &filename, unsigned int interval);
+	static void StopWriter();
+
+private:
+	static void ProcessWriter();
+	static bool WriteFile(const string &filename);
+
+	int m_HandleID;
+
+	CHistogram m_Timers[TIMER_COUNT];
+	boost::atomic<boost::uint64_t> m_Counters[COUNTER_COUNT];
+	unordered_map<unsigned int, unsigned int> m_Errors; //by error id
+	boost::mutex m_ErrorsMtx;
+
+	//all existing handle metrics, for the writer thread
+	static vector<CMetrics *> m_Registry;
+	static boost::mutex m_RegistryMtx;
+
+	static boost::thread *m_WriterThread;
+	static boost::mutex m_WriterMtx;
+	static boost::condition_variable m_WriterCond;
+	static string m_WriterFile;
+	static unsigned int m_WriterInterval;
+};
+
+
+#endif // INC_CMETRICS_H
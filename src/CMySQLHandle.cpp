@@ -5,6 +5,9 @@
 #include "CMySQLHandle.h"
 #include "CMySQLResult.h"
 #include "CMySQLQuery.h"
+#include "CCallback.h"
+
+#include <algorithm>
 
 
 unordered_map<int, CMySQLHandle *> CMySQLHandle::SQLHandle;
@@ -14,43 +17,290 @@ CMySQLOptions MySQLOptions;
 
 CMySQLHandle::CMySQLHandle(int id) : 
 	m_QueryThreadRunning(true),
+	m_WaitingForQueryExec(false),
 	m_QueryCounter(0),
-	m_QueryThread(NULL),
 
-	m_MyID(id),
-	
+	m_MainConnectThread(NULL),
+	m_ConnectedWorkers(0),
+	m_ConnectionState(-1),
+	m_ReconnectGeneration(0),
+
+	m_QueueLatencyTotal(0),
+	m_QueueLatencyCount(0),
+	m_QueueLatencyMax(0),
+	m_QueryQueue(1024),
+	m_QueryQueueHighWater(0),
+	m_QueryQueueOverflows(0),
+
+	m_WriteBehindMaxSize(0),
+	m_WriteBehindDelay(0),
+	m_WriteBatchLimit(0),
+	m_WriteBatchCount(0),
+	m_FlushLatencyMax(0),
+	m_WriteBatchStatements(0),
+	m_FlushLatencyTotal(0),
+
+	m_QueryTimeout(0),
+	m_WatchdogThread(NULL),
+	m_WatchedThreadID(0),
+	m_WatchTimedOut(false),
+	m_WatchGeneration(0),
+	m_KillInProgress(false),
+	m_KillConnection(NULL),
+	m_BlockingTimeTotal(0),
+	m_BlockingQueryCount(0),
+	m_BlockingTimeMax(0),
+
+	m_StatementCounter(0),
+
 	m_ActiveResult(NULL),
 	m_ActiveResultID(0),
+	m_ActiveResultIdx(0),
+
+	m_MyID(id),
+	m_Metrics(id),
+	m_QueryStats(id),
 	
-	m_MainConnection(NULL),
-	m_QueryConnection(NULL)
+	m_MainConnection(NULL)
 {
-	m_QueryThread = new boost::thread(&CMySQLHandle::ProcessQueries, this);
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::CMySQLHandle", "constructor called");
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::CMySQLHandle", "constructor called");
 }
 
 CMySQLHandle::~CMySQLHandle() 
 {
-	m_QueryThreadRunning = false;
-	m_QueryThread->join();
-	delete m_QueryThread;
+	//buffered writes were already accepted, so they're executed even if the handle is closed without waiting
+	if(!m_WriteOffsets.empty())
+		WaitForQueryExec();
+
+	{
+		boost::mutex::scoped_lock lock(m_QueryQueueMtx);
+		m_QueryThreadRunning = false;
+	}
+	m_QueryQueueCond.notify_all();
+	m_ReconnectCond.notify_all();
+	{
+		boost::mutex::scoped_lock lock(m_StreamMtx);
+	}
+	m_StreamCond.notify_all();
+	for (vector<boost::thread *>::iterator t = m_QueryThreads.begin(), end = m_QueryThreads.end(); t != end; ++t)
+	{
+		(*t)->join();
+		delete (*t);
+	}
+	if(m_WatchdogThread != NULL)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_WatchdogMtx);
+		}
+		m_WatchdogCond.notify_all();
+		m_WatchdogThread->join();
+		delete m_WatchdogThread;
+	}
+	GetMainConnection(); //waits for a pending connect
+
+	//queries which couldn't be executed anymore
+	CMySQLQuery *query = NULL;
+	while(m_QueryQueue.pop(query))
+		query->Destroy();
+	//results still waiting for their callbacks must not touch this handle anymore
+	CCallback::DetachHandle(this);
+	ResetActiveResult();
 
 	for (unordered_map<int, CMySQLResult*>::iterator it = m_SavedResults.begin(), end = m_SavedResults.end(); it != end; it++)
 		it->second->Destroy();
 
 	m_MainConnection->Destroy();
-	m_QueryConnection->Destroy();
+	m_KillConnection->Destroy();
+	for (vector<CMySQLConnection *>::iterator c = m_QueryConnections.begin(), end = m_QueryConnections.end(); c != end; ++c)
+		(*c)->Destroy();
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::~CMySQLHandle", "deconstructor called");
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::~CMySQLHandle", "deconstructor called");
 }
 
 void CMySQLHandle::WaitForQueryExec() 
 {
-	while(!m_QueryQueue.empty())
-		boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+	//the counter only drops after a query has finished executing, 
+	//so this also covers queries which are already popped by a worker
+	FlushWriteBuffer();
+
+	//queries are held back while the connection is down, so don't wait for them then
+	boost::mutex::scoped_lock lock(m_QueryExecMtx);
+	m_WaitingForQueryExec = true;
+	NotifyStreamChunkProcessed(); //streaming workers don't wait for the main thread anymore
+	while(m_QueryCounter > 0 && m_ConnectionState != 0)
+		m_QueryExecCond.timed_wait(lock, boost::posix_time::milliseconds(100));
+	m_WaitingForQueryExec = false;
+
+	if(m_QueryCounter > 0)
+		CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::WaitForQueryExec", "connection is down, %d queries are still pending (connection: %d)", static_cast<unsigned int>(m_QueryCounter), m_MyID);
+}
+
+bool CMySQLHandle::ScheduleQuery(CMySQLQuery *query) 
+{
+	if(m_WriteBehindMaxSize > 0)
+	{
+		//trailing separators would create empty statements
+		const size_t query_len = query->Query.find_last_not_of("; \t\r\n");
+		//batches run with multi-statements enabled, a query with its own separator would execute stacked statements
+		if(query->IsWriteBehindCandidate() && (query_len == string::npos || !HasStatementSeparator(query->Query.c_str(), query_len + 1)))
+		{
+			if(query_len != string::npos)
+			{
+				if(m_WriteOffsets.empty())
+					m_WriteBufferTime = boost::posix_time::microsec_clock::universal_time();
+				else
+					m_WriteBuffer.append("\n;"); //the newline ends a trailing line comment
+				m_WriteOffsets.push_back(m_WriteBuffer.length());
+				m_WriteBuffer.append(query->Query, 0, query_len + 1);
+			}
+			query->Destroy();
+
+			if(m_WriteOffsets.size() >= m_WriteBatchLimit || m_WriteBuffer.length() >= MAX_WRITE_BUFFER_LENGTH)
+				FlushWriteBuffer();
+			return true;
+		}
+		//everything else has to see the buffered writes
+		FlushWriteBuffer();
+	}
+	return PushQuery(query);
+}
+
+void CMySQLHandle::SetWriteBehind(unsigned int max_batch_size, unsigned int max_delay)
+{
+	FlushWriteBuffer();
+	m_WriteBehindMaxSize = max_batch_size;
+	m_WriteBehindDelay = max_delay;
+	m_WriteBatchLimit = max_batch_size;
+}
+
+void CMySQLHandle::FlushWriteBuffer()
+{
+	if(m_WriteOffsets.empty())
+		return ;
+
+	CMySQLQuery *batch = CMySQLQuery::Create("", this, NULL);
+	batch->Query.swap(m_WriteBuffer);
+	batch->WriteBatchOffsets.swap(m_WriteOffsets);
+	batch->WriteBufferTime = m_WriteBufferTime;
+	m_WriteBuffer.clear();
+	m_WriteOffsets.clear();
+
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::FlushWriteBuffer", "flushing %d buffered writes (connection: %d)", static_cast<int>(batch->WriteBatchOffsets.size()), m_MyID);
+	PushQuery(batch);
+}
+
+void CMySQLHandle::ProcessWriteBuffers()
+{
+	boost::posix_time::ptime now;
+	for(unordered_map<int, CMySQLHandle*>::iterator i = SQLHandle.begin(), end = SQLHandle.end(); i != end; ++i) 
+	{
+		CMySQLHandle *handle = i->second;
+		if(handle->m_WriteOffsets.empty())
+			continue;
+
+		if(now.is_not_a_date_time())
+			now = boost::posix_time::microsec_clock::universal_time();
+		if((now - handle->m_WriteBufferTime).total_milliseconds() >= handle->m_WriteBehindDelay)
+			handle->FlushWriteBuffer();
+	}
+}
+
+void CMySQLHandle::ReportWriteBatch(unsigned int num_statements, unsigned int exec_time, unsigned int flush_latency)
+{
+	m_WriteBatchCount++;
+	m_WriteBatchStatements += num_statements;
+	m_FlushLatencyTotal += flush_latency;
+	unsigned int max_latency = m_FlushLatencyMax;
+	while(flush_latency > max_latency && !m_FlushLatencyMax.compare_exchange_weak(max_latency, flush_latency));
+
+	//a batch should take less time than writes may wait in the buffer (at least 5ms);
+	//halve the batch size if it takes longer, double it if full batches are done quickly
+	const unsigned int 
+		target_time = std::max<unsigned int>(m_WriteBehindDelay, 5) * 1000,
+		max_size = m_WriteBehindMaxSize,
+		limit = m_WriteBatchLimit;
+	if(exec_time > target_time && limit > 1)
+		m_WriteBatchLimit = limit / 2;
+	else if(exec_time < target_time / 2 && num_statements >= limit && limit < max_size)
+		m_WriteBatchLimit = std::min(limit * 2, max_size);
+}
+
+bool CMySQLHandle::PushQuery(CMySQLQuery *query) 
+{
+	query->ScheduleTime = boost::posix_time::microsec_clock::universal_time();
+	const unsigned int num_queries = ++m_QueryCounter;
+	if(!m_QueryQueue.push(query))
+	{
+		//the queue only fails if no memory could be allocated
+		m_QueryCounter--;
+		m_QueryQueueOverflows++;
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLHandle::ScheduleQuery", "could not schedule query (connection: %d), out of memory", m_MyID);
+		query->Destroy();
+		return false;
+	}
+
+	//only called from the main thread
+	if(num_queries > m_QueryQueueHighWater)
+	{
+		m_QueryQueueHighWater = num_queries;
+		if(num_queries >= 1024 && (num_queries & (num_queries - 1)) == 0)
+			CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::ScheduleQuery", "%d queries waiting for execution (connection: %d)", num_queries, m_MyID);
+	}
+
+	//taking the lock makes sure no worker is between its empty-check and its wait
+	{
+		boost::mutex::scoped_lock lock(m_QueryQueueMtx);
+	}
+	m_QueryQueueCond.notify_one();
+	return true;
+}
+
+bool CMySQLHandle::WaitForQuery(CMySQLQuery *&query, unsigned int &spin_limit) 
+{
+	//spin a bit first, bursts of queries are common and cheaper to catch this way;
+	//the limit grows when spinning pays off and shrinks when it doesn't
+	for(unsigned int s = 0; s < spin_limit; ++s) 
+	{
+		if(m_QueryQueue.pop(query))
+		{
+			if(spin_limit < 1024)
+				spin_limit *= 2;
+			return true;
+		}
+		boost::this_thread::yield();
+	}
+	if(spin_limit > 16)
+		spin_limit /= 2;
+
+	boost::mutex::scoped_lock lock(m_QueryQueueMtx);
+	while(m_QueryThreadRunning) 
+	{
+		if(m_QueryQueue.pop(query))
+			return true;
+		m_QueryQueueCond.wait(lock);
+	}
+	return false;
+}
+
+bool CMySQLHandle::WaitForStreamChunks(const boost::atomic<unsigned int> &pending_chunks, unsigned int max_pending) 
+{
+	//never block while the main thread itself waits for the workers
+	boost::mutex::scoped_lock lock(m_StreamMtx);
+	while(pending_chunks >= max_pending && m_QueryThreadRunning && !m_WaitingForQueryExec)
+		m_StreamCond.wait(lock);
+	return m_QueryThreadRunning;
+}
+
+void CMySQLHandle::NotifyStreamChunkProcessed() 
+{
+	//taking the lock makes sure no worker is between its check and its wait
+	{
+		boost::mutex::scoped_lock lock(m_StreamMtx);
+	}
+	m_StreamCond.notify_all();
 }
 
-CMySQLHandle *CMySQLHandle::Create(string host, string user, string pass, string db, size_t port, bool reconnect) 
+CMySQLHandle *CMySQLHandle::Create(string host, string user, string pass, string db, size_t port, bool reconnect, unsigned int pool_size /* = 1 */) 
 {
 	CMySQLHandle *handle = NULL;
 	CMySQLConnection *main_connection = CMySQLConnection::Create(host, user, pass, db, port, reconnect);
@@ -60,14 +310,14 @@ CMySQLHandle *CMySQLHandle::Create(string host, string user, string pass, string
 			CMySQLConnection *Connection = i->second->m_MainConnection;
 			if((*Connection) == (*main_connection))
 			{
-				CLog::Get()->LogFunction(LOG_WARNING, "CMySQLHandle::Create", "connection already exists");
+				CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::Create", "connection already exists");
 				handle = i->second;
 				break;
 			}
 		}
 	}
 	if(handle == NULL) {
-			CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::Create", "creating new connection..");
+			CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::Create", "creating new connection..");
 
 		int id = 1;
 		if(SQLHandle.size() > 0) 
@@ -83,13 +333,31 @@ CMySQLHandle *CMySQLHandle::Create(string host, string user, string pass, string
 
 		handle = new CMySQLHandle(id);
 
-		//init connections
+		//init connections, every pooled connection gets its own worker thread which also connects it;
+		//the main connection is connected in the background too, so a slow server doesn't block the main thread
 		handle->m_MainConnection = main_connection;
-		handle->m_QueryConnection = CMySQLConnection::Create(host, user, pass, db, port, reconnect);
+		handle->m_KillConnection = CMySQLConnection::Create(host, user, pass, db, port, false);
+		handle->m_QueryStats.SetExplainConnection(CMySQLConnection::Create(host, user, pass, db, port, false));
+		handle->m_QueryTimeout = MySQLOptions.QueryTimeout;
+		//the client timeouts are only a safety net if the watchdog can't kill the query,
+		//libmysql retries reads, so they wait longer than the timeout anyway
+		if(MySQLOptions.QueryTimeout > 0)
+			main_connection->SetTimeout(MySQLOptions.QueryTimeout / 1000 + 1);
+		handle->m_MainConnectThread = new boost::thread(&CMySQLHandle::ConnectMainConnection, main_connection);
+		handle->m_QueryConnections.reserve(pool_size);
+		handle->m_QueryThreads.reserve(pool_size);
+		for(unsigned int i = 0; i < pool_size; ++i)
+		{
+			CMySQLConnection *query_connection = CMySQLConnection::Create(host, user, pass, db, port, reconnect);
+			handle->m_QueryConnections.push_back(query_connection);
+			handle->m_QueryThreads.push_back(new boost::thread(&CMySQLHandle::ProcessQueries, handle, query_connection));
+		}
 
 		SQLHandle.insert( unordered_map<int, CMySQLHandle*>::value_type(id, handle) );
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::Create", "connection created with id = %d", id);
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::Create", "connection created with id = %d, pool size = %d", id, pool_size);
 	}
+	else
+		main_connection->Destroy();
 	return handle;
 }
 
@@ -99,20 +367,243 @@ void CMySQLHandle::Destroy()
 	delete this;
 }
 
+CMySQLConnection *CMySQLHandle::GetMainConnection() 
+{
+	if(m_MainConnectThread != NULL)
+	{
+		m_MainConnectThread->join();
+		delete m_MainConnectThread;
+		m_MainConnectThread = NULL;
+	}
+	return m_MainConnection;
+}
+
+void CMySQLHandle::Reconnect() 
+{
+	GetMainConnection()->Disconnect();
+	m_MainConnectThread = new boost::thread(&CMySQLHandle::ConnectMainConnection, m_MainConnection);
+
+	m_ReconnectGeneration++;
+}
 
-void CMySQLHandle::ProcessQueries() 
+void CMySQLHandle::ConnectMainConnection(CMySQLConnection *connection) 
 {
 	mysql_thread_init();
-	while(m_QueryThreadRunning) 
+	connection->Connect();
+	mysql_thread_end();
+}
+
+void CMySQLHandle::WatchQuery(unsigned int timeout) 
+{
+	MYSQL *mysql = GetMainConnection()->GetMySQLPointer();
+	if(mysql == NULL)
+		return ;
+
+	boost::mutex::scoped_lock lock(m_WatchdogMtx);
+	if(m_WatchdogThread == NULL)
+		m_WatchdogThread = new boost::thread(&CMySQLHandle::WatchQueries, this);
+
+	m_WatchedThreadID = mysql_thread_id(mysql);
+	m_WatchGeneration++;
+	m_WatchDeadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+	m_WatchTimedOut = false;
+	lock.unlock();
+	m_WatchdogCond.notify_one();
+}
+
+bool CMySQLHandle::UnwatchQuery() 
+{
+	//the watchdog doesn't kill anymore once the query is unwatched; a kill which was already sent 
+	//has to complete though, it could hit the next query otherwise (that's one round trip at most)
+	boost::mutex::scoped_lock lock(m_WatchdogMtx);
+	m_WatchedThreadID = 0;
+	while(m_KillInProgress)
+		m_WatchdogCond.wait(lock);
+	return m_WatchTimedOut;
+}
+
+void CMySQLHandle::WatchQueries() 
+{
+	mysql_thread_init();
+	boost::mutex::scoped_lock lock(m_WatchdogMtx);
+	while(m_QueryThreadRunning)
 	{
-		CMySQLQuery *query = NULL;
-		while(m_QueryQueue.pop(query)) 
+		if(m_WatchedThreadID == 0)
+		{
+			m_WatchdogCond.wait(lock);
+			continue;
+		}
+		if(boost::get_system_time() < m_WatchDeadline)
+		{
+			m_WatchdogCond.timed_wait(lock, m_WatchDeadline);
+			continue;
+		}
+
+		const unsigned long thread_id = m_WatchedThreadID;
+		const unsigned int generation = m_WatchGeneration;
+
+		//connecting can take up to the connect timeout, the main thread mustn't wait for it in UnwatchQuery
+		if(!m_KillConnection->IsConnected())
 		{
-			query->Execute();
-			m_QueryCounter--;
+			lock.unlock();
+			m_KillConnection->Connect();
+			lock.lock();
+			//the query may have finished in the meantime
+			if(m_WatchedThreadID == 0 || m_WatchGeneration != generation)
+				continue;
 		}
-		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		m_WatchedThreadID = 0;
+		m_KillInProgress = true;
+		lock.unlock();
+
+		char kill_query[32];
+		sprintf(kill_query, "KILL QUERY %lu", thread_id);
+		MYSQL *mysql = m_KillConnection->GetMySQLPointer();
+		const bool killed = m_KillConnection->IsConnected() && mysql_real_query(mysql, kill_query, strlen(kill_query)) == 0;
+		if(!killed)
+		{
+			CLOG_FUNCTION(LOG_ERROR, "CMySQLHandle::WatchQueries", "could not kill timed out query (error #%d) %s", mysql_errno(mysql), mysql_error(mysql));
+			m_KillConnection->Disconnect();
+		}
+
+		lock.lock();
+		m_KillInProgress = false;
+		if(killed)
+			m_WatchTimedOut = true;
+		m_WatchdogCond.notify_all(); //UnwatchQuery may wait for the kill
 	}
+	if(m_KillConnection->IsConnected())
+		m_KillConnection->Disconnect();
+	mysql_thread_end();
+}
+
+void CMySQLHandle::AddBlockingTime(AMX *amx, unsigned int time) 
+{
+	m_BlockingTimeTotal += time;
+	m_BlockingQueryCount++;
+	if(time > m_BlockingTimeMax)
+		m_BlockingTimeMax = time;
+	m_ScriptBlockingTime[amx] += time;
+}
+
+unsigned int CMySQLHandle::GetBlockingTime(AMX *amx /* = NULL */) const 
+{
+	if(amx == NULL)
+		return static_cast<unsigned int>(m_BlockingTimeTotal / 1000);
+
+	unordered_map<AMX *, boost::uint64_t>::const_iterator it = m_ScriptBlockingTime.find(amx);
+	return it != m_ScriptBlockingTime.end() ? static_cast<unsigned int>(it->second / 1000) : 0;
+}
+
+void CMySQLHandle::EraseAmx(AMX *amx) 
+{
+	for(unordered_map<int, CMySQLHandle *>::iterator i = SQLHandle.begin(), end = SQLHandle.end(); i != end; ++i)
+		i->second->m_ScriptBlockingTime.erase(amx);
+}
+
+bool CMySQLHandle::ConnectQueryConnection(CMySQLConnection *connection, bool &connected) 
+{
+	unsigned int delay = RECONNECT_MIN_DELAY;
+	while(m_QueryThreadRunning)
+	{
+		connection->Connect();
+		if(connection->IsConnected())
+		{
+			if(!connected)
+			{
+				connected = true;
+				ChangeConnectionState(1, 0, string());
+			}
+			return true;
+		}
+
+		MYSQL *sql_connection = connection->GetMySQLPointer();
+		int error_id = sql_connection != NULL ? mysql_errno(sql_connection) : 0;
+		string error_str(sql_connection != NULL ? mysql_error(sql_connection) : "");
+		ChangeConnectionState(connected ? -1 : 0, error_id, error_str);
+		connected = false;
+
+		//without auto-reconnect the queries fail with an error, like before
+		if(!connection->GetAutoReconnect())
+			return true;
+
+		CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::ConnectQueryConnection", "connecting failed (connection: %d), next attempt in %d milliseconds", m_MyID, delay);
+		connection->Disconnect();
+
+		const boost::system_time next_attempt = boost::get_system_time() + boost::posix_time::milliseconds(delay);
+		{
+			boost::mutex::scoped_lock lock(m_QueryQueueMtx);
+			while(m_QueryThreadRunning && boost::get_system_time() < next_attempt)
+				m_ReconnectCond.timed_wait(lock, next_attempt);
+		}
+		delay = std::min(delay * 2, static_cast<unsigned int>(RECONNECT_MAX_DELAY));
+	}
+	return false;
+}
+
+void CMySQLHandle::ChangeConnectionState(int delta, int error_id, const string &error_str) 
+{
+	const int state = (m_ConnectedWorkers += delta) > 0 ? 1 : 0;
+	if(m_ConnectionState.exchange(state) == state || !m_QueryThreadRunning) //no callbacks for a closed handle
+		return ;
+
+	CLOG_FUNCTION(state == 1 ? LOG_DEBUG : LOG_WARNING, "CMySQLHandle::ChangeConnectionState", "connection %d is %s", m_MyID, state == 1 ? "up" : "down");
+
+	//forward OnConnectionStateChange(connectionHandle, bool:connected, errorid, error[]);
+	CMySQLQuery *query = CMySQLQuery::Create("", this, "OnConnectionStateChange");
+	query->Callback->AddParam(static_cast<cell>(m_MyID));
+	query->Callback->AddParam(static_cast<cell>(state));
+	query->Callback->AddParam(static_cast<cell>(error_id));
+	query->Callback->AddParam(error_str);
+	CCallback::AddQueryToQueue(query);
+}
+
+
+void CMySQLHandle::ProcessQueries(CMySQLConnection *connection) 
+{
+	mysql_thread_init();
+	unsigned int spin_limit = 64;
+	bool connected = false;
+	unsigned int reconnect_generation = m_ReconnectGeneration;
+	bool running = ConnectQueryConnection(connection, connected);
+	
+	//all workers share one queue, so whichever connection is idle first 
+	//(the least loaded one) picks up the next query
+	CMySQLQuery *query = NULL;
+	while(running && WaitForQuery(query, spin_limit)) 
+	{
+		unsigned int latency = static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - query->ScheduleTime).total_microseconds());
+		m_QueueLatencyTotal += latency;
+		m_QueueLatencyCount++;
+		unsigned int max_latency = m_QueueLatencyMax;
+		while(latency > max_latency && !m_QueueLatencyMax.compare_exchange_weak(max_latency, latency));
+		m_Metrics.AddTime(TIMER_QUEUE_WAIT, latency);
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::ProcessQueries", "query waited %u microseconds in queue", latency);
+
+		if(reconnect_generation != m_ReconnectGeneration)
+		{
+			reconnect_generation = m_ReconnectGeneration;
+			connection->Disconnect();
+			running = ConnectQueryConnection(connection, connected);
+		}
+
+		//while the connection is down the query stays with this worker, it's executed as soon as the connection is back
+		query->Connection = connection;
+		while(running && !query->Execute())
+			running = ConnectQueryConnection(connection, connected);
+		if(!running)
+			query->Destroy();
+
+		if(--m_QueryCounter == 0)
+		{
+			boost::mutex::scoped_lock lock(m_QueryExecMtx);
+			m_QueryExecCond.notify_all();
+		}
+	}
+
+	if(connected)
+		ChangeConnectionState(-1, 0, string());
+	connection->Disconnect();
 	mysql_thread_end();
 }
 
@@ -123,7 +614,7 @@ int CMySQLHandle::SaveActiveResult()
 	{
 		if(m_ActiveResultID != 0) //if active cache was already saved
 		{
-			CLog::Get()->LogFunction(LOG_WARNING, "CMySQLHandle::SaveActiveResult", "active cache was already saved");
+			CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::SaveActiveResult", "active cache was already saved");
 			return m_ActiveResultID; //return the ID of already saved cache
 		}
 		else 
@@ -142,7 +633,7 @@ int CMySQLHandle::SaveActiveResult()
 			m_ActiveResultID = id;
 			m_SavedResults.insert( std::map<int, CMySQLResult*>::value_type(id, m_ActiveResult) );
 			
-			CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::SaveActiveResult", "cache saved with ID = %d", id);
+			CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::SaveActiveResult", "cache saved with ID = %d", id);
 			return id; 
 		}
 	}
@@ -161,16 +652,17 @@ bool CMySQLHandle::DeleteSavedResult(int resultid)
 			{
 				m_ActiveResult = NULL;
 				m_ActiveResultID = 0;
+				m_ActiveResultIdx = 0;
 				ActiveHandle = NULL;
 			}
 			ResultHandle->Destroy();
 			m_SavedResults.erase(resultid);
-			CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::DeleteSavedResult", "result deleted");
+			CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::DeleteSavedResult", "result deleted");
 			return true;
 		}
 	}
 	
-	CLog::Get()->LogFunction(LOG_WARNING, "CMySQLHandle::DeleteSavedResult", "invalid result ID ('%d')", resultid);
+	CLOG_FUNCTION(LOG_WARNING, "CMySQLHandle::DeleteSavedResult", "invalid result ID ('%d')", resultid);
 	return false;
 }
 
@@ -189,12 +681,13 @@ bool CMySQLHandle::SetActiveResult(int resultid)
 				
 				m_ActiveResult = cResult; //set new active cache
 				m_ActiveResultID = resultid; //new active cache was stored previously
+				m_ActiveResultIdx = 0;
 				ActiveHandle = this;
-				CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::SetActiveResult", "result is now active");
+				CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::SetActiveResult", "result is now active");
 			}
 		}
 		else
-			CLog::Get()->LogFunction(LOG_ERROR, "CMySQLHandle::SetActiveResult", "result not found");
+			CLOG_FUNCTION(LOG_ERROR, "CMySQLHandle::SetActiveResult", "result not found");
 	}
 	else 
 	{
@@ -202,12 +695,36 @@ bool CMySQLHandle::SetActiveResult(int resultid)
 			m_ActiveResult->Destroy(); //delete unsaved cache
 		m_ActiveResult = NULL;
 		m_ActiveResultID = 0;
+		m_ActiveResultIdx = 0;
 		ActiveHandle = NULL;
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLHandle::SetActiveResult", "invalid result ID specified, setting active result to zero");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::SetActiveResult", "invalid result ID specified, setting active result to zero");
 	}
 	return true;
 }
 
+int CMySQLHandle::RegisterStatement(const char *query) 
+{
+	int id = ++m_StatementCounter;
+	{
+		boost::mutex::scoped_lock lock(m_StatementsMtx);
+		m_Statements.insert( unordered_map<int, string>::value_type(id, query) );
+	}
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLHandle::RegisterStatement", "statement registered with ID = %d", id);
+	return id;
+}
+
+void CMySQLHandle::CloseStatement(int id) 
+{
+	//erased before the connections are told, a worker which still sees the statement 
+	//releases it with the next statement it executes
+	{
+		boost::mutex::scoped_lock lock(m_StatementsMtx);
+		m_Statements.erase(id);
+	}
+	for (vector<CMySQLConnection *>::iterator c = m_QueryConnections.begin(), end = m_QueryConnections.end(); c != end; ++c)
+		(*c)->CloseStatement(id);
+}
+
 void CMySQLHandle::ClearAll()
 {
 	for(unordered_map<int, CMySQLHandle *>::iterator i = SQLHandle.begin(); i != SQLHandle.end(); ++i)
@@ -220,6 +737,34 @@ void CMySQLHandle::SetActiveResult(CMySQLResult *result)
 {
 	m_ActiveResult = result;
 	m_ActiveResultID = 0;
+	m_ActiveResultIdx = 0;
+}
+
+CMySQLResult *CMySQLHandle::GetActiveResult() const
+{
+	return m_ActiveResult != NULL ? m_ActiveResult->GetResult(m_ActiveResultIdx) : NULL;
+}
+
+unsigned int CMySQLHandle::GetActiveResultCount() const
+{
+	return m_ActiveResult != NULL ? m_ActiveResult->GetResultCount() : 0;
+}
+
+void CMySQLHandle::ResetActiveResult()
+{
+	if(m_ActiveResult != NULL && m_ActiveResultID == 0)
+		m_ActiveResult->Destroy();
+
+	SetActiveResult((CMySQLResult *)NULL);
+}
+
+bool CMySQLHandle::SetActiveResultIndex(unsigned int idx)
+{
+	if(m_ActiveResult == NULL || idx >= m_ActiveResult->GetResultCount())
+		return false;
+
+	m_ActiveResultIdx = idx;
+	return true;
 }
 
 
@@ -240,23 +785,29 @@ void CMySQLConnection::Connect()
 	{
 		m_Connection = mysql_init(NULL);
 		if (m_Connection == NULL)
-			CLog::Get()->LogFunction(LOG_ERROR, "CMySQLConnection::Connect", "MySQL initialization failed");
+			CLOG_FUNCTION(LOG_ERROR, "CMySQLConnection::Connect", "MySQL initialization failed");
+		else if(m_Timeout > 0)
+		{
+			mysql_options(m_Connection, MYSQL_OPT_READ_TIMEOUT, &m_Timeout);
+			mysql_options(m_Connection, MYSQL_OPT_WRITE_TIMEOUT, &m_Timeout);
+		}
 	}
 
 	if (!m_IsConnected && !mysql_real_connect(m_Connection, m_Host.c_str(), m_User.c_str(), m_Passw.c_str(), m_Database.c_str(), m_Port, NULL, NULL)) 
 	{
-		CLog::Get()->LogFunction(LOG_ERROR, "CMySQLConnection::Connect", "(error #%d) %s", mysql_errno(m_Connection), mysql_error(m_Connection));
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLConnection::Connect", "(error #%d) %s", mysql_errno(m_Connection), mysql_error(m_Connection));
 
 		m_IsConnected = false;
 	} 
 	else 
 	{
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLConnection::Connect", "connection was successful");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLConnection::Connect", "connection was successful");
 
 		my_bool reconnect = m_AutoReconnect;
 		mysql_options(m_Connection, MYSQL_OPT_RECONNECT, &reconnect);
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLConnection::Connect", "auto-reconnect has been %s", m_AutoReconnect == true ? "enabled" : "disabled");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLConnection::Connect", "auto-reconnect has been %s", m_AutoReconnect == true ? "enabled" : "disabled");
 		
+		UpdateEscapeSettings();
 		m_IsConnected = true;
 	}
 }
@@ -264,26 +815,143 @@ void CMySQLConnection::Connect()
 void CMySQLConnection::Disconnect() 
 {
 	if (m_Connection == NULL)
-		CLog::Get()->LogFunction(LOG_WARNING, "CMySQLConnection::Disconnect", "no connection available");
+		CLOG_FUNCTION(LOG_WARNING, "CMySQLConnection::Disconnect", "no connection available");
 	else 
 	{
+		//prepared statements die with the connection, they get prepared again after reconnecting
+		for (unordered_map<int, MYSQL_STMT *>::iterator s = m_Statements.begin(), end = m_Statements.end(); s != end; ++s)
+			mysql_stmt_close(s->second);
+		m_Statements.clear();
+
 		mysql_close(m_Connection);
 		m_Connection = NULL;
 		m_IsConnected = false;
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLConnection::Disconnect", "connection was closed");
+		m_MultiStatements = false;
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLConnection::Disconnect", "connection was closed");
+	}
+}
+
+bool CMySQLConnection::SetMultiStatements(bool enable)
+{
+	const unsigned long thread_id = mysql_thread_id(m_Connection);
+	const bool enabled = m_MultiStatements && m_MultiStatementsThreadID == thread_id;
+	if(enabled == enable)
+		return true;
+
+	if(mysql_set_server_option(m_Connection, enable ? MYSQL_OPTION_MULTI_STATEMENTS_ON : MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0)
+	{
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLConnection::SetMultiStatements", "(error #%d) %s", mysql_errno(m_Connection), mysql_error(m_Connection));
+		return false;
 	}
+	m_MultiStatements = enable;
+	m_MultiStatementsThreadID = thread_id;
+	return true;
 }
 
 void CMySQLConnection::EscapeString(const char *src, string &dest)
 {
-	if(src != NULL && m_IsConnected) 
+	if(src != NULL) 
 	{
 		size_t src_len = strlen(src);
-		char *escaped_str = (char *)malloc((src_len*2 + 1) * sizeof(char));
+		dest.resize(src_len*2 + 1);
+		dest.resize(EscapeString(src, src_len, &dest[0]));
+	}
+}
 
-		mysql_real_escape_string(m_Connection, escaped_str, src, src_len);
-		dest.assign(escaped_str);
+size_t CMySQLConnection::EscapeString(const char *src, size_t src_len, char *dest)
+{
+	if(m_EscapeCharset != ESCAPE_CHARSET_NONE)
+	{
+		if(m_IsConnected)
+			m_NoBackslashEscapes = (m_Connection->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES) != 0;
+		return EscapeSQLString(src, src_len, dest, m_EscapeCharset, m_NoBackslashEscapes);
+	}
 
-		free(escaped_str);
+	if(!m_IsConnected)
+	{
+		*dest = '\0';
+		return 0;
 	}
+	return mysql_real_escape_string(m_Connection, dest, src, src_len);
 }
+
+bool CMySQLConnection::SetCharset(const char *charset)
+{
+	if(m_Connection == NULL)
+		return false;
+
+	const bool success = (mysql_set_character_set(m_Connection, charset) == 0);
+	UpdateEscapeSettings();
+	return success;
+}
+
+void CMySQLConnection::UpdateEscapeSettings()
+{
+	MY_CHARSET_INFO charset_info;
+	mysql_get_character_set_info(m_Connection, &charset_info);
+
+	//other multi-byte character sets (like gbk or sjis) use bytes of special characters in multi-byte characters,
+	//only libmysqlclient knows them
+	if(charset_info.mbmaxlen <= 1)
+		m_EscapeCharset = ESCAPE_CHARSET_SINGLE_BYTE;
+	else if(strcmp(charset_info.csname, "utf8") == 0 || strcmp(charset_info.csname, "utf8mb3") == 0)
+		m_EscapeCharset = ESCAPE_CHARSET_UTF8;
+	else if(strcmp(charset_info.csname, "utf8mb4") == 0)
+		m_EscapeCharset = ESCAPE_CHARSET_UTF8MB4;
+	else
+		m_EscapeCharset = ESCAPE_CHARSET_NONE;
+
+	m_NoBackslashEscapes = (m_Connection->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES) != 0;
+
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLConnection::UpdateEscapeSettings", "character set \"%s\", %s escaper", charset_info.csname, m_EscapeCharset != ESCAPE_CHARSET_NONE ? "built-in" : "libmysqlclient");
+}
+
+
+MYSQL_STMT *CMySQLConnection::GetStatement(int id, const string &query)
+{
+	unordered_map<int, MYSQL_STMT *>::iterator it = m_Statements.find(id);
+	if(it != m_Statements.end())
+		return it->second;
+
+	if(m_Connection == NULL)
+		return NULL;
+
+	MYSQL_STMT *stmt = mysql_stmt_init(m_Connection);
+	if(stmt == NULL)
+		return NULL;
+
+	if(mysql_stmt_prepare(stmt, query.c_str(), query.length()) != 0)
+	{
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLConnection::GetStatement", "(error #%d) %s", mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLConnection::GetStatement", "statement with ID = %d prepared", id);
+	m_Statements.insert( unordered_map<int, MYSQL_STMT *>::value_type(id, stmt) );
+	return stmt;
+}
+
+void CMySQLConnection::DropStatement(int id)
+{
+	unordered_map<int, MYSQL_STMT *>::iterator it = m_Statements.find(id);
+	if(it != m_Statements.end())
+	{
+		mysql_stmt_close(it->second);
+		m_Statements.erase(it);
+	}
+}
+
+void CMySQLConnection::CloseStatement(int id)
+{
+	boost::mutex::scoped_lock lock(m_ClosedStatementsMtx);
+	m_ClosedStatements.push_back(id);
+}
+
+void CMySQLConnection::ReleaseClosedStatements()
+{
+	boost::mutex::scoped_lock lock(m_ClosedStatementsMtx);
+	for (vector<int>::iterator i = m_ClosedStatements.begin(), end = m_ClosedStatements.end(); i != end; ++i)
+		DropStatement(*i);
+	m_ClosedStatements.clear();
+}
\ No newline at end of file
@@ -4,12 +4,18 @@
 
 
 #include <string>
+#include <vector>
 #include <boost/unordered_map.hpp>
-#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 using std::string;
+using std::vector;
 using boost::unordered_map;
 
 #ifdef WIN32
@@ -18,6 +24,9 @@ using boost::unordered_map;
 #include "mysql_include/mysql.h"
 
 #include "main.h"
+#include "misc.h"
+#include "CMetrics.h"
+#include "CQueryStats.h"
 
 
 class CMySQLResult;
@@ -25,7 +34,14 @@ class CMySQLQuery;
 
 
 #define ERROR_INVALID_CONNECTION_HANDLE(function, id) \
-	CLog::Get()->LogFunction(LOG_ERROR, #function, "invalid connection handle (ID = %d)", id), 0
+	CLOG_FUNCTION(LOG_ERROR, #function, "invalid connection handle (ID = %d)", id), 0
+
+#define MAX_QUERY_POOL_SIZE 32
+#define MAX_WRITE_BATCH_SIZE 1024
+#define MAX_WRITE_BUFFER_LENGTH (1024 * 1024)
+//delay (in milliseconds) between reconnect attempts, doubled after every failed attempt
+#define RECONNECT_MIN_DELAY 250
+#define RECONNECT_MAX_DELAY 30000
 
 
 class CMySQLConnection 
@@ -40,6 +56,29 @@ public:
 
 	//escape a string to dest
 	void EscapeString(const char *src, string &dest);
+	//dest has to hold at least src_len*2+1 characters, returns the length of the escaped string;
+	//works without a connection too once the character set is known (utf8, utf8mb4 and single-byte character sets)
+	size_t EscapeString(const char *src, size_t src_len, char *dest);
+
+	//changes the character set of the connection and the escaper
+	bool SetCharset(const char *charset);
+
+	//returns this connection's prepared version of a statement, prepares it on first use (worker thread only)
+	MYSQL_STMT *GetStatement(int id, const string &query);
+	//forgets a prepared statement, it gets prepared again on next use (worker thread only)
+	void DropStatement(int id);
+	//marks a statement as closed, it's released next time the worker thread uses this connection
+	void CloseStatement(int id);
+	void ReleaseClosedStatements();
+
+	//switches multi-statement support on or off, only talks to the server if the state changes (worker thread only)
+	bool SetMultiStatements(bool enable);
+
+	//client read/write timeout (in seconds, 0 = none), applied on the next connect
+	inline void SetTimeout(unsigned int timeout) 
+	{
+		m_Timeout = timeout;
+	}
 
 	inline MYSQL *GetMySQLPointer() 
 	{
@@ -70,8 +109,15 @@ private:
 
 			m_IsConnected(false),
 			m_AutoReconnect(auto_reconnect),
+			m_Timeout(0),
+
+			m_Connection(NULL),
 
-			m_Connection(NULL)
+			m_EscapeCharset(ESCAPE_CHARSET_NONE),
+			m_NoBackslashEscapes(false),
+
+			m_MultiStatements(false),
+			m_MultiStatementsThreadID(0)
 	{ }
 	~CMySQLConnection()
 	{ }
@@ -91,8 +137,27 @@ private:
 	//automatic reconnect
 	bool m_AutoReconnect;
 
+	unsigned int m_Timeout;
+
 	//internal MYSQL pointer
 	MYSQL *m_Connection;
+
+	//escaper settings, taken from the connection after connecting and changing the character set,
+	//so strings can still be escaped while the connection is lost;
+	//the SQL mode (NO_BACKSLASH_ESCAPES) can change with any query, so it's read again on every escape while connected
+	void UpdateEscapeSettings();
+	e_EscapeCharset m_EscapeCharset;
+	bool m_NoBackslashEscapes;
+
+	//multi-statement support is switched on only for batch queries;
+	//the thread id detects reconnects, which switch it off again
+	bool m_MultiStatements;
+	unsigned long m_MultiStatementsThreadID;
+
+	//prepared statements of this connection, by statement id
+	unordered_map<int, MYSQL_STMT *> m_Statements;
+	vector<int> m_ClosedStatements;
+	boost::mutex m_ClosedStatementsMtx;
 };
 
 
@@ -101,17 +166,56 @@ class CMySQLHandle
 public:
 	//freezes the thread until all pending queries are executed
 	void WaitForQueryExec();
+	inline bool IsWaitingForQueryExec() const 
+	{
+		return m_WaitingForQueryExec;
+	}
+
+	//returns main MySQL connection, waits until its background connect is finished
+	CMySQLConnection *GetMainConnection();
+	//reconnects all connections in the background; 
+	//the worker threads reconnect their connection before executing the next query
+	void Reconnect();
 
-	//returns main MySQL connection
-	inline CMySQLConnection *GetMainConnection() const 
+	//unthreaded queries (mysql_query): a watchdog thread kills the running query 
+	//through a side connection once it runs longer than the timeout (in milliseconds)
+	inline void SetQueryTimeout(unsigned int timeout) 
+	{
+		m_QueryTimeout = timeout;
+	}
+	inline unsigned int GetQueryTimeout() const 
+	{
+		return m_QueryTimeout;
+	}
+	//arms the watchdog for the query which is about to run on the main connection
+	void WatchQuery(unsigned int timeout);
+	//disarms the watchdog, returns true if the query was killed
+	bool UnwatchQuery();
+	//time (in microseconds) the main thread was blocked by an unthreaded query of a script
+	void AddBlockingTime(AMX *amx, unsigned int time);
+	inline unsigned int GetBlockingQueryCount() const 
+	{
+		return m_BlockingQueryCount;
+	}
+	//returns the longest blocking time in milliseconds
+	inline unsigned int GetMaxBlockingTime() const 
 	{
-		return m_MainConnection;
+		return m_BlockingTimeMax / 1000;
 	}
+	//returns total blocking time in milliseconds, either of all scripts or only of the given one
+	unsigned int GetBlockingTime(AMX *amx = NULL) const;
+	//forgets the blocking time of an unloaded script in all handles
+	static void EraseAmx(AMX *amx);
 
-	//returns MySQL connection for unthreaded queries
-	inline CMySQLConnection *GetQueryConnection() const 
+	//returns pooled MySQL connection for threaded queries
+	inline CMySQLConnection *GetQueryConnection(size_t idx) const 
 	{
-		return m_QueryConnection;
+		return m_QueryConnections.at(idx);
+	}
+	//returns number of pooled connections (and worker threads)
+	inline size_t GetQueryConnectionCount() const 
+	{
+		return m_QueryConnections.size();
 	}
 	
 	//checks if handle exists by id
@@ -120,17 +224,19 @@ public:
 		return (SQLHandle.find(id) != SQLHandle.end());
 	}
 
-	//schedules query
-	inline bool ScheduleQuery(CMySQLQuery *query) 
-	{
-		m_QueryCounter++;
-		return m_QueryQueue.push(query);
-	}
-	//process queries
-	void ProcessQueries();
+	//schedules query and wakes up an idle worker thread;
+	//callback-less writes are buffered instead if write-behind is enabled
+	bool ScheduleQuery(CMySQLQuery *query);
+	//process queries, one call per pooled connection
+	void ProcessQueries(CMySQLConnection *connection);
+	//streamed queries: blocks the worker while max_pending chunks of its query wait for their callbacks;
+	//returns false if the handle is closed meanwhile
+	bool WaitForStreamChunks(const boost::atomic<unsigned int> &pending_chunks, unsigned int max_pending);
+	//called by the main thread after a chunk was processed
+	void NotifyStreamChunkProcessed();
 
 	//fabric function
-	static CMySQLHandle *Create(string host, string user, string pass, string db, size_t port, bool reconnect);
+	static CMySQLHandle *Create(string host, string user, string pass, string db, size_t port, bool reconnect, unsigned int pool_size = 1);
 	//delete function, call this instead of delete operator!
 	void Destroy();
 	//returns MySQL handle by id
@@ -148,6 +254,65 @@ public:
 	{
 		return m_QueryCounter;
 	}
+	//highest number of unprocessed queries so far
+	inline unsigned int GetQueryQueueHighWater() const 
+	{
+		return m_QueryQueueHighWater;
+	}
+	//number of queries which couldn't be scheduled
+	inline unsigned int GetQueryQueueOverflows() const 
+	{
+		return m_QueryQueueOverflows;
+	}
+	//returns average/maximum time (in microseconds) threaded queries spent in the queue before execution
+	inline unsigned int GetAverageQueueLatency() const 
+	{
+		unsigned int count = m_QueueLatencyCount;
+		return count > 0 ? static_cast<unsigned int>(m_QueueLatencyTotal / count) : 0;
+	}
+	inline unsigned int GetMaxQueueLatency() const 
+	{
+		return m_QueueLatencyMax;
+	}
+
+	//query pipeline metrics
+	inline CMetrics &GetMetrics() 
+	{
+		return m_Metrics;
+	}
+	//execution statistics by query fingerprint and slow query log
+	inline CQueryStats &GetQueryStats() 
+	{
+		return m_QueryStats;
+	}
+
+	//write-behind: callback-less writes are collected and sent as one multi-statement query
+	//once max_batch_size writes are buffered or the oldest one waited max_delay milliseconds
+	void SetWriteBehind(unsigned int max_batch_size, unsigned int max_delay);
+	void FlushWriteBuffer();
+	//flushes all write buffers which waited long enough, called every server tick
+	static void ProcessWriteBuffers();
+	//called by the worker thread after a buffered batch was executed, adapts the batch size
+	void ReportWriteBatch(unsigned int num_statements, unsigned int exec_time, unsigned int flush_latency);
+	inline unsigned int GetWriteBatchCount() const 
+	{
+		return m_WriteBatchCount;
+	}
+	inline unsigned int GetAverageWriteBatchSize() const 
+	{
+		unsigned int count = m_WriteBatchCount;
+		return count > 0 ? static_cast<unsigned int>(m_WriteBatchStatements / count) : 0;
+	}
+	//returns average/maximum time (in microseconds) from buffering the first write of a batch until the batch was executed
+	inline unsigned int GetAverageFlushLatency() const 
+	{
+		unsigned int count = m_WriteBatchCount;
+		return count > 0 ? static_cast<unsigned int>(m_FlushLatencyTotal / count) : 0;
+	}
+	inline unsigned int GetMaxFlushLatency() const 
+	{
+		return m_FlushLatencyMax;
+	}
 
 
 	void SetActiveResult(CMySQLResult *result);
@@ -155,19 +320,37 @@ public:
 	int SaveActiveResult();
 	bool DeleteSavedResult(int resultid);
 	bool SetActiveResult(int resultid);
-	inline CMySQLResult *GetActiveResult() const 
-	{
-		return m_ActiveResult;
-	}
+	//returns the selected statement result of the active result
+	CMySQLResult *GetActiveResult() const;
 	inline bool IsActiveResultSaved() const 
 	{
 		return m_ActiveResultID > 0 ? true : false;
 	}
+	//destroys the active result if it wasn't saved and unsets it
+	void ResetActiveResult();
+	//selects a statement result of a multi-statement result
+	bool SetActiveResultIndex(unsigned int idx);
+	unsigned int GetActiveResultCount() const;
 
 	
 	static void ClearAll();
 
 
+	//prepared statements; only the query is stored here, the worker connections prepare it on first use
+	int RegisterStatement(const char *query);
+	void CloseStatement(int id);
+	//also used by the worker threads, to drop executes of statements closed while they were queued
+	inline bool IsValidStatement(int id) const 
+	{
+		boost::mutex::scoped_lock lock(m_StatementsMtx);
+		return m_Statements.find(id) != m_Statements.end();
+	}
+	inline const string &GetStatementQuery(int id) const 
+	{
+		return m_Statements.at(id);
+	}
+
+
 	static CMySQLHandle *ActiveHandle;
 private:
 	CMySQLHandle(int id);
@@ -175,33 +358,124 @@ private:
 
 	static unordered_map<int, CMySQLHandle *> SQLHandle;
 	
-	boost::atomic<bool> m_QueryThreadRunning;
+	//blocks the calling worker thread until there is something in the queue
+	bool WaitForQuery(CMySQLQuery *&query, unsigned int &spin_limit);
+	//puts the query into the queue, bypassing the write buffer
+	bool PushQuery(CMySQLQuery *query);
+
+	static void ConnectMainConnection(CMySQLConnection *connection);
+	void WatchQueries();
+	//(re)connects a worker's connection, retrying with exponential backoff if auto-reconnect is enabled;
+	//returns false if the handle is closed meanwhile
+	bool ConnectQueryConnection(CMySQLConnection *connection, bool &connected);
+	//delta is the change of connected worker connections; calls OnConnectionStateChange if the handle's state changes
+	void ChangeConnectionState(int delta, int error_id, const string &error_str);
+
+	boost::atomic<bool> 
+		m_QueryThreadRunning,
+		m_WaitingForQueryExec;
 	boost::atomic<unsigned int> m_QueryCounter;
-	boost::thread *m_QueryThread;
-	boost::lockfree::spsc_queue <
-			CMySQLQuery *,
-			boost::lockfree::capacity<16384> 
-		> m_QueryQueue;
+	vector<boost::thread *> m_QueryThreads;
+
+	//signals new queries to the worker threads
+	boost::mutex m_QueryQueueMtx;
+	boost::condition_variable m_QueryQueueCond;
+	//signals the main thread that all queries are executed
+	boost::mutex m_QueryExecMtx;
+	boost::condition_variable m_QueryExecCond;
+	//wakes up worker threads waiting for their next reconnect attempt (uses m_QueryQueueMtx)
+	boost::condition_variable m_ReconnectCond;
+	//signals streaming workers that a chunk was processed, the handle is closed or the main thread waits for them
+	boost::mutex m_StreamMtx;
+	boost::condition_variable m_StreamCond;
+
+	boost::thread *m_MainConnectThread;
+	boost::atomic<int> 
+		m_ConnectedWorkers,
+		m_ConnectionState; //-1 = unknown, 0 = disconnected, 1 = connected
+	boost::atomic<unsigned int> m_ReconnectGeneration;
+
+	boost::atomic<boost::uint64_t> m_QueueLatencyTotal;
+	boost::atomic<unsigned int> 
+		m_QueueLatencyCount,
+		m_QueueLatencyMax;
+	//grows on demand, the reserved nodes only avoid allocations for usual loads
+	boost::lockfree::queue<CMySQLQuery *> m_QueryQueue;
+	unsigned int 
+		m_QueryQueueHighWater,
+		m_QueryQueueOverflows;
+
+	//write-behind buffer (main thread only); statements are separated by ';'
+	string m_WriteBuffer;
+	vector<size_t> m_WriteOffsets;
+	boost::posix_time::ptime m_WriteBufferTime; //time the first buffered write was added
+	//set by the main thread, read by the workers in ReportWriteBatch
+	boost::atomic<unsigned int> 
+		m_WriteBehindMaxSize, //0 if write-behind is disabled
+		m_WriteBehindDelay; //in milliseconds
+	//current batch size, adapted to the execution time of the last batches
+	boost::atomic<unsigned int> m_WriteBatchLimit;
+	boost::atomic<unsigned int> 
+		m_WriteBatchCount,
+		m_FlushLatencyMax;
+	boost::atomic<boost::uint64_t> 
+		m_WriteBatchStatements,
+		m_FlushLatencyTotal;
+
+	//unthreaded query watchdog
+	unsigned int m_QueryTimeout; //0 if disabled
+	boost::thread *m_WatchdogThread; //started on first use
+	boost::mutex m_WatchdogMtx;
+	boost::condition_variable m_WatchdogCond;
+	unsigned long m_WatchedThreadID; //server thread id of the main connection, 0 if no query is watched
+	boost::system_time m_WatchDeadline;
+	bool m_WatchTimedOut;
+	unsigned int m_WatchGeneration; //counts watched queries, the main connection's thread id is the same for all of them
+	bool m_KillInProgress; //KILL QUERY was sent without holding the lock
+	CMySQLConnection *m_KillConnection; //only used by the watchdog thread
+	//main thread blocking time (in microseconds), total and per script
+	boost::uint64_t m_BlockingTimeTotal;
+	unsigned int 
+		m_BlockingQueryCount,
+		m_BlockingTimeMax;
+	unordered_map<AMX *, boost::uint64_t> m_ScriptBlockingTime;
 
 	unordered_map<int, CMySQLResult*> m_SavedResults;
 
+	//statement ids are never reused, so worker connections can't confuse a closed statement with a new one
+	unordered_map<int, string> m_Statements;
+	mutable boost::mutex m_StatementsMtx; //only changes are locked in the main thread
+	int m_StatementCounter;
+
 	CMySQLResult *m_ActiveResult;
 	int m_ActiveResultID; //ID of stored result; 0 if not stored yet
+	unsigned int m_ActiveResultIdx; //selected statement result of m_ActiveResult
 
 	int m_MyID;
 
-	CMySQLConnection
-		*m_MainConnection, //only used in main thread
-		*m_QueryConnection; //used for threaded queries
+	CMetrics m_Metrics;
+	CQueryStats m_QueryStats;
+
+	CMySQLConnection *m_MainConnection; //only used in main thread
+	vector<CMySQLConnection *> m_QueryConnections; //used for threaded queries, one per worker thread
 };
 
 
 struct CMySQLOptions
 {
 	CMySQLOptions() :
-		DuplicateConnections(false)
+		DuplicateConnections(false),
+		CallbackTimeBudget(0),
+		CallbackCountBudget(0),
+		QueryTimeout(0)
 	{}
 	bool DuplicateConnections;
+	//limits for the callbacks processed in one server tick, 0 means unlimited
+	unsigned int 
+		CallbackTimeBudget, //in microseconds
+		CallbackCountBudget;
+	//default timeout (in milliseconds) of unthreaded queries for new connections, 0 means none
+	unsigned int QueryTimeout;
 };
 extern struct CMySQLOptions MySQLOptions;
 
@@ -215,7 +489,12 @@ enum E_DATATYPE
 
 enum E_MYSQL_OPTION	
 {
-	DUPLICATE_CONNECTIONS
+	DUPLICATE_CONNECTIONS,
+	CALLBACK_TIME_BUDGET,
+	CALLBACK_COUNT_BUDGET,
+	QUERY_TIMEOUT,
+	LOG_MAX_FILE_SIZE,
+	LOG_FLUSH_ON_ERROR
 };
 
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 
 
 #include "CMySQLQuery.h"
@@ -9,9 +11,14 @@
 #include "CCallback.h"
 #include "COrm.h"
 #include "CLog.h"
+#include "CFormatter.h"
+#include "CObjectPool.h"
 
 #include "misc.h"
 
+#include "mysql_include/errmsg.h"
+#include "mysql_include/mysqld_error.h"
+
 
 CMySQLQuery::CMySQLQuery()  :
 	Threaded(true),
@@ -22,16 +29,60 @@ CMySQLQuery::CMySQLQuery()  :
 	Callback(NULL),
 
 	OrmObject(NULL),
-	OrmQueryType(0)
+	OrmQueryType(0),
+
+	FetchTime(0),
+	StatementID(0),
+	FormatPending(false),
+	StreamChunkSize(0),
+	StreamParent(NULL),
+	StreamPendingChunks(0),
+	MultiStatement(false)
 { 
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLQuery::CMySQLQuery()", "constructor called");
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLQuery::CMySQLQuery()", "constructor called");
 }
 
 CMySQLQuery::~CMySQLQuery() {
-	delete Result;
-	delete Callback;
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLQuery::~CMySQLQuery()", "deconstructor called");
+}
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLQuery::~CMySQLQuery()", "deconstructor called");
+void CMySQLQuery::Reset() 
+{
+	if(Result != NULL)
+		Result->Destroy();
+	if(Callback != NULL)
+		Callback->Destroy();
+
+	if(StreamParent != NULL)
+	{
+		StreamParent->StreamPendingChunks--;
+		if(ConnHandle != NULL) //chunks of a closed handle are detached from it
+			ConnHandle->NotifyStreamChunkProcessed();
+	}
+
+	Query.clear();
+	Threaded = true;
+	ConnHandle = NULL;
+	Connection = NULL;
+	Result = NULL;
+	Callback = NULL;
+	OrmObject = NULL;
+	OrmQueryType = 0;
+	ScheduleTime = boost::posix_time::ptime();
+	ExecuteTime = boost::posix_time::ptime();
+	FetchTime = 0;
+	CallbackQueueTime = boost::posix_time::ptime();
+	StatementID = 0;
+	StatementParams.clear();
+	FormatPending = false;
+	FormatParams.clear();
+	StreamChunkSize = 0;
+	StreamCallback.clear();
+	StreamParent = NULL;
+	StreamPendingChunks = 0;
+	MultiStatement = false;
+	WriteBatchOffsets.clear();
+	WriteBufferTime = boost::posix_time::ptime();
 }
 
 CMySQLQuery *CMySQLQuery::Create(
@@ -42,23 +93,23 @@ CMySQLQuery *CMySQLQuery::Create(
 {
 	if(connhandle == NULL) 
 	{
-		CLog::Get()->LogFunction(LOG_ERROR, "CMySQLQuery::Create", "no connection handle specified");
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLQuery::Create", "no connection handle specified");
 		return static_cast<CMySQLQuery *>(NULL);
 	}
 
 	if(query == NULL && ormobject == NULL) 
 	{
-		CLog::Get()->LogFunction(LOG_ERROR, "CMySQLQuery::Create", "no query and orm object specified");
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLQuery::Create", "no query and orm object specified");
 		return static_cast<CMySQLQuery *>(NULL);
 	}
 	
 
-	CMySQLQuery *Query = new CMySQLQuery;
-	CCallback *Callback = new CCallback;
+	CMySQLQuery *Query = CObjectPool<CMySQLQuery>::Acquire();
+	CCallback *Callback = CCallback::Create();
 
 	if(ormobject != NULL) 
 	{
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLQuery::Create", "starting query generation");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLQuery::Create", "starting query generation");
 		switch(orm_querytype) 
 		{
 		case ORM_QUERYTYPE_SELECT:
@@ -77,7 +128,7 @@ CMySQLQuery *CMySQLQuery::Create(
 			orm_querytype = ormobject->GenerateSaveQuery(Query->Query);
 		}
 
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLQuery::Create", "query successful generated");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLQuery::Create", "query successful generated");
 	}
 	else 
 	{
@@ -90,7 +141,7 @@ CMySQLQuery *CMySQLQuery::Create(
 
 	Query->Threaded = threaded;
 	Query->ConnHandle = connhandle; 
-	Query->Connection = threaded == true ? connhandle->GetQueryConnection() : connhandle->GetMainConnection(); 
+	Query->Connection = threaded == true ? NULL : connhandle->GetMainConnection(); //threaded queries get their connection from the worker thread
 	Query->Callback = Callback;
 	Query->OrmObject = ormobject;
 	Query->OrmQueryType = orm_querytype;
@@ -98,71 +149,95 @@ CMySQLQuery *CMySQLQuery::Create(
 	if(Query->Callback->Name.find("FJ37DH3JG") != string::npos) 
 	{
 		Query->Callback->IsInline = true;
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLQuery::Create", "inline function detected");
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLQuery::Create", "inline function detected");
 	}
 
 	return Query;
 }
 
+CMySQLQuery *CMySQLQuery::Create(AMX *amx, cell query_param, CMySQLHandle *connhandle, const char *cbname, bool threaded /* = true */)
+{
+	CMySQLQuery *Query = Create("", connhandle, cbname, threaded);
+	if(Query != NULL && amx_GetStdString(amx, query_param, Query->Query) == 0)
+	{
+		CLOG_FUNCTION(LOG_ERROR, "CMySQLQuery::Create", "no query specified");
+		Query->Destroy();
+		return static_cast<CMySQLQuery *>(NULL);
+	}
+	return Query;
+}
+
 void CMySQLQuery::Destroy() 
 {
-	delete this;
+	CObjectPool<CMySQLQuery>::Release(this);
 }
 
-void CMySQLQuery::Execute() 
+bool CMySQLQuery::Execute() 
 {
 	char log_funcname[128];
 	sprintf(log_funcname, "CMySQLQuery::Execute[%s]", Callback->Name.c_str());
 	
-	CLog::Get()->LogFunction(LOG_DEBUG, log_funcname, "starting query execution");
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "starting query execution");
 
 	Result = NULL;
 	MYSQL *sql_connection = Connection->GetMySQLPointer();
 
-	if(sql_connection != NULL) 
+	if(sql_connection != NULL && FormatPending == true)
 	{
+		//escaping uses the character set of the executing connection
+		string formatted_query;
+		CFormatter::FormatValues(Query, FormatParams, Connection, formatted_query);
+		Query.swap(formatted_query);
+		FormatParams.clear();
+		FormatPending = false;
+	}
+
+	ExecuteTime = boost::posix_time::microsec_clock::universal_time();
+	FetchTime = 0;
+
+	if(sql_connection != NULL && !WriteBatchOffsets.empty()) 
+	{
+		if(!ExecuteWriteBatch(log_funcname))
+			return false;
+	}
+	else if(sql_connection != NULL && StatementID != 0) 
+	{
+		if(!ExecuteStatement(log_funcname))
+			return false;
+	}
+	else if(sql_connection != NULL) 
+	{
+		//a failed switch shows up as syntax error of the query
+		if(Threaded == true)
+			Connection->SetMultiStatements(MultiStatement);
+
 		if (mysql_real_query(sql_connection, Query.c_str(), Query.length()) == 0) 
 		{
-			CLog::Get()->LogFunction(LOG_DEBUG, log_funcname, "query was successful");
+			CLOG_FUNCTION(LOG_DEBUG, log_funcname, "query was successful");
+
+			//both pass the query to the main thread themselves
+			if(StreamChunkSize > 0)
+			{
+				StreamResult(log_funcname, sql_connection);
+				return true;
+			}
+
+			if(MultiStatement == true)
+			{
+				StoreMultiResults(log_funcname, sql_connection);
+				return true;
+			}
 
 			MYSQL_RES *sql_result = mysql_store_result(sql_connection); //this has to be here
 
 			//why should we process the result if it won't and can't be used?
-			if(Threaded == false || Callback->Name.length() > 0 || (OrmObject != NULL && (OrmQueryType == ORM_QUERYTYPE_SELECT || OrmQueryType == ORM_QUERYTYPE_INSERT))) 
+			if(IsResultNeeded()) 
 			{ 
 				if (sql_result != NULL) 
-				{
-					MYSQL_FIELD *sql_field;
-					MYSQL_ROW sql_row;
-
-					Result = new CMySQLResult;
-
-					Result->m_WarningCount = mysql_warning_count(sql_connection);
-
-					Result->m_Rows = mysql_num_rows(sql_result);
-					Result->m_Fields = mysql_num_fields(sql_result);
-
-					Result->m_Data.reserve((unsigned int)Result->m_Rows+1);
-					Result->m_FieldNames.reserve(Result->m_Fields+1);
-
-
-					while ((sql_field = mysql_fetch_field(sql_result)))
-						Result->m_FieldNames.push_back(sql_field->name);
-					
-				
-					while (sql_row = mysql_fetch_row(sql_result)) 
-					{
-						vector< vector<string> >::iterator It = Result->m_Data.insert(Result->m_Data.end(), vector<string>());
-						It->reserve(Result->m_Fields+1);
-					
-						for (unsigned int a = 0; a < Result->m_Fields; ++a)
-							It->push_back(!sql_row[a] ? "NULL" : sql_row[a]);
-					}
-
-				}
+					Result = StoreResult(sql_connection, sql_result);
 				else if(mysql_field_count(sql_connection) == 0) //query is non-SELECT query
 				{
-					Result = new CMySQLResult;
+					Result = CMySQLResult::Create();
 				
 					Result->m_WarningCount = mysql_warning_count(sql_connection);
 					Result->m_AffectedRows = mysql_affected_rows(sql_connection);
@@ -173,7 +248,7 @@ void CMySQLQuery::Execute()
 					int ErrorID = mysql_errno(sql_connection);
 					string ErrorString(mysql_error(sql_connection));
 
-					CLog::Get()->LogFunction(LOG_ERROR, log_funcname, "an error occured while storing the result: (error #%d) \"%s\"", ErrorID, ErrorString.c_str());
+					CLOG_FUNCTION(LOG_ERROR, log_funcname, "an error occured while storing the result: (error #%d) \"%s\"", ErrorID, ErrorString.c_str());
 					
 					//we clear the callback name and forward it to the callback handler
 					//the callback handler free's all memory but doesn't call the callback because there's no callback name
@@ -181,7 +256,7 @@ void CMySQLQuery::Execute()
 				}
 			}
 			else  //no callback was specified
-				CLog::Get()->LogFunction(LOG_DEBUG, log_funcname, "no callback specified, skipping result saving");
+				CLOG_FUNCTION(LOG_DEBUG, log_funcname, "no callback specified, skipping result saving");
 
 			if(sql_result != NULL)
 				mysql_free_result(sql_result);
@@ -191,12 +266,19 @@ void CMySQLQuery::Execute()
 			int ErrorID = mysql_errno(sql_connection);
 			string ErrorString(mysql_error(sql_connection));
 
-			CLog::Get()->LogFunction(LOG_ERROR, log_funcname, "(error #%d) %s", ErrorID, ErrorString.c_str());
+			CLOG_FUNCTION(LOG_ERROR, log_funcname, "(error #%d) %s", ErrorID, ErrorString.c_str());
 			
 			
-			if(Connection->GetAutoReconnect() && ErrorID == 2006) 
+			if(Threaded == true && Connection->GetAutoReconnect() && ErrorID == CR_SERVER_GONE_ERROR) 
+			{
+				//the query wasn't sent, so it's safe to execute it again after reconnecting
+				CLOG_FUNCTION(LOG_WARNING, log_funcname, "lost connection, query will be executed after reconnecting");
+				Connection->Disconnect();
+				return false;
+			}
+			else if(Connection->GetAutoReconnect() && ErrorID == CR_SERVER_GONE_ERROR) 
 			{
-				CLog::Get()->LogFunction(LOG_WARNING, log_funcname, "lost connection, reconnecting..");
+				CLOG_FUNCTION(LOG_WARNING, log_funcname, "lost connection, reconnecting..");
 
 				MYSQL_RES *sql_result;
 				if ((sql_result = mysql_store_result(sql_connection)) != NULL)
@@ -206,35 +288,665 @@ void CMySQLQuery::Execute()
 				Connection->Connect();
 			}
 
-			if(Threaded == true) 
+			ForwardError(log_funcname, ErrorID, ErrorString);
+		}
+	}
+
+	RecordExecution();
+	if(Threaded == true) 
+	{
+		//the query gets passed to the callback handler in any case
+		//if query successful, it calls the callback and free's memory
+		//if not it only free's the memory
+		CLOG_FUNCTION(LOG_DEBUG, log_funcname, "data being passed to ProcessCallbacks()");
+		CCallback::AddQueryToQueue(this);
+	}
+	return true;
+}
+
+bool CMySQLQuery::IsWriteBehindCandidate() const 
+{
+	return Threaded == true && Callback->Name.empty() && OrmObject == NULL && StatementID == 0 && FormatPending == false
+		&& StreamChunkSize == 0 && MultiStatement == false && WriteBatchOffsets.empty();
+}
+
+bool CMySQLQuery::IsResultNeeded() const 
+{
+	return Threaded == false || Callback->Name.length() > 0 || (OrmObject != NULL && (OrmQueryType == ORM_QUERYTYPE_SELECT || OrmQueryType == ORM_QUERYTYPE_INSERT));
+}
+
+void CMySQLQuery::RecordExecution() 
+{
+	CMetrics &metrics = ConnHandle->GetMetrics();
+	const unsigned int exec_time = static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - ExecuteTime).total_microseconds());
+	metrics.AddCount(COUNTER_QUERIES);
+	metrics.AddTime(TIMER_EXECUTION, exec_time > FetchTime ? exec_time - FetchTime : 0);
+	if(FetchTime > 0)
+		metrics.AddTime(TIMER_RESULT_FETCH, FetchTime);
+
+	boost::uint64_t num_rows = 0, num_bytes = 0;
+	if(Result != NULL)
+	{
+		for(unsigned int r = 0, count = Result->GetResultCount(); r < count; ++r)
+		{
+			CMySQLResult *stmt_result = Result->GetResult(r);
+			num_rows += stmt_result->m_Rows;
+			num_bytes += stmt_result->m_Data.size();
+		}
+		metrics.AddCount(COUNTER_ROWS_FETCHED, num_rows);
+		metrics.AddCount(COUNTER_BYTES_RECEIVED, num_bytes);
+	}
+
+	//buffered writes are unrelated queries, they aren't aggregated
+	if(WriteBatchOffsets.empty())
+		ConnHandle->GetQueryStats().Add(Query, exec_time, num_rows, num_bytes);
+}
+
+void CMySQLQuery::ForwardError(char *log_funcname, int error_id, const string &error_str) 
+{
+	ConnHandle->GetMetrics().AddError(error_id);
+	if(Threaded == false)
+		return ;
+
+	//forward OnQueryError(errorid, error[], callback[], query[], connectionHandle);
+	//recycle these structures, change some data
+	OrmObject = NULL;
+	OrmQueryType = 0;
+
+	Callback->ParamData.clear();
+	Callback->Params.clear();
+
+	Callback->AddParam(static_cast<cell>(error_id));
+	Callback->AddParam(error_str);
+	Callback->AddParam(Callback->Name);
+	Callback->AddParam(Query);
+	Callback->AddParam(static_cast<cell>(ConnHandle->GetID()));
+
+	Callback->Name = "OnQueryError";
+
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "error will be triggered in OnQueryError");
+}
+
+CMySQLResult *CMySQLQuery::StoreResult(MYSQL *sql_connection, MYSQL_RES *sql_result) 
+{
+	const boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+	MYSQL_ROW sql_row;
+
+	CMySQLResult *result = CMySQLResult::Create();
+
+	result->m_WarningCount = mysql_warning_count(sql_connection);
+
+	result->m_Rows = mysql_num_rows(sql_result);
+	result->SetFields(mysql_fetch_fields(sql_result), mysql_num_fields(sql_result));
+	
+
+	//first pass: calculate the size of all data, so everything fits in one allocation
+	const size_t num_values = static_cast<size_t>(result->m_Rows) * result->m_Fields;
+	size_t data_size = 0;
+	while ((sql_row = mysql_fetch_row(sql_result)) != NULL) 
+	{
+		unsigned long *sql_lengths = mysql_fetch_lengths(sql_result);
+		for (unsigned int a = 0; a < result->m_Fields; ++a)
+			data_size += sql_lengths[a] + 1;
+	}
+	mysql_data_seek(sql_result, 0);
+
+	const bool has_numeric_fields = result->HasNumericFields();
+	result->m_Data.resize(data_size);
+	result->m_DataOffsets.resize(num_values + 1);
+	result->m_NullMap.resize(num_values, false);
+	if(has_numeric_fields)
+		result->m_NumericData.resize(num_values);
+
+	//second pass: copy the data
+	size_t offset = 0, value_idx = 0;
+	char *data = result->m_Data.empty() ? NULL : &result->m_Data[0];
+	while ((sql_row = mysql_fetch_row(sql_result)) != NULL) 
+	{
+		unsigned long *sql_lengths = mysql_fetch_lengths(sql_result);
+		for (unsigned int a = 0; a < result->m_Fields; ++a, ++value_idx)
+		{
+			result->m_DataOffsets[value_idx] = offset;
+			if(sql_row[a] == NULL)
+				result->m_NullMap[value_idx] = true;
+			else
+				memcpy(data + offset, sql_row[a], sql_lengths[a]);
+			offset += sql_lengths[a];
+			data[offset++] = '\0';
+
+			if(result->m_NumericFields[a] && sql_row[a] != NULL)
+				result->ConvertNumericValue(value_idx);
+		}
+	}
+	result->m_DataOffsets[value_idx] = offset;
+
+	FetchTime += static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - start_time).total_microseconds());
+	return result;
+}
+
+bool CMySQLQuery::ExecuteWriteBatch(char *log_funcname) 
+{
+	MYSQL *sql_connection = Connection->GetMySQLPointer();
+	const boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+	Connection->SetMultiStatements(true);
+
+	//the server stops at the first failing statement; 
+	//the statements were independent queries, so the batch is resumed after the failed one
+	const size_t num_statements = WriteBatchOffsets.size();
+	size_t next_stmt = 0;
+	int first_error_id = 0;
+	string first_error_str;
+	size_t first_error_stmt = 0;
+	while(next_stmt < num_statements)
+	{
+		const size_t offset = WriteBatchOffsets[next_stmt];
+		size_t num_executed = 0;
+		int status = 1;
+		if(mysql_real_query(sql_connection, Query.c_str() + offset, Query.length() - offset) == 0)
+		{
+			do
 			{
-				//forward OnQueryError(errorid, error[], callback[], query[], connectionHandle);
-				//recycle these structures, change some data
-				OrmObject = NULL;
-				OrmQueryType = 0;
+				++num_executed;
+				MYSQL_RES *sql_result = mysql_store_result(sql_connection);
+				if(sql_result != NULL)
+					mysql_free_result(sql_result);
+			} while((status = mysql_next_result(sql_connection)) == 0);
+		}
+		if(status <= 0) //all statements executed
+			break;
+
+		const size_t failed_stmt = std::min(next_stmt + num_executed, num_statements - 1);
+		int ErrorID = mysql_errno(sql_connection);
+		string ErrorString(mysql_error(sql_connection));
 
-				while(Callback->Parameters.size() > 0)
-					Callback->Parameters.pop();
+		if(Connection->GetAutoReconnect() && ErrorID == CR_SERVER_GONE_ERROR) 
+		{
+			//the failed statement wasn't sent; the executed ones are dropped from the batch, 
+			//the rest is executed after reconnecting
+			CLOG_FUNCTION(LOG_WARNING, log_funcname, "lost connection, %d buffered writes will be executed after reconnecting", static_cast<int>(num_statements - failed_stmt));
+			WriteBatchOffsets.erase(WriteBatchOffsets.begin(), WriteBatchOffsets.begin() + failed_stmt);
+			Connection->Disconnect();
+			return false;
+		}
+
+		CLOG_FUNCTION(LOG_ERROR, log_funcname, "buffered write #%d failed: (error #%d) %s", static_cast<int>(failed_stmt + 1), ErrorID, ErrorString.c_str());
+		if(first_error_id == 0)
+		{
+			first_error_id = ErrorID;
+			first_error_str = ErrorString;
+			first_error_stmt = failed_stmt;
+		}
+		else //the first error is counted by ForwardError
+			ConnHandle->GetMetrics().AddError(ErrorID);
+		next_stmt = failed_stmt + 1;
+	}
 
-				Callback->Parameters.push(static_cast<cell>(ErrorID));
-				Callback->Parameters.push(ErrorString);
-				Callback->Parameters.push(Callback->Name);
-				Callback->Parameters.push(Query);
-				Callback->Parameters.push(static_cast<cell>(ConnHandle->GetID()));
+	const boost::posix_time::ptime end_time = boost::posix_time::microsec_clock::universal_time();
+	ConnHandle->ReportWriteBatch(static_cast<unsigned int>(num_statements), 
+		static_cast<unsigned int>((end_time - start_time).total_microseconds()), 
+		static_cast<unsigned int>((end_time - WriteBufferTime).total_microseconds()));
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "%d buffered writes executed", static_cast<int>(num_statements));
 
-				Callback->Name = "OnQueryError";
+	if(first_error_id != 0)
+	{
+		//OnQueryError gets the first failed statement
+		const size_t stmt_start = WriteBatchOffsets[first_error_stmt];
+		const size_t stmt_end = first_error_stmt + 1 < num_statements ? WriteBatchOffsets[first_error_stmt + 1] - 2 : Query.length(); //"\n;" separator
+		Query = Query.substr(stmt_start, stmt_end - stmt_start);
+		ForwardError(log_funcname, first_error_id, first_error_str);
+	}
+	return true;
+}
 
-				CLog::Get()->LogFunction(LOG_DEBUG, log_funcname, "error will be triggered in OnQueryError");
+void CMySQLQuery::StoreMultiResults(char *log_funcname, MYSQL *sql_connection) 
+{
+	//all results have to be read, even if they aren't needed; the connection can't be used otherwise
+	const bool result_needed = IsResultNeeded();
+	unsigned int num_statements = 0;
+	int status = 0;
+	bool store_failed = false;
+	do
+	{
+		++num_statements;
+		CMySQLResult *stmt_result = NULL;
+		MYSQL_RES *sql_result = mysql_store_result(sql_connection);
+		if(sql_result != NULL)
+		{
+			if(result_needed)
+				stmt_result = StoreResult(sql_connection, sql_result);
+			mysql_free_result(sql_result);
+		}
+		else if(mysql_field_count(sql_connection) == 0) //non-SELECT statement
+		{
+			if(result_needed)
+			{
+				stmt_result = CMySQLResult::Create();
+				stmt_result->m_WarningCount = mysql_warning_count(sql_connection);
+				stmt_result->m_AffectedRows = mysql_affected_rows(sql_connection);
+				stmt_result->m_InsertID = mysql_insert_id(sql_connection); 
 			}
 		}
+		else 
+		{
+			store_failed = true;
+			break;
+		}
+
+		if(stmt_result != NULL)
+		{
+			if(Result == NULL)
+				Result = stmt_result;
+			else
+				Result->m_NextResults.push_back(stmt_result);
+		}
+	} while((status = mysql_next_result(sql_connection)) == 0);
+
+	//the server stops executing at the first failed statement
+	if(store_failed || status > 0)
+	{
+		int ErrorID = mysql_errno(sql_connection);
+		string ErrorString(mysql_error(sql_connection));
+
+		CLOG_FUNCTION(LOG_ERROR, log_funcname, "statement #%d failed: (error #%d) \"%s\"", store_failed ? num_statements : num_statements + 1, ErrorID, ErrorString.c_str());
+
+		if(Result != NULL)
+		{
+			Result->Destroy();
+			Result = NULL;
+		}
+		ForwardError(log_funcname, ErrorID, ErrorString);
 	}
+	else
+		CLOG_FUNCTION(LOG_DEBUG, log_funcname, "%d statement results stored", num_statements);
 
-	if(Threaded == true) 
+	RecordExecution();
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "data being passed to ProcessCallbacks()");
+	CCallback::AddQueryToQueue(this);
+}
+
+void CMySQLQuery::StreamResult(char *log_funcname, MYSQL *sql_connection) 
+{
+	//rows are read from the server one by one and handed over to the main thread in chunks, 
+	//so only a chunk (and not the whole result) has to fit in memory at once
+	static const unsigned int MaxPendingChunks = 2;
+
+	MYSQL_RES *sql_result = mysql_use_result(sql_connection);
+	if(sql_result != NULL) 
 	{
-		//the query gets passed to the callback handler in any case
-		//if query successful, it calls the callback and free's memory
-		//if not it only free's the memory
-		CLog::Get()->LogFunction(LOG_DEBUG, log_funcname, "data being passed to ProcessCallbacks()");
-		CCallback::AddQueryToQueue(this);
+		MYSQL_FIELD *sql_fields = mysql_fetch_fields(sql_result);
+		const unsigned int num_fields = mysql_num_fields(sql_result);
+		unsigned int num_chunks = 0;
+		CMySQLResult *chunk_result = NULL;
+		MYSQL_ROW sql_row;
+		
+		do
+		{
+			sql_row = mysql_fetch_row(sql_result);
+			if(sql_row != NULL)
+			{
+				if(chunk_result == NULL)
+				{
+					chunk_result = CMySQLResult::Create();
+					chunk_result->SetFields(sql_fields, num_fields);
+				}
+				chunk_result->AppendRow(sql_row, mysql_fetch_lengths(sql_result));
+			}
+
+			if(chunk_result != NULL && (sql_row == NULL || chunk_result->m_Rows >= StreamChunkSize))
+			{
+				//don't let the worker run too far ahead of the main thread
+				if(!ConnHandle->WaitForStreamChunks(StreamPendingChunks, MaxPendingChunks))
+				{
+					CLOG_FUNCTION(LOG_WARNING, log_funcname, "connection handle was closed, remaining rows are dropped");
+					chunk_result->Destroy();
+					chunk_result = NULL;
+					break;
+				}
+
+				CMySQLQuery *chunk = CObjectPool<CMySQLQuery>::Acquire();
+				chunk->ConnHandle = ConnHandle;
+				chunk->Connection = Connection;
+				chunk->Result = chunk_result;
+				chunk->Callback = CCallback::Create();
+				chunk->Callback->Name = StreamCallback;
+				chunk->Callback->ParamData = Callback->ParamData;
+				chunk->Callback->Params = Callback->Params;
+				chunk->StreamParent = this;
+				StreamPendingChunks++;
+				
+				ConnHandle->GetMetrics().AddCount(COUNTER_ROWS_FETCHED, chunk_result->m_Rows);
+				ConnHandle->GetMetrics().AddCount(COUNTER_BYTES_RECEIVED, chunk_result->m_Data.size());
+				CLOG_FUNCTION(LOG_DEBUG, log_funcname, "passing chunk #%d (%d rows) to ProcessCallbacks()", ++num_chunks, static_cast<int>(chunk_result->m_Rows));
+				CCallback::AddQueryToQueue(chunk);
+				chunk_result = NULL;
+			}
+		} while(sql_row != NULL);
+
+		if(mysql_errno(sql_connection) != 0)
+		{
+			int ErrorID = mysql_errno(sql_connection);
+			string ErrorString(mysql_error(sql_connection));
+
+			CLOG_FUNCTION(LOG_ERROR, log_funcname, "an error occured while streaming the result: (error #%d) \"%s\"", ErrorID, ErrorString.c_str());
+			ForwardError(log_funcname, ErrorID, ErrorString);
+		}
+		else
+		{
+			//the final callback gets the total row count as affected rows
+			Result = CMySQLResult::Create();
+			Result->m_WarningCount = mysql_warning_count(sql_connection);
+			Result->m_AffectedRows = mysql_num_rows(sql_result);
+		}
+		mysql_free_result(sql_result);
+	}
+	else if(mysql_field_count(sql_connection) == 0) //non-SELECT query, nothing to stream
+	{
+		Result = CMySQLResult::Create();
+		Result->m_WarningCount = mysql_warning_count(sql_connection);
+		Result->m_AffectedRows = mysql_affected_rows(sql_connection);
+		Result->m_InsertID = mysql_insert_id(sql_connection); 
+	}
+	else 
+	{
+		int ErrorID = mysql_errno(sql_connection);
+		string ErrorString(mysql_error(sql_connection));
+
+		CLOG_FUNCTION(LOG_ERROR, log_funcname, "an error occured while streaming the result: (error #%d) \"%s\"", ErrorID, ErrorString.c_str());
+		ForwardError(log_funcname, ErrorID, ErrorString);
 	}
+
+	//the query itself goes last, so its callback is called after all chunks; 
+	//its result only holds the row count, the rows were counted with the chunks
+	CMySQLResult *final_result = Result;
+	Result = NULL;
+	RecordExecution();
+	Result = final_result;
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "data being passed to ProcessCallbacks()");
+	CCallback::AddQueryToQueue(this);
+}
+
+bool CMySQLQuery::ExecuteStatement(char *log_funcname) 
+{
+	MYSQL_STMT *stmt = NULL;
+	unsigned int ErrorID = 0;
+	string ErrorString;
+
+	Connection->ReleaseClosedStatements();
+
+	//executes queued before mysql_stmt_close would prepare the statement again, nothing would release it afterwards
+	if(!ConnHandle->IsValidStatement(StatementID))
+	{
+		CLOG_FUNCTION(LOG_WARNING, log_funcname, "statement with ID = %d was closed before it could be executed", StatementID);
+		ForwardError(log_funcname, CR_NO_PREPARE_STMT, "statement was closed before it could be executed");
+		return true;
+	}
+
+	//a statement can become invalid after a reconnect (including the automatic one done by libmysql),
+	//in that case it gets re-prepared and executed a second time; 
+	//that's only done if the server can't have executed it yet
+	for(int attempt = 0; attempt < 2; ++attempt) 
+	{
+		stmt = Connection->GetStatement(StatementID, Query);
+		if(stmt == NULL)
+		{
+			ErrorID = mysql_errno(Connection->GetMySQLPointer());
+			ErrorString = mysql_error(Connection->GetMySQLPointer());
+			if(Threaded == true && Connection->GetAutoReconnect() && ErrorID == CR_SERVER_GONE_ERROR) 
+			{
+				CLOG_FUNCTION(LOG_WARNING, log_funcname, "lost connection, statement will be executed after reconnecting");
+				Connection->Disconnect();
+				return false;
+			}
+			break;
+		}
+
+		if(mysql_stmt_param_count(stmt) != StatementParams.size())
+		{
+			ErrorID = CR_PARAMS_NOT_BOUND;
+			ErrorString = "statement parameter count does not match format specifier length";
+			stmt = NULL;
+			break;
+		}
+
+		vector<MYSQL_BIND> param_binds(StatementParams.size());
+		if(!param_binds.empty())
+		{
+			memset(&param_binds[0], 0, sizeof(MYSQL_BIND) * param_binds.size());
+			for(size_t p = 0; p < StatementParams.size(); ++p) 
+			{
+				MYSQL_BIND &bind = param_binds[p];
+				boost::variant<int, float, string> &param = StatementParams[p];
+				if(int *int_val = boost::get<int>(&param)) 
+				{
+					bind.buffer_type = MYSQL_TYPE_LONG;
+					bind.buffer = int_val;
+				}
+				else if(float *float_val = boost::get<float>(&param)) 
+				{
+					bind.buffer_type = MYSQL_TYPE_FLOAT;
+					bind.buffer = float_val;
+				}
+				else 
+				{
+					string &str_val = boost::get<string>(param);
+					bind.buffer_type = MYSQL_TYPE_STRING;
+					bind.buffer = const_cast<char *>(str_val.c_str());
+					bind.buffer_length = str_val.length();
+				}
+			}
+			if(mysql_stmt_bind_param(stmt, &param_binds[0]) != 0)
+			{
+				ErrorID = mysql_stmt_errno(stmt);
+				ErrorString = mysql_stmt_error(stmt);
+				stmt = NULL;
+				break;
+			}
+		}
+
+		if(mysql_stmt_execute(stmt) == 0)
+		{
+			ErrorID = 0;
+			break;
+		}
+
+		ErrorID = mysql_stmt_errno(stmt);
+		ErrorString = mysql_stmt_error(stmt);
+		//libmysql detaches all statements when it reconnects on its own, 
+		//executing them fails with CR_SERVER_LOST without sending anything
+		const bool detached = (stmt->mysql == NULL);
+		stmt = NULL;
+		
+		//with CR_SERVER_LOST the statement was sent, the server may have executed it already
+		if(ErrorID == CR_SERVER_LOST && !detached)
+		{
+			Connection->DropStatement(StatementID);
+			break;
+		}
+		if(ErrorID != ER_UNKNOWN_STMT_HANDLER && ErrorID != ER_NEED_REPREPARE && ErrorID != CR_SERVER_GONE_ERROR && ErrorID != CR_SERVER_LOST)
+			break;
+
+		Connection->DropStatement(StatementID);
+		if(Connection->GetAutoReconnect() && ErrorID == CR_SERVER_GONE_ERROR) 
+		{
+			CLOG_FUNCTION(LOG_WARNING, log_funcname, "lost connection (error #%d), statement will be executed after reconnecting", ErrorID);
+			Connection->Disconnect();
+			if(Threaded == true)
+				return false;
+			Connection->Connect();
+		}
+		else
+			CLOG_FUNCTION(LOG_WARNING, log_funcname, "prepared statement is invalid (error #%d), preparing it again..", ErrorID);
+	}
+
+	if(stmt == NULL)
+	{
+		CLOG_FUNCTION(LOG_ERROR, log_funcname, "(error #%d) %s", ErrorID, ErrorString.c_str());
+		ForwardError(log_funcname, ErrorID, ErrorString);
+		return true;
+	}
+
+	CLOG_FUNCTION(LOG_DEBUG, log_funcname, "statement was successful");
+
+	MYSQL_RES *sql_meta = mysql_stmt_result_metadata(stmt);
+	if(IsResultNeeded()) 
+	{
+		if(sql_meta != NULL)
+		{
+			if(!StoreStatementResult(stmt, sql_meta))
+			{
+				CLOG_FUNCTION(LOG_ERROR, log_funcname, "an error occured while storing the result: (error #%d) \"%s\"", mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+				Callback->Name.clear(); 
+			}
+		}
+		else 
+		{
+			Result = CMySQLResult::Create();
+				
+			Result->m_WarningCount = mysql_warning_count(Connection->GetMySQLPointer());
+			Result->m_AffectedRows = mysql_stmt_affected_rows(stmt);
+			Result->m_InsertID = mysql_stmt_insert_id(stmt); 
+		}
+	}
+	else 
+		CLOG_FUNCTION(LOG_DEBUG, log_funcname, "no callback specified, skipping result saving");
+
+	if(sql_meta != NULL)
+		mysql_free_result(sql_meta);
+	mysql_stmt_free_result(stmt);
+	return true;
+}
+
+bool CMySQLQuery::StoreStatementResult(MYSQL_STMT *stmt, MYSQL_RES *sql_meta) 
+{
+	//let the client library calculate the longest value of every column, 
+	//so every row can be fetched into fixed buffers
+	my_bool update_max_length = 1;
+	mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+	if(mysql_stmt_store_result(stmt) != 0)
+		return false;
+	const boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+
+	Result = CMySQLResult::Create();
+
+	Result->m_WarningCount = mysql_warning_count(Connection->GetMySQLPointer());
+	Result->m_Rows = mysql_stmt_num_rows(stmt);
+	Result->m_AffectedRows = mysql_stmt_affected_rows(stmt);
+
+	MYSQL_FIELD *sql_fields = mysql_fetch_fields(sql_meta);
+	const unsigned int num_fields = mysql_num_fields(sql_meta);
+	Result->SetFields(sql_fields, num_fields);
+
+	//every value is fetched as string, libmysql converts the binary values for us
+	vector<MYSQL_BIND> result_binds(num_fields);
+	vector<unsigned long> lengths(num_fields);
+	vector<my_bool> nulls(num_fields);
+	vector<size_t> 
+		buffer_offsets(num_fields),
+		buffer_lengths(num_fields);
+	size_t row_size = 0;
+	for(unsigned int f = 0; f < num_fields; ++f)
+	{
+		//the declared column length can be gigabytes (LONGTEXT), only max_length is usable;
+		//numeric and temporal columns get converted to text by the client library, so leave some space for their text form
+		size_t len = sql_fields[f].max_length;
+		if(!IS_LONGDATA(sql_fields[f].type))
+			len = std::max<size_t>(len, 64);
+		buffer_offsets[f] = row_size;
+		buffer_lengths[f] = len + 1;
+		row_size += len + 1;
+	}
+	
+	const size_t num_values = static_cast<size_t>(Result->m_Rows) * num_fields;
+	Result->m_Data.resize(static_cast<size_t>(Result->m_Rows) * row_size); //upper bound, shrunk afterwards
+	Result->m_DataOffsets.resize(num_values + 1);
+	Result->m_NullMap.resize(num_values, false);
+	if(Result->HasNumericFields())
+		Result->m_NumericData.resize(num_values);
+
+	if(num_values == 0)
+	{
+		Result->m_DataOffsets[0] = 0;
+		return true;
+	}
+
+	size_t offset = 0, value_idx = 0;
+	char *data = &Result->m_Data[0];
+	vector<char> row_copy;
+	for(my_ulonglong r = 0; r < Result->m_Rows; ++r)
+	{
+		//bind the next row directly into the result buffer, values get packed afterwards
+		memset(&result_binds[0], 0, sizeof(MYSQL_BIND) * num_fields);
+		for(unsigned int f = 0; f < num_fields; ++f)
+		{
+			result_binds[f].buffer_type = MYSQL_TYPE_STRING;
+			result_binds[f].buffer = data + offset + buffer_offsets[f];
+			result_binds[f].buffer_length = buffer_lengths[f];
+			result_binds[f].length = &lengths[f];
+			result_binds[f].is_null = &nulls[f];
+		}
+		mysql_stmt_bind_result(stmt, &result_binds[0]);
+
+		int fetch_ret = mysql_stmt_fetch(stmt);
+		if(fetch_ret == 1 || fetch_ret == MYSQL_NO_DATA)
+		{
+			Result->m_Rows = r;
+			break;
+		}
+
+		//a value longer than its buffer (max_length was too small) is fetched again in full; 
+		//the row is copied first then, so the longer value can't overwrite the values after it
+		char *row_start = data + offset;
+		bool truncated = false;
+		for(unsigned int f = 0; f < num_fields; ++f)
+		{
+			if(!nulls[f] && lengths[f] >= buffer_lengths[f])
+				truncated = true;
+		}
+		if(truncated)
+		{
+			row_copy.assign(row_start, row_start + row_size);
+			row_start = &row_copy[0];
+		}
+
+		for(unsigned int f = 0; f < num_fields; ++f, ++value_idx)
+		{
+			Result->m_DataOffsets[value_idx] = offset;
+			if(nulls[f])
+			{
+				Result->m_NullMap[value_idx] = true;
+				lengths[f] = 0;
+			}
+			else if(lengths[f] >= buffer_lengths[f])
+			{
+				//the remaining rows still have to fit behind the value
+				const size_t needed = offset + lengths[f] + 1 + static_cast<size_t>(Result->m_Rows - r) * row_size;
+				if(Result->m_Data.size() < needed)
+				{
+					Result->m_Data.resize(needed);
+					data = &Result->m_Data[0];
+				}
+
+				MYSQL_BIND column_bind;
+				memset(&column_bind, 0, sizeof(MYSQL_BIND));
+				column_bind.buffer_type = MYSQL_TYPE_STRING;
+				column_bind.buffer = data + offset;
+				column_bind.buffer_length = lengths[f] + 1;
+				column_bind.length = &lengths[f];
+				if(mysql_stmt_fetch_column(stmt, &column_bind, f, 0) != 0)
+					return false;
+			}
+			else if(data + offset != row_start + buffer_offsets[f])
+				memmove(data + offset, row_start + buffer_offsets[f], lengths[f]);
+			offset += lengths[f];
+			data[offset++] = '\0';
+
+			if(Result->m_NumericFields[f] && !nulls[f])
+				Result->ConvertNumericValue(value_idx);
+		}
+	}
+	Result->m_DataOffsets[value_idx] = offset;
+	Result->m_Data.resize(offset);
+
+	FetchTime += static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - start_time).total_microseconds());
+	return true;
 }
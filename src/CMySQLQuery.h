@@ -4,7 +4,19 @@
 
 
 #include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/variant.hpp>
+#include <boost/atomic.hpp>
 using std::string;
+using std::vector;
+
+#ifdef WIN32
+	#include <WinSock2.h>
+#endif
+#include "mysql_include/mysql.h"
+
+#include "main.h"
 
 
 class CMySQLHandle;
@@ -14,13 +26,22 @@ class CCallback;
 class COrm;
 
 
+template<typename T> class CObjectPool;
+
+
 class CMySQLQuery 
 {
 public:
+	friend class CObjectPool<CMySQLQuery>;
+
 	static CMySQLQuery *Create(const char *query, CMySQLHandle *connhandle, const char *cbname, bool threaded = true, COrm *ormobject = NULL, unsigned short orm_querytype = 0);
+	//converts the query string parameter straight into the query object
+	static CMySQLQuery *Create(AMX *amx, cell query_param, CMySQLHandle *connhandle, const char *cbname, bool threaded = true);
 	void Destroy();
 
-	void Execute();
+	//returns false if the connection was lost before the query could be executed (threaded queries with auto-reconnect only);
+	//the worker thread reconnects and executes it again then
+	bool Execute();
 
 
 	string Query;
@@ -34,9 +55,55 @@ public:
 	COrm *OrmObject;
 	unsigned short OrmQueryType;
 
+	boost::posix_time::ptime ScheduleTime;
+	//metrics; time the execution started, time spent copying results (in microseconds) 
+	//and time the result was passed to the main thread
+	boost::posix_time::ptime ExecuteTime;
+	unsigned int FetchTime;
+	boost::posix_time::ptime CallbackQueueTime;
+
+	//prepared statement data; StatementID is 0 for plain text queries, Query holds the statement then
+	int StatementID;
+	vector<boost::variant<int, float, string> > StatementParams;
+
+	//parameterized text queries; Query holds the format string and FormatParams its values 
+	//until the executing thread builds the query
+	bool FormatPending;
+	vector<boost::variant<int, float, string> > FormatParams;
+
+	//streamed queries deliver their rows in chunks of StreamChunkSize rows to StreamCallback, 
+	//then the normal callback is called; StreamChunkSize is 0 for normal queries
+	unsigned int StreamChunkSize;
+	string StreamCallback;
+	//chunks point to their query, which counts the chunks not yet processed by the main thread
+	CMySQLQuery *StreamParent;
+	boost::atomic<unsigned int> StreamPendingChunks;
+
+	//query contains multiple statements, each one gets its own result
+	bool MultiStatement;
+
+	//buffered writes of the write-behind mode; start offset of every statement in Query
+	vector<size_t> WriteBatchOffsets;
+	boost::posix_time::ptime WriteBufferTime;
+	//fire-and-forget text queries which can be buffered
+	bool IsWriteBehindCandidate() const;
+
 private:
 	CMySQLQuery();
 	~CMySQLQuery();
+	void Reset();
+
+	bool IsResultNeeded() const;
+	void ForwardError(char *log_funcname, int error_id, const string &error_str);
+	//adds execution time, fetched rows and bytes to the handle's metrics
+	void RecordExecution();
+	CMySQLResult *StoreResult(MYSQL *sql_connection, MYSQL_RES *sql_result);
+	void StoreMultiResults(char *log_funcname, MYSQL *sql_connection);
+	void StreamResult(char *log_funcname, MYSQL *sql_connection);
+
+	bool ExecuteStatement(char *log_funcname);
+	bool ExecuteWriteBatch(char *log_funcname);
+	bool StoreStatementResult(MYSQL_STMT *stmt, MYSQL_RES *sql_meta);
 };
 
 
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <cstring>
+
 #include "CLog.h"
 #include "CMySQLResult.h"
 
+#include "misc.h"
+
 
 void CMySQLResult::GetFieldName(unsigned int idx, char **dest) 
 {
@@ -10,72 +14,248 @@ void CMySQLResult::GetFieldName(unsigned int idx, char **dest)
 	{
 		(*dest) = const_cast<char*>(m_FieldNames.at(idx).c_str());
 
-		CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLResult::GetFieldName", "index: '%d', name: \"%s\"", idx, *dest);
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::GetFieldName", "index: '%d', name: \"%s\"", idx, *dest);
 	}
 	else 
-		CLog::Get()->LogFunction(LOG_WARNING, "CMySQLResult::GetFieldName", "invalid field index ('%d')", idx);
+		CLOG_FUNCTION(LOG_WARNING, "CMySQLResult::GetFieldName", "invalid field index ('%d')", idx);
 }
 
 void CMySQLResult::GetRowData(unsigned int row, unsigned int fieldidx, char **dest) 
 {
 	if(row < m_Rows && fieldidx < m_Fields) 
 	{
-		(*dest) = const_cast<char*>(m_Data.at(row).at(fieldidx).c_str());
+		(*dest) = IsNull(row, fieldidx) ? NULL : const_cast<char*>(&m_Data[m_DataOffsets[row * m_Fields + fieldidx]]);
 
 		if(CLog::Get()->IsLogLevel(LOG_DEBUG)) 
 		{
-			string ShortenDest(*dest);
+			string ShortenDest(*dest != NULL ? *dest : "NULL");
 			if(ShortenDest.length() > 1024)
 				ShortenDest.resize(1024);
-			CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLResult::GetRowData", "row: '%d', field: '%d', data: \"%s\"", row, fieldidx, ShortenDest.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::GetRowData", "row: '%d', field: '%d', data: \"%s\"", row, fieldidx, ShortenDest.c_str());
 		}
 	}
 	else 
-		CLog::Get()->LogFunction(LOG_WARNING, "CMySQLResult::GetRowData", "invalid row ('%d') or field index ('%d')", row, fieldidx);
+		CLOG_FUNCTION(LOG_WARNING, "CMySQLResult::GetRowData", "invalid row ('%d') or field index ('%d')", row, fieldidx);
 }
 
-void CMySQLResult::GetRowDataByName(unsigned int row, const char *field, char **dest) 
+bool CMySQLResult::GetRowDataByName(unsigned int row, const char *field, char **dest) 
 {
 	if(row >= m_Rows || m_Fields == 0)
-		return (void)CLog::Get()->LogFunction(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "invalid row index ('%d')", row);
+		return CLOG_FUNCTION(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "invalid row index ('%d')", row);
 	
 	if(field == NULL)
-		return (void)CLog::Get()->LogFunction(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "empty field name specified");
+		return CLOG_FUNCTION(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "empty field name specified");
 
 	if(dest == NULL)
-		return (void)CLog::Get()->LogFunction(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "invalid destination specified");
+		return CLOG_FUNCTION(LOG_ERROR, "CMySQLResult::GetRowDataByName()", "invalid destination specified");
+
+	int field_idx = GetFieldIndex(field);
+	if(field_idx < 0)
+		return CLOG_FUNCTION(LOG_WARNING, "CMySQLResult::GetRowDataByName", "field not found (\"%s\")", field);
+
+	(*dest) = IsNull(row, field_idx) ? NULL : const_cast<char*>(&m_Data[m_DataOffsets[row * m_Fields + field_idx]]);
 
-	for(unsigned int i = 0; i < m_Fields; ++i) 
+	if(CLog::Get()->IsLogLevel(LOG_DEBUG)) 
 	{
-		if(::strcmp(m_FieldNames.at(i).c_str(), field) == 0) 
+		string ShortenDest(*dest != NULL ? *dest : "NULL");
+		if(ShortenDest.length() > 1024)
+			ShortenDest.resize(1024);
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::GetRowDataByName", "row: '%d', field: \"%s\", data: \"%s\"", row, field, ShortenDest.c_str());
+	}
+	return true;
+}
+
+
+bool CMySQLResult::GetRowDataInt(unsigned int row, unsigned int fieldidx, int &dest) 
+{
+	if(row < m_Rows && fieldidx < m_Fields && IsNull(row, fieldidx))
+		return false; //NULL isn't a valid number, as it was before the values were pre-converted
+	if(row < m_Rows && fieldidx < m_Fields && m_NumericFields[fieldidx]) 
+	{
+		const SNumericValue &value = m_NumericData[row * m_Fields + fieldidx];
+		if(!(value.Flags & NUMERIC_INT_VALID))
+			return false;
+		
+		dest = value.Int;
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::GetRowDataInt", "row: '%d', field: '%d', data: '%d'", row, fieldidx, dest);
+		return true;
+	}
+
+	//not a numeric column (or invalid index), convert the text
+	char *data = NULL;
+	GetRowData(row, fieldidx, &data);
+	return data == NULL || ConvertStrToInt(data, GetFieldLength(row, fieldidx), dest);
+}
+
+bool CMySQLResult::GetRowDataFloat(unsigned int row, unsigned int fieldidx, float &dest) 
+{
+	if(row < m_Rows && fieldidx < m_Fields && IsNull(row, fieldidx))
+		return false; //NULL isn't a valid number, as it was before the values were pre-converted
+	if(row < m_Rows && fieldidx < m_Fields && m_NumericFields[fieldidx]) 
+	{
+		const SNumericValue &value = m_NumericData[row * m_Fields + fieldidx];
+		if(!(value.Flags & NUMERIC_FLOAT_VALID))
+			return false;
+		
+		dest = value.Float;
+		CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::GetRowDataFloat", "row: '%d', field: '%d', data: '%f'", row, fieldidx, dest);
+		return true;
+	}
+
+	char *data = NULL;
+	GetRowData(row, fieldidx, &data);
+	return data == NULL || ConvertStrToFloat(data, GetFieldLength(row, fieldidx), dest);
+}
+
+
+//lets us look up C strings in m_FieldIndex without constructing a std::string;
+//boost::hash<string> hashes the character range, so both hashes are the same
+struct CStrHash
+{
+	size_t operator()(const char *str) const
+	{
+		return boost::hash_range(str, str + strlen(str));
+	}
+};
+struct CStrEqual
+{
+	bool operator()(const char *lhs, const string &rhs) const
+	{
+		return rhs.compare(lhs) == 0;
+	}
+};
+
+int CMySQLResult::GetFieldIndex(const char *field) const
+{
+	if(field == NULL)
+		return -1;
+
+	unordered_map<string, unsigned int>::const_iterator it = m_FieldIndex.find(field, CStrHash(), CStrEqual());
+	return it != m_FieldIndex.end() ? static_cast<int>(it->second) : -1;
+}
+
+void CMySQLResult::SetFields(MYSQL_FIELD *fields, unsigned int num_fields) 
+{
+	m_Fields = num_fields;
+	m_FieldNames.reserve(num_fields);
+	m_NumericFields.assign(num_fields, false);
+
+	for(unsigned int i = 0; i < num_fields; ++i) 
+	{
+		switch(fields[i].type)
 		{
-			(*dest) = const_cast<char*>(m_Data.at(row).at(i).c_str());
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+			case MYSQL_TYPE_FLOAT:
+			case MYSQL_TYPE_DOUBLE:
+			case MYSQL_TYPE_DECIMAL:
+			case MYSQL_TYPE_NEWDECIMAL:
+				m_NumericFields[i] = true;
+				m_HasNumericFields = true;
+				break;
+			default:
+				break;
+		}
+
+		//insert doesn't overwrite, so duplicate names resolve to the first field like before
+		m_FieldIndex.insert( unordered_map<string, unsigned int>::value_type(fields[i].name, i) );
+		m_FieldNames.push_back(fields[i].name);
+	}
+}
+
+void CMySQLResult::ConvertNumericValue(size_t value_idx) 
+{
+	//use the same conversion rules as the string accessors
+	SNumericValue &value = m_NumericData[value_idx];
+	const char *str = &m_Data[m_DataOffsets[value_idx]];
+	const size_t len = m_DataOffsets[value_idx + 1] - m_DataOffsets[value_idx] - 1;
+	value.Flags = 0;
+	if(ConvertStrToInt(str, len, value.Int))
+		value.Flags |= NUMERIC_INT_VALID;
+	if(ConvertStrToFloat(str, len, value.Float))
+		value.Flags |= NUMERIC_FLOAT_VALID;
+}
 
-			if(CLog::Get()->IsLogLevel(LOG_DEBUG)) 
-			{
-				string ShortenDest(*dest);
-				if(ShortenDest.length() > 1024)
-					ShortenDest.resize(1024);
-				CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLResult::GetRowDataByName", "row: '%d', field: \"%s\", data: \"%s\"", row, field, ShortenDest.c_str());
-			}
+void CMySQLResult::AppendRow(MYSQL_ROW row, unsigned long *lengths) 
+{
+	//the last offset always marks the end of the data, which is where the next value starts
+	if(m_DataOffsets.empty())
+		m_DataOffsets.push_back(0);
+
+	for(unsigned int f = 0; f < m_Fields; ++f) 
+	{
+		const size_t value_idx = m_DataOffsets.size() - 1;
+		m_NullMap.push_back(row[f] == NULL);
+		if(row[f] != NULL)
+			m_Data.insert(m_Data.end(), row[f], row[f] + lengths[f]);
+		m_Data.push_back('\0');
+		m_DataOffsets.push_back(m_Data.size());
 
-			return ;
+		if(m_HasNumericFields)
+		{
+			m_NumericData.push_back(SNumericValue());
+			if(m_NumericFields[f] && row[f] != NULL)
+				ConvertNumericValue(value_idx);
 		}
 	}
-	CLog::Get()->LogFunction(LOG_WARNING, "CMySQLResult::GetRowDataByName", "field not found (\"%s\")", field);
+	m_Rows++;
 }
 
+
 CMySQLResult::CMySQLResult() :
 	m_Fields(0),
 	m_Rows(0),
+	m_HasNumericFields(false),
 	m_InsertID(0),
 	m_AffectedRows(0),
 	m_WarningCount(0)
 {
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLResult::CMySQLResult()", "constructor called");
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::CMySQLResult()", "constructor called");
 }
 
 CMySQLResult::~CMySQLResult() 
 {
-	CLog::Get()->LogFunction(LOG_DEBUG, "CMySQLResult::~CMySQLResult()", "deconstructor called");
+	CLOG_FUNCTION(LOG_DEBUG, "CMySQLResult::~CMySQLResult()", "deconstructor called");
+}
+
+//pooled results keep their buffers for the next result, unless they got too big
+static const size_t MaxKeptDataSize = 64 * 1024;
+
+template<typename T>
+static inline void ClearBuffer(vector<T> &buffer)
+{
+	if(buffer.capacity() * sizeof(T) > MaxKeptDataSize)
+		vector<T>().swap(buffer);
+	else
+		buffer.clear();
+}
+
+void CMySQLResult::Reset() 
+{
+	ClearBuffer(m_Data);
+	ClearBuffer(m_DataOffsets);
+	ClearBuffer(m_NullMap);
+	ClearBuffer(m_NumericData);
+	for(size_t i = 0; i < m_NextResults.size(); ++i)
+		m_NextResults[i]->Destroy();
+	ClearBuffer(m_NextResults);
+
+	ClearBuffer(m_FieldNames);
+	ClearBuffer(m_NumericFields);
+	//clear() keeps the bucket array
+	if(m_FieldIndex.bucket_count() * sizeof(void *) > MaxKeptDataSize)
+		unordered_map<string, unsigned int>().swap(m_FieldIndex);
+	else
+		m_FieldIndex.clear();
+	m_HasNumericFields = false;
+
+	m_Fields = 0;
+	m_Rows = 0;
+	m_InsertID = 0;
+	m_AffectedRows = 0;
+	m_WarningCount = 0;
 }
\ No newline at end of file
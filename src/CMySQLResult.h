@@ -5,24 +5,28 @@
 
 #include <vector>
 #include <string>
+#include <boost/unordered_map.hpp>
 
 using std::vector;
 using std::string;
+using boost::unordered_map;
 
 #ifdef WIN32
 	#include <WinSock2.h>
 #endif
 #include "mysql_include/mysql.h"
+#include "CObjectPool.h"
 
 
 class CMySQLResult 
 {
 public:
 	friend class CMySQLQuery;
+	friend class CObjectPool<CMySQLResult>;
 
 	inline void Destroy()
 	{
-		delete this;
+		CObjectPool<CMySQLResult>::Release(this);
 	}
 
 	inline my_ulonglong GetRowCount() const 
@@ -36,8 +40,26 @@ public:
 	}
 
 	void GetFieldName(unsigned int idx, char **dest);
+	//returns -1 if the field doesn't exist
+	int GetFieldIndex(const char *field) const;
+	//dest is set to NULL if the field value is NULL
 	void GetRowData(unsigned int row, unsigned int fieldidx, char **dest);
-	void GetRowDataByName(unsigned int row, const char *field, char **dest);
+	//returns false if the field doesn't exist
+	bool GetRowDataByName(unsigned int row, const char *field, char **dest);
+	//both return false if the value is NULL or can't be converted; dest is only written on success
+	bool GetRowDataInt(unsigned int row, unsigned int fieldidx, int &dest);
+	bool GetRowDataFloat(unsigned int row, unsigned int fieldidx, float &dest);
+
+	inline bool IsNull(unsigned int row, unsigned int fieldidx) const 
+	{
+		return m_NullMap[row * m_Fields + fieldidx];
+	}
+	//length of the field value without null terminator
+	inline size_t GetFieldLength(unsigned int row, unsigned int fieldidx) const 
+	{
+		const size_t idx = row * m_Fields + fieldidx;
+		return m_DataOffsets[idx+1] - m_DataOffsets[idx] - 1;
+	}
 
 
 	inline my_ulonglong InsertID() const 
@@ -55,21 +77,75 @@ public:
 		return m_WarningCount;
 	}
 
+	//multi-statement queries have one result per statement, the first one holds the others
+	inline unsigned int GetResultCount() const 
+	{
+		return static_cast<unsigned int>(m_NextResults.size()) + 1;
+	}
+	inline CMySQLResult *GetResult(unsigned int idx) 
+	{
+		return idx == 0 ? this : m_NextResults[idx - 1];
+	}
+
 private:
 	CMySQLResult();
 	~CMySQLResult();
 
+	static inline CMySQLResult *Create()
+	{
+		return CObjectPool<CMySQLResult>::Acquire();
+	}
+	void Reset();
+
+	//used by CMySQLQuery while the worker thread fills the result
+	void SetFields(MYSQL_FIELD *fields, unsigned int num_fields);
+	void ConvertNumericValue(size_t value_idx);
+	inline bool HasNumericFields() const 
+	{
+		return m_HasNumericFields;
+	}
+	//appends one row when the row count isn't known in advance (streamed results)
+	void AppendRow(MYSQL_ROW row, unsigned long *lengths);
+
 	unsigned int m_Fields;
 	my_ulonglong m_Rows;
 
-	vector< vector<string> > m_Data;
+	//all field values of all rows, each one null-terminated, stored row after row
+	vector<char> m_Data;
+	//start offset of every field value in m_Data (index = row * m_Fields + field), 
+	//plus one last entry marking the end of the buffer
+	vector<size_t> m_DataOffsets;
+	//set for every field value which is NULL (same indexing as m_DataOffsets)
+	vector<bool> m_NullMap;
 	vector<string> m_FieldNames;
+	//field name -> field index, built together with m_FieldNames
+	unordered_map<string, unsigned int> m_FieldIndex;
+
+	//values of numeric columns, converted once by the worker thread
+	//(same indexing as m_DataOffsets, empty if the result has no numeric columns)
+	struct SNumericValue
+	{
+		int Int;
+		float Float;
+		unsigned char Flags;
+	};
+	enum E_NUMERIC_FLAGS
+	{
+		NUMERIC_INT_VALID = 1,
+		NUMERIC_FLOAT_VALID = 2
+	};
+	vector<SNumericValue> m_NumericData;
+	vector<bool> m_NumericFields;
+	bool m_HasNumericFields;
 
 	my_ulonglong 
 		m_InsertID, 
 		m_AffectedRows;
 
 	unsigned int m_WarningCount;
+
+	//results of the following statements of a multi-statement query
+	vector<CMySQLResult *> m_NextResults;
 };
 
 
@@ -0,0 +1,76 @@
+#pragma once
+#ifndef INC_COBJECTPOOL_H
+#define INC_COBJECTPOOL_H
+
+
+#include <boost/lockfree/stack.hpp>
+#include <boost/atomic.hpp>
+
+
+//keeps released objects for reuse instead of deleting them
+//objects are created and released on different threads, so a lockfree stack holds the free ones
+//T has to provide a Reset() function which brings the object back into its initial state
+template<typename T>
+class CObjectPool
+{
+public:
+	static const unsigned int MaxFreeObjects = 1024;
+
+	static T *Acquire()
+	{
+		T *object = NULL;
+		m_AcquireCount++;
+		if(!m_FreeObjects.pop(object))
+		{
+			m_AllocCount++;
+			object = new T;
+		}
+		return object;
+	}
+	static void Release(T *object)
+	{
+		object->Reset();
+		if(!m_FreeObjects.bounded_push(object))
+			delete object;
+	}
+	//deletes all free objects
+	static void Clear()
+	{
+		T *object = NULL;
+		while(m_FreeObjects.pop(object))
+			delete object;
+	}
+
+	//number of objects handed out so far
+	static inline unsigned int GetAcquireCount()
+	{
+		return m_AcquireCount;
+	}
+	//number of objects which had to be allocated
+	static inline unsigned int GetAllocCount()
+	{
+		return m_AllocCount;
+	}
+
+private:
+	static boost::lockfree::stack<
+			T *,
+			boost::lockfree::capacity<MaxFreeObjects>
+		> m_FreeObjects;
+
+	static boost::atomic<unsigned int>
+		m_AcquireCount,
+		m_AllocCount;
+};
+
+template<typename T>
+boost::lockfree::stack<T *, boost::lockfree::capacity<CObjectPool<T>::MaxFreeObjects> > CObjectPool<T>::m_FreeObjects;
+
+template<typename T>
+boost::atomic<unsigned int> CObjectPool<T>::m_AcquireCount(0);
+
+template<typename T>
+boost::atomic<unsigned int> CObjectPool<T>::m_AllocCount(0);
+
+
+#endif // INC_COBJECTPOOL_H
@@ -24,13 +24,13 @@ unordered_map<int, COrm *> COrm::OrmHandle;
 
 int COrm::Create(char *table, CMySQLHandle *connhandle) 
 {
-	CLog::Get()->LogFunction(LOG_DEBUG, "COrm::Create", "creating new orm object..");
+	CLOG_FUNCTION(LOG_DEBUG, "COrm::Create", "creating new orm object..");
 
 	if(table == NULL)
-		return CLog::Get()->LogFunction(LOG_ERROR, "COrm::Create", "empty table name specified");
+		return CLOG_FUNCTION(LOG_ERROR, "COrm::Create", "empty table name specified");
 
 	if(connhandle == NULL)
-		return CLog::Get()->LogFunction(LOG_ERROR, "COrm::Create", "invalid connection handle");
+		return CLOG_FUNCTION(LOG_ERROR, "COrm::Create", "invalid connection handle");
 
 	int id = 1;
 	if(OrmHandle.size() > 0) 
@@ -50,13 +50,13 @@ int COrm::Create(char *table, CMySQLHandle *connhandle)
 	OrmObject->m_MyID = id;
 
 	OrmHandle.insert( unordered_map<int, COrm*>::value_type(id, OrmObject) );
-	CLog::Get()->LogFunction(LOG_DEBUG, "COrm::Create", "orm object created with id = %d", id);
+	CLOG_FUNCTION(LOG_DEBUG, "COrm::Create", "orm object created with id = %d", id);
 	return id;
 }
 
 void COrm::Destroy() 
 {
-	CLog::Get()->LogFunction(LOG_DEBUG, "COrm::Destroy", "id: %d", m_MyID);
+	CLOG_FUNCTION(LOG_DEBUG, "COrm::Destroy", "id: %d", m_MyID);
 	OrmHandle.erase(m_MyID);
 	delete this;
 }
@@ -68,43 +68,47 @@ void COrm::ApplyActiveResult(unsigned int row)
 	
 	m_ErrorID = ORM_ERROR_NO_DATA;
 	if(result == NULL)
-		return (void)CLog::Get()->LogFunction(LOG_ERROR, "COrm::ApplyActiveResult", "no active result");
+		return (void)CLOG_FUNCTION(LOG_ERROR, "COrm::ApplyActiveResult", "no active result");
 
 	if(row >= result->GetRowCount())
-		return (void)CLog::Get()->LogFunction(LOG_ERROR, "COrm::ApplyActiveResult", "invalid row specified");
+		return (void)CLOG_FUNCTION(LOG_ERROR, "COrm::ApplyActiveResult", "invalid row specified");
 
 	m_ErrorID = ORM_ERROR_OK;
 	for(size_t v=0; v < m_Vars.size(); ++v) 
 	{
 		SVarInfo *Var = m_Vars.at(v);
 
-		char *data = NULL;
-		result->GetRowDataByName(row, Var->Name.c_str(), &data);
-
-		if(data != NULL) 
+		int field_idx = result->GetFieldIndex(Var->Name.c_str());
+		if(field_idx >= 0) 
 		{
 			switch(Var->Datatype) 
 			{
 				case DATATYPE_INT: 
 				{
 					int IntVar = 0;
-					if(ConvertStrToInt(data, IntVar))
+					if(!result->IsNull(row, field_idx) && result->GetRowDataInt(row, field_idx, IntVar))
 						(*Var->Address) = IntVar;
 				} 
 				break;
 				case DATATYPE_FLOAT: 
 				{
 					float FloatVar = 0.0f;
-					if(ConvertStrToFloat(data, FloatVar))
+					if(!result->IsNull(row, field_idx) && result->GetRowDataFloat(row, field_idx, FloatVar))
 						(*Var->Address) = amx_ftoc(FloatVar);
 
 				} 
 				break;
 				case DATATYPE_STRING:
-					amx_SetString(Var->Address, data != NULL ? data : "NULL", 0, 0, Var->MaxLen);
+				{
+					char *data = NULL;
+					result->GetRowData(row, field_idx, &data);
+					amx_SetCString(Var->Address, data != NULL ? data : "NULL", Var->MaxLen);
+				}
 				break;
 			}
 		}
+		else
+			CLOG_FUNCTION(LOG_WARNING, "COrm::ApplyActiveResult", "field not found (\"%s\")", Var->Name.c_str());
 	}
 
 	//also check for key in result
@@ -121,7 +125,7 @@ void COrm::ApplyActiveResult(unsigned int row)
 					(*(m_KeyVar->Address)) = IntVar;
 			}
 			else if(m_KeyVar->Datatype == DATATYPE_STRING) 
-				amx_SetString(m_KeyVar->Address, key_data, 0, 0, m_KeyVar->MaxLen);
+				amx_SetCString(m_KeyVar->Address, key_data, m_KeyVar->MaxLen);
 		}
 	}
 
@@ -137,7 +141,7 @@ void COrm::GenerateSelectQuery(string &dest)
 	if(m_KeyVar->Datatype == DATATYPE_STRING) 
 	{
 		char *key_value_str = (char *)alloca(sizeof(char) * (m_KeyVar->MaxLen + 1));
-		amx_GetString(key_value_str, m_KeyVar->Address, 0, m_KeyVar->MaxLen);
+		amx_GetCString(m_KeyVar->Address, key_value_str, m_KeyVar->MaxLen);
 		if(key_value_str != NULL) 
 		{
 			string escaped_str;
@@ -168,24 +172,23 @@ void COrm::ApplySelectResult(CMySQLResult *result)
 		{
 			SVarInfo *var = m_Vars.at(i);
 
-			char *data = NULL;
-			result->GetRowData(0, i, &data);
-
 			switch(var->Datatype) 
 			{
 				case DATATYPE_INT: {
 					int int_var = 0;
-					if(ConvertStrToInt(data, int_var))
+					if(!result->IsNull(0, i) && result->GetRowDataInt(0, i, int_var))
 						(*var->Address) = int_var;
 					} break;
 				case DATATYPE_FLOAT: {
 					float float_var = 0.0f;
-					if(ConvertStrToFloat(data, float_var))
+					if(!result->IsNull(0, i) && result->GetRowDataFloat(0, i, float_var))
 						(*var->Address) = amx_ftoc(float_var);
 					} break;
-				case DATATYPE_STRING: 
-					amx_SetString(var->Address, data, 0, 0, var->MaxLen);
-					break;
+				case DATATYPE_STRING: {
+					char *data = NULL;
+					result->GetRowData(0, i, &data);
+					amx_SetCString(var->Address, data != NULL ? data : "NULL", var->MaxLen);
+					} break;
 			}
 		}
 	}
@@ -214,7 +217,7 @@ void COrm::GenerateUpdateQuery(string &dest)
 				break;
 			case DATATYPE_STRING:
 				char *StrVal = (char *)alloca(sizeof(char) * var->MaxLen+1);
-				amx_GetString(StrVal, var->Address, 0, var->MaxLen);
+				amx_GetCString(var->Address, StrVal, var->MaxLen);
 				string escaped_str;
 				m_ConnHandle->GetMainConnection()->EscapeString(StrVal, escaped_str);
 				sprintf(str_buf, "%s`%s`='%s'", FirstIt == true ? "" : ",", var->Name.c_str(), escaped_str.c_str());
@@ -228,7 +231,7 @@ void COrm::GenerateUpdateQuery(string &dest)
 	if(m_KeyVar->Datatype == DATATYPE_STRING) 
 	{
 		char *key_value_str = (char *)alloca(sizeof(char) * m_KeyVar->MaxLen+1);
-		amx_GetString(key_value_str, m_KeyVar->Address, 0, m_KeyVar->MaxLen);
+		amx_GetCString(m_KeyVar->Address, key_value_str, m_KeyVar->MaxLen);
 		string escaped_str;
 		m_ConnHandle->GetMainConnection()->EscapeString(key_value_str, escaped_str);
 		sprintf(str_buf, " WHERE `%s`='%s' LIMIT 1", m_KeyVar->Name.c_str(), escaped_str.c_str());
@@ -259,7 +262,7 @@ void COrm::GenerateInsertQuery(string &dest)
 				break;
 			case DATATYPE_STRING:
 				char *val_str = (char *)alloca(sizeof(char) * (*v)->MaxLen+1);
-				amx_GetString(val_str, (*v)->Address, 0, (*v)->MaxLen);
+				amx_GetCString((*v)->Address, val_str, (*v)->MaxLen);
 				string escaped_str;
 				m_ConnHandle->GetMainConnection()->EscapeString(val_str, escaped_str);
 				vars.push_back(escaped_str);
@@ -300,7 +303,7 @@ void COrm::GenerateDeleteQuery(string &dest)
 	else 
 	{
 		char *key_value_str = (char *)alloca(sizeof(char) * m_KeyVar->MaxLen+1);
-		amx_GetString(key_value_str, m_KeyVar->Address, 0, m_KeyVar->MaxLen);
+		amx_GetCString(m_KeyVar->Address, key_value_str, m_KeyVar->MaxLen);
 		string escaped_str;
 		m_ConnHandle->GetMainConnection()->EscapeString(key_value_str, escaped_str);
 		sprintf(str_buf, "DELETE FROM `%s` WHERE `%s`='%s' LIMIT 1", m_TableName.c_str(), m_KeyVar->Name.c_str(), escaped_str.c_str());
@@ -314,7 +317,7 @@ unsigned short COrm::GenerateSaveQuery(string &dest)
 	if(m_KeyVar->Datatype == DATATYPE_STRING) 
 	{
 		char *key_value_str = (char *)alloca(sizeof(char) * m_KeyVar->MaxLen+1);
-		amx_GetString(key_value_str, m_KeyVar->Address, 0, m_KeyVar->MaxLen);
+		amx_GetCString(m_KeyVar->Address, key_value_str, m_KeyVar->MaxLen);
 		has_valid_key_value = (strlen(key_value_str) > 0);
 	}
 	else //DATATYPE_INT
@@ -395,13 +398,13 @@ void COrm::ClearVariableValues()
 				(*((*v)->Address)) = amx_ftoc(EmtpyFloat);
 				} break;
 			case DATATYPE_STRING:
-				amx_SetString((*v)->Address, "", 0, 0, (*v)->MaxLen);
+				amx_SetCString((*v)->Address, "", (*v)->MaxLen);
 				break;
 		}
 	}
 	//also clear key variable
 	if(m_KeyVar->Datatype == DATATYPE_STRING)
-		amx_SetString(m_KeyVar->Address, "", 0, 0, m_KeyVar->MaxLen);
+		amx_SetCString(m_KeyVar->Address, "", m_KeyVar->MaxLen);
 	else //DATATYPE_INT
 		(*(m_KeyVar->Address)) = 0;
 }
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "CQueryStats.h"
+#include "CMySQLHandle.h"
+#include "CLog.h"
+
+#include <cstdio>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+
+#include "mysql_include/errmsg.h"
+
+
+#define SLOW_LOG_FILE "mysql_slow_log.txt"
+
+boost::mutex CQueryStats::m_SlowLogMtx;
+
+
+static inline bool IsIdentifierChar(char c)
+{
+	return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+static void AppendPlaceholder(string &dest)
+{
+	//lists of values like "IN (1, 2, 3)" collapse into one placeholder, so their length doesn't matter
+	size_t end = dest.length();
+	if(end > 0 && dest[end - 1] == ' ')
+		--end;
+	if(end > 0 && dest[end - 1] == ',')
+	{
+		size_t prev = end - 1;
+		if(prev > 0 && dest[prev - 1] == ' ')
+			--prev;
+		if(prev >= 2 && dest.compare(prev - 2, 2, "?+") == 0)
+		{
+			dest.resize(prev);
+			return ;
+		}
+		if(prev >= 1 && dest[prev - 1] == '?')
+		{
+			dest.resize(prev);
+			dest += '+';
+			return ;
+		}
+	}
+	dest += '?';
+}
+
+static void CloseGroup(string &dest)
+{
+	//rows of a multi-row insert collapse into one
+	const size_t open = dest.rfind('(');
+	if(open == string::npos || dest.find_first_not_of("()?+, ", open) != string::npos)
+		return ;
+
+	size_t prev_end = open;
+	while(prev_end > 0 && (dest[prev_end - 1] == ' ' || dest[prev_end - 1] == ','))
+		--prev_end;
+	const size_t group_len = dest.length() - open;
+	if(prev_end >= group_len && dest.compare(prev_end - group_len, group_len, dest, open, group_len) == 0)
+		dest.resize(prev_end);
+}
+
+void CQueryStats::GetFingerprint(const string &query, string &dest)
+{
+	dest.clear();
+	dest.reserve(query.length());
+
+	const size_t len = query.length();
+	bool pending_space = false;
+	size_t i = 0;
+	while(i < len)
+	{
+		const char c = query[i];
+		if(isspace(static_cast<unsigned char>(c)))
+		{
+			pending_space = true;
+			++i;
+			continue;
+		}
+		//comments
+		if((c == '-' && i + 2 < len && query[i + 1] == '-' && isspace(static_cast<unsigned char>(query[i + 2]))) || c == '#')
+		{
+			while(i < len && query[i] != '\n')
+				++i;
+			pending_space = true;
+			continue;
+		}
+		if(c == '/' && i + 1 < len && query[i + 1] == '*')
+		{
+			const size_t comment_end = query.find("*/", i + 2);
+			i = (comment_end == string::npos) ? len : comment_end + 2;
+			pending_space = true;
+			continue;
+		}
+
+		if(pending_space && !dest.empty())
+			dest += ' ';
+		pending_space = false;
+
+		if(c == '\'' || c == '"') //string literal
+		{
+			++i;
+			while(i < len)
+			{
+				if(query[i] == '\\')
+					i += 2;
+				else if(query[i] == c && i + 1 < len && query[i + 1] == c) //doubled quote
+					i += 2;
+				else if(query[i] == c)
+					break;
+				else
+					++i;
+			}
+			++i;
+			AppendPlaceholder(dest);
+		}
+		else if(c == '`') //quoted identifier
+		{
+			const size_t ident_end = query.find('`', i + 1);
+			const size_t next = (ident_end == string::npos) ? len : ident_end + 1;
+			dest.append(query, i, next - i);
+			i = next;
+		}
+		else if(isdigit(static_cast<unsigned char>(c))) //number, including hex and float values
+		{
+			while(i < len && (isalnum(static_cast<unsigned char>(query[i])) || query[i] == '.'))
+				++i;
+			AppendPlaceholder(dest);
+		}
+		else if(IsIdentifierChar(c))
+		{
+			while(i < len && IsIdentifierChar(query[i]))
+				dest += static_cast<char>(tolower(static_cast<unsigned char>(query[i++])));
+		}
+		else
+		{
+			dest += c;
+			++i;
+			if(c == ')')
+				CloseGroup(dest);
+		}
+	}
+}
+
+
+unsigned int CQueryStats::SFingerprintStats::GetPercentile(unsigned int percentile) const
+{
+	if(Count == 0)
+		return 0;
+
+	const boost::uint64_t rank = (static_cast<boost::uint64_t>(Count) * percentile + 99) / 100;
+	boost::uint64_t num_values = 0;
+	for(unsigned int b = 0; b < CHistogram::NumBuckets - 1; ++b)
+	{
+		num_values += Buckets[b];
+		if(num_values >= rank)
+			return std::min(CHistogram::BucketBounds[b], MaxTime);
+	}
+	return MaxTime;
+}
+
+
+CQueryStats::CQueryStats(int handle_id) :
+	m_HandleID(handle_id),
+	m_SlowThreshold(0),
+	m_SlowExplain(false),
+	m_ExplainConnection(NULL),
+	m_SlowLogThread(NULL),
+	m_SlowLogRunning(true)
+{ }
+
+CQueryStats::~CQueryStats()
+{
+	if(m_SlowLogThread != NULL)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_SlowQueueMtx);
+			m_SlowLogRunning = false;
+		}
+		m_SlowQueueCond.notify_all();
+		m_SlowLogThread->join();
+		delete m_SlowLogThread;
+	}
+
+	if(m_ExplainConnection != NULL)
+	{
+		if(m_ExplainConnection->GetMySQLPointer() != NULL)
+			m_ExplainConnection->Disconnect();
+		m_ExplainConnection->Destroy();
+	}
+}
+
+void CQueryStats::Add(const string &query, unsigned int time, boost::uint64_t num_rows, boost::uint64_t num_bytes)
+{
+	string fingerprint;
+	GetFingerprint(query, fingerprint);
+
+	{
+		boost::mutex::scoped_lock lock(m_StatsMtx);
+		unordered_map<string, SFingerprintStats>::iterator s = m_Stats.find(fingerprint);
+		if(s == m_Stats.end())
+		{
+			//the number of fingerprints is limited, queries with dynamic identifiers could add endless ones
+			if(m_Stats.size() >= MAX_QUERY_FINGERPRINTS)
+				s = m_Stats.insert(std::make_pair(string("<other>"), SFingerprintStats())).first;
+			else
+				s = m_Stats.insert(std::make_pair(fingerprint, SFingerprintStats())).first;
+		}
+
+		SFingerprintStats &stats = s->second;
+		stats.Count++;
+		stats.TotalTime += time;
+		if(time > stats.MaxTime)
+			stats.MaxTime = time;
+		stats.Rows += num_rows;
+		stats.Bytes += num_bytes;
+		stats.Buckets[CHistogram::GetBucket(time)]++;
+	}
+
+	const unsigned int threshold = m_SlowThreshold;
+	if(threshold > 0 && time >= threshold * 1000)
+		QueueSlowQuery(query, fingerprint, time, num_rows);
+}
+
+void CQueryStats::QueueSlowQuery(const string &query, const string &fingerprint, unsigned int time, boost::uint64_t num_rows)
+{
+	boost::mutex::scoped_lock lock(m_SlowQueueMtx);
+	if(m_SlowQueue.size() >= MAX_SLOW_LOG_QUEUE_SIZE)
+	{
+		CLOG_FUNCTION(LOG_WARNING, "CQueryStats::QueueSlowQuery", "slow query log can't keep up, query dropped (connection: %d)", m_HandleID);
+		return ;
+	}
+
+	m_SlowQueue.push_back(SSlowQuery());
+	SSlowQuery &slow_query = m_SlowQueue.back();
+	slow_query.Query = query;
+	slow_query.Fingerprint = fingerprint;
+	slow_query.Time = time;
+	slow_query.Rows = num_rows;
+	::time(&slow_query.LogTime);
+
+	if(m_SlowLogThread == NULL)
+		m_SlowLogThread = new boost::thread(&CQueryStats::ProcessSlowLog, this);
+	lock.unlock();
+	m_SlowQueueCond.notify_one();
+}
+
+void CQueryStats::ProcessSlowLog()
+{
+	mysql_thread_init();
+	vector<SSlowQuery> slow_queries;
+	bool running = true;
+	while(running)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_SlowQueueMtx);
+			while(m_SlowLogRunning && m_SlowQueue.empty())
+				m_SlowQueueCond.wait(lock);
+			running = m_SlowLogRunning;
+			slow_queries.swap(m_SlowQueue);
+		}
+
+		//queries left when the handle is closed are logged without EXPLAIN, the server isn't waited for anymore
+		for(vector<SSlowQuery>::const_iterator q = slow_queries.begin(), end = slow_queries.end(); q != end; ++q)
+			LogSlowQuery(*q, running);
+		slow_queries.clear();
+	}
+	if(m_ExplainConnection != NULL && m_ExplainConnection->IsConnected())
+		m_ExplainConnection->Disconnect();
+	mysql_thread_end();
+}
+
+void CQueryStats::LogSlowQuery(const SSlowQuery &slow_query, bool explain)
+{
+	//only SELECT queries can be explained on every server version
+	string explain_output;
+	if(explain && m_SlowExplain && slow_query.Fingerprint.compare(0, 6, "select") == 0)
+		Explain(slow_query.Query, explain_output);
+
+	char timeform[32];
+	strftime(timeform, sizeof(timeform), "%Y-%m-%d %H:%M:%S", localtime(&slow_query.LogTime));
+
+	boost::mutex::scoped_lock lock(m_SlowLogMtx);
+	FILE *log_file = fopen(SLOW_LOG_FILE, "a");
+	if(log_file == NULL)
+		return ;
+
+	fprintf(log_file, "[%s] handle %d: %.3f ms, %llu rows\n", timeform, m_HandleID, slow_query.Time / 1000.0, static_cast<unsigned long long>(slow_query.Rows));
+	fprintf(log_file, "\tquery: %s\n", slow_query.Query.c_str());
+	fprintf(log_file, "\tfingerprint: %s\n", slow_query.Fingerprint.c_str());
+	if(!explain_output.empty())
+		fprintf(log_file, "%s", explain_output.c_str());
+	fclose(log_file);
+}
+
+void CQueryStats::Explain(const string &query, string &dest)
+{
+	if(m_ExplainConnection == NULL)
+		return ;
+
+	if(!m_ExplainConnection->IsConnected())
+		m_ExplainConnection->Connect();
+	if(!m_ExplainConnection->IsConnected())
+		return ;
+
+	MYSQL *mysql = m_ExplainConnection->GetMySQLPointer();
+	const string explain_query("EXPLAIN " + query);
+	if(mysql_real_query(mysql, explain_query.c_str(), explain_query.length()) != 0)
+	{
+		const unsigned int error_id = mysql_errno(mysql);
+		char error[512];
+		sprintf(error, "\texplain failed: (error #%d) %.450s\n", error_id, mysql_error(mysql));
+		dest.assign(error);
+		if(error_id == CR_SERVER_GONE_ERROR || error_id == CR_SERVER_LOST)
+			m_ExplainConnection->Disconnect(); //reconnects next time
+		return ;
+	}
+
+	MYSQL_RES *sql_result = mysql_store_result(mysql);
+	if(sql_result == NULL)
+		return ;
+
+	//one line per plan row, "field: value" pairs separated by commas
+	MYSQL_FIELD *sql_fields = mysql_fetch_fields(sql_result);
+	const unsigned int num_fields = mysql_num_fields(sql_result);
+	MYSQL_ROW sql_row;
+	while((sql_row = mysql_fetch_row(sql_result)) != NULL)
+	{
+		dest.append("\texplain:");
+		for(unsigned int f = 0; f < num_fields; ++f)
+		{
+			dest.append(f == 0 ? " " : ", ");
+			dest.append(sql_fields[f].name);
+			dest.append(": ");
+			dest.append(sql_row[f] != NULL ? sql_row[f] : "NULL");
+		}
+		dest.append("\n");
+	}
+	mysql_free_result(sql_result);
+}
+
+static bool CompareTotalTime(const std::pair<boost::uint64_t, const void *> &lhs, const std::pair<boost::uint64_t, const void *> &rhs)
+{
+	return lhs.first > rhs.first;
+}
+
+unsigned int CQueryStats::Dump(unsigned int top)
+{
+	//total time and fingerprint entry
+	vector<std::pair<boost::uint64_t, const void *> > sorted;
+
+	boost::mutex::scoped_lock lock(m_StatsMtx);
+	sorted.reserve(m_Stats.size());
+	for(unordered_map<string, SFingerprintStats>::const_iterator s = m_Stats.begin(), end = m_Stats.end(); s != end; ++s)
+		sorted.push_back(std::make_pair(s->second.TotalTime, static_cast<const void *>(&(*s))));
+
+	const size_t num_dumped = std::min<size_t>(top, sorted.size());
+	std::partial_sort(sorted.begin(), sorted.begin() + num_dumped, sorted.end(), CompareTotalTime);
+
+	char timeform[32];
+	time_t rawtime;
+	::time(&rawtime);
+	strftime(timeform, sizeof(timeform), "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
+
+	boost::mutex::scoped_lock log_lock(m_SlowLogMtx);
+	FILE *log_file = fopen(SLOW_LOG_FILE, "a");
+	if(log_file == NULL)
+		return 0;
+
+	fprintf(log_file, "[%s] handle %d: top %d of %d query fingerprints by total time\n", timeform, m_HandleID, static_cast<int>(num_dumped), static_cast<int>(sorted.size()));
+	fprintf(log_file, "\t%10s %12s %10s %10s %10s %12s %12s  %s\n", "count", "total ms", "avg ms", "max ms", "p99 ms", "rows", "bytes", "fingerprint");
+	for(size_t i = 0; i < num_dumped; ++i)
+	{
+		const std::pair<const string, SFingerprintStats> *entry = static_cast<const std::pair<const string, SFingerprintStats> *>(sorted[i].second);
+		const string &fingerprint = entry->first;
+		const SFingerprintStats &stats = entry->second;
+		fprintf(log_file, "\t%10u %12.3f %10.3f %10.3f %10.3f %12llu %12llu  %s\n",
+			stats.Count, stats.TotalTime / 1000.0, stats.TotalTime / 1000.0 / stats.Count, stats.MaxTime / 1000.0, stats.GetPercentile(99) / 1000.0,
+			static_cast<unsigned long long>(stats.Rows), static_cast<unsigned long long>(stats.Bytes), fingerprint.c_str());
+	}
+	fclose(log_file);
+	return static_cast<unsigned int>(num_dumped);
+}
+
+void CQueryStats::Clear()
+{
+	boost::mutex::scoped_lock lock(m_StatsMtx);
+	m_Stats.clear();
+}
@@ -0,0 +1,121 @@
+#pragma once
+#ifndef INC_CQUERYSTATS_H
+#define INC_CQUERYSTATS_H
+
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "CMetrics.h"
+
+using std::string;
+using std::vector;
+using boost::unordered_map;
+
+
+class CMySQLConnection;
+
+
+#define MAX_QUERY_FINGERPRINTS 1000
+#define MAX_SLOW_LOG_QUEUE_SIZE 1024
+
+
+//aggregates the execution statistics of queries by their fingerprint (the query without its literal values)
+//and writes queries slower than a threshold to the slow query log;
+//the log (and the EXPLAIN of slow queries) is written by a background thread, so it doesn't block unthreaded queries
+class CQueryStats
+{
+public:
+	CQueryStats(int handle_id);
+	~CQueryStats();
+
+	//called by the executing thread after every query; time is in microseconds
+	void Add(const string &query, unsigned int time, boost::uint64_t num_rows, boost::uint64_t num_bytes);
+
+	//threshold in milliseconds, 0 disables the slow query log;
+	//the explain connection is used to log the execution plan of slow SELECT queries
+	inline void SetSlowLog(unsigned int threshold, bool explain)
+	{
+		m_SlowThreshold = threshold;
+		m_SlowExplain = explain;
+	}
+	inline void SetExplainConnection(CMySQLConnection *connection)
+	{
+		m_ExplainConnection = connection;
+	}
+
+	//writes the top fingerprints (by total time) to the slow query log, returns the number of written fingerprints
+	unsigned int Dump(unsigned int top);
+	void Clear();
+
+	//replaces literals with '?', collapses lists of literals and whitespace
+	static void GetFingerprint(const string &query, string &dest);
+
+private:
+	struct SFingerprintStats
+	{
+		SFingerprintStats() :
+			Count(0),
+			TotalTime(0),
+			MaxTime(0),
+			Rows(0),
+			Bytes(0)
+		{
+			for(unsigned int b = 0; b < CHistogram::NumBuckets; ++b)
+				Buckets[b] = 0;
+		}
+
+		unsigned int Count;
+		boost::uint64_t TotalTime;
+		unsigned int MaxTime;
+		boost::uint64_t
+			Rows,
+			Bytes;
+		unsigned int Buckets[CHistogram::NumBuckets];
+
+		unsigned int GetPercentile(unsigned int percentile) const;
+	};
+
+	struct SSlowQuery
+	{
+		string 
+			Query,
+			Fingerprint;
+		unsigned int Time;
+		boost::uint64_t Rows;
+		time_t LogTime;
+	};
+
+	void QueueSlowQuery(const string &query, const string &fingerprint, unsigned int time, boost::uint64_t num_rows);
+	void ProcessSlowLog();
+	void LogSlowQuery(const SSlowQuery &slow_query, bool explain);
+	void Explain(const string &query, string &dest);
+
+	int m_HandleID;
+
+	unordered_map<string, SFingerprintStats> m_Stats;
+	boost::mutex m_StatsMtx;
+
+	boost::atomic<unsigned int> m_SlowThreshold;
+	boost::atomic<bool> m_SlowExplain;
+	CMySQLConnection *m_ExplainConnection; //only used by the slow log thread
+
+	vector<SSlowQuery> m_SlowQueue;
+	boost::mutex m_SlowQueueMtx;
+	boost::condition_variable m_SlowQueueCond;
+	boost::thread *m_SlowLogThread; //started on first use
+	bool m_SlowLogRunning;
+
+	//all handles share one slow query log
+	static boost::mutex m_SlowLogMtx;
+};
+
+
+#endif // INC_CQUERYSTATS_H
@@ -7,6 +7,7 @@
 #include "CCallback.h"
 #include "COrm.h"
 #include "CLog.h"
+#include "CFormatter.h"
 
 #include "misc.h"
 
@@ -24,7 +25,7 @@ cell AMX_NATIVE_CALL Native::orm_create(AMX* amx, cell* params)
 	char *table_name = NULL;
 	amx_StrParam(amx, params[1], table_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_create", "table: \"%s\", connectionHandle: %d", table_name, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_create", "table: \"%s\", connectionHandle: %d", table_name, connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("orm_create", connection_id);
@@ -37,7 +38,7 @@ cell AMX_NATIVE_CALL Native::orm_destroy(AMX* amx, cell* params)
 {
 	unsigned int orm_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_destroy", "orm_id: %d", orm_id);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_destroy", "orm_id: %d", orm_id);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_destroy", orm_id);
@@ -51,7 +52,7 @@ cell AMX_NATIVE_CALL Native::orm_errno(AMX* amx, cell* params)
 {
 	unsigned int orm_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_errno", "orm_id: %d", orm_id);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_errno", "orm_id: %d", orm_id);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_errno", orm_id);
@@ -65,7 +66,7 @@ cell AMX_NATIVE_CALL Native::orm_apply_cache(AMX* amx, cell* params)
 	unsigned int orm_id = params[1];
 	unsigned int row_idx = params[2];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_apply_cache", "orm_id: %d, row: %d", orm_id, row_idx);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_apply_cache", "orm_id: %d, row: %d", orm_id, row_idx);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_apply_cache", orm_id);
@@ -85,13 +86,13 @@ cell AMX_NATIVE_CALL Native::orm_select(AMX* amx, cell* params)
 	amx_StrParam(amx, params[3], cb_format);
 	amx_StrParam(amx, params[2], cb_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_select", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_select", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_select", orm_id);
 
 	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
-		return CLog::Get()->LogFunction(LOG_ERROR, "orm_select", "callback parameter count does not match format specifier length");
+		return CLOG_FUNCTION(LOG_ERROR, "orm_select", "callback parameter count does not match format specifier length");
 
 
 	COrm *orm_object = COrm::GetOrm(orm_id);
@@ -106,10 +107,11 @@ cell AMX_NATIVE_CALL Native::orm_select(AMX* amx, cell* params)
 			string short_query(query_object->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "orm_select", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "orm_select", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		orm_object->GetConnectionHandle()->ScheduleQuery(query_object);
+		if(!orm_object->GetConnectionHandle()->ScheduleQuery(query_object))
+			return 0;
 	}
 	return 1;
 }
@@ -119,7 +121,7 @@ cell AMX_NATIVE_CALL Native::orm_update(AMX* amx, cell* params)
 {
 	unsigned int orm_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_update", "orm_id: %d", orm_id);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_update", "orm_id: %d", orm_id);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_update", orm_id);
@@ -134,10 +136,11 @@ cell AMX_NATIVE_CALL Native::orm_update(AMX* amx, cell* params)
 			string short_query(query_object->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "orm_update", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "orm_update", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		orm_object->GetConnectionHandle()->ScheduleQuery(query_object);
+		if(!orm_object->GetConnectionHandle()->ScheduleQuery(query_object))
+			return 0;
 	}
 	return 1;
 }
@@ -153,13 +156,13 @@ cell AMX_NATIVE_CALL Native::orm_insert(AMX* amx, cell* params)
 	amx_StrParam(amx, params[3], cb_format);
 	amx_StrParam(amx, params[2], cb_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_insert", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_insert", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_insert", orm_id);
 
 	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
-		return CLog::Get()->LogFunction(LOG_ERROR, "orm_insert", "callback parameter count does not match format specifier length");
+		return CLOG_FUNCTION(LOG_ERROR, "orm_insert", "callback parameter count does not match format specifier length");
 
 
 	COrm *orm_object = COrm::GetOrm(orm_id);
@@ -174,10 +177,11 @@ cell AMX_NATIVE_CALL Native::orm_insert(AMX* amx, cell* params)
 			string short_query(query_object->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "orm_insert", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "orm_insert", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		orm_object->GetConnectionHandle()->ScheduleQuery(query_object);
+		if(!orm_object->GetConnectionHandle()->ScheduleQuery(query_object))
+			return 0;
 	}
 	return 1;
 }
@@ -187,7 +191,7 @@ cell AMX_NATIVE_CALL Native::orm_delete(AMX* amx, cell* params)
 {
 	unsigned int orm_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_delete", "orm_id: %d, clearvars: %d", orm_id, params[2]);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_delete", "orm_id: %d, clearvars: %d", orm_id, params[2]);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_delete", orm_id);
@@ -203,10 +207,11 @@ cell AMX_NATIVE_CALL Native::orm_delete(AMX* amx, cell* params)
 			string short_query(query_object->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "orm_delete", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "orm_delete", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		orm_object->GetConnectionHandle()->ScheduleQuery(query_object);
+		if(!orm_object->GetConnectionHandle()->ScheduleQuery(query_object))
+			return 0;
 
 		if(!!(params[2]) == true)
 			orm_object->ClearVariableValues();
@@ -225,13 +230,13 @@ cell AMX_NATIVE_CALL Native::orm_save(AMX* amx, cell* params)
 	amx_StrParam(amx, params[3], cb_format);
 	amx_StrParam(amx, params[2], cb_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_save", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_save", "orm_id: %d, callback: \"%s\", format: \"%s\"", orm_id, cb_name, cb_format);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_save", orm_id);
 
 	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
-		return CLog::Get()->LogFunction(LOG_ERROR, "orm_save", "callback parameter count does not match format specifier length");
+		return CLOG_FUNCTION(LOG_ERROR, "orm_save", "callback parameter count does not match format specifier length");
 
 
 	COrm *orm_object = COrm::GetOrm(orm_id);
@@ -246,10 +251,11 @@ cell AMX_NATIVE_CALL Native::orm_save(AMX* amx, cell* params)
 			string short_query(query_object->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "orm_save", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "orm_save", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		orm_object->GetConnectionHandle()->ScheduleQuery(query_object);
+		if(!orm_object->GetConnectionHandle()->ScheduleQuery(query_object))
+			return 0;
 	}
 	return 1;
 }
@@ -266,16 +272,16 @@ cell AMX_NATIVE_CALL Native::orm_addvar(AMX* amx, cell* params)
 	int var_maxlen = params[4];
 	amx_StrParam(amx, params[5], var_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_addvar", "orm_id: %d, var: %p, datatype: %d, varname: \"%s\", var_maxlen: %d", orm_id, var_address, var_datatype, var_name, var_maxlen);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_addvar", "orm_id: %d, var: %p, datatype: %d, varname: \"%s\", var_maxlen: %d", orm_id, var_address, var_datatype, var_name, var_maxlen);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_addvar", orm_id);
 
 	if(var_datatype != DATATYPE_INT && var_datatype != DATATYPE_FLOAT && var_datatype != DATATYPE_STRING)
-		return CLog::Get()->LogFunction(LOG_ERROR, "orm_addvar", "unknown datatype specified");
+		return CLOG_FUNCTION(LOG_ERROR, "orm_addvar", "unknown datatype specified");
 
 	if(var_maxlen <= 0)
-		return CLog::Get()->LogFunction(LOG_ERROR, "orm_addvar", "invalid variable length specified");
+		return CLOG_FUNCTION(LOG_ERROR, "orm_addvar", "invalid variable length specified");
 
 	COrm *orm_object = COrm::GetOrm(orm_id);
 	orm_object->AddVariable(var_name, var_address, var_datatype, var_maxlen);
@@ -289,7 +295,7 @@ cell AMX_NATIVE_CALL Native::orm_setkey(AMX* amx, cell* params)
 	char *var_name = NULL;
 	amx_StrParam(amx, params[2], var_name);
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "orm_setkey", "orm_id: %d, varname: \"%s\"", orm_id, var_name);
+	CLOG_FUNCTION(LOG_DEBUG, "orm_setkey", "orm_id: %d, varname: \"%s\"", orm_id, var_name);
 
 	if(!COrm::IsValid(orm_id))
 		return ERROR_INVALID_ORM_ID("orm_setkey", orm_id);
@@ -297,7 +303,7 @@ cell AMX_NATIVE_CALL Native::orm_setkey(AMX* amx, cell* params)
 	if(var_name != NULL)
 		COrm::GetOrm(orm_id)->SetVariableAsKey(var_name);
 	else
-		CLog::Get()->LogFunction(LOG_ERROR, "orm_setkey", "empty variable name specified");
+		CLOG_FUNCTION(LOG_ERROR, "orm_setkey", "empty variable name specified");
 	return 1;
 }
 
@@ -307,14 +313,14 @@ cell AMX_NATIVE_CALL Native::cache_affected_rows(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_affected_rows", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_affected_rows", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_affected_rows", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_affected_rows", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_affected_rows", "no active cache");
 	
 	return static_cast<cell>(Result->AffectedRows());
 }
@@ -324,14 +330,14 @@ cell AMX_NATIVE_CALL Native::cache_warning_count(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_warning_count", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_warning_count", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_warning_count", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_warning_count", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_warning_count", "no active cache");
 	
 	return static_cast<cell>(Result->WarningCount());
 }
@@ -341,14 +347,14 @@ cell AMX_NATIVE_CALL Native::cache_insert_id(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_insert_id", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_insert_id", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_insert_id", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_insert_id", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_insert_id", "no active cache");
 	
 	return static_cast<cell>(Result->InsertID());
 }
@@ -358,14 +364,14 @@ cell AMX_NATIVE_CALL Native::cache_insert_id(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::cache_save(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_save", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_save", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_save", connection_id);
 	
 	int cache_id = CMySQLHandle::GetHandle(connection_id)->SaveActiveResult();
 	if(cache_id == 0)
-		CLog::Get()->LogFunction(LOG_WARNING, "cache_save", "no active cache");
+		CLOG_FUNCTION(LOG_WARNING, "cache_save", "no active cache");
 
 	return static_cast<cell>(cache_id);
 }
@@ -374,7 +380,7 @@ cell AMX_NATIVE_CALL Native::cache_save(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::cache_delete(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_delete", "cache_id: %d, connection: %d", params[1], connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_delete", "cache_id: %d, connection: %d", params[1], connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_delete", connection_id);
@@ -386,7 +392,7 @@ cell AMX_NATIVE_CALL Native::cache_delete(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::cache_set_active(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_set_active", "cache_id: %d, connection: %d", params[1], connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_set_active", "cache_id: %d, connection: %d", params[1], connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_set_active", connection_id);
@@ -394,18 +400,54 @@ cell AMX_NATIVE_CALL Native::cache_set_active(AMX* amx, cell* params)
 	return static_cast<cell>(CMySQLHandle::GetHandle(connection_id)->SetActiveResult((int)params[1]) == true ? 1 : 0);
 }
 
+// native cache_get_result_count(connectionHandle = 1);
+cell AMX_NATIVE_CALL Native::cache_get_result_count(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_result_count", "connection: %d", connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_result_count", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	if(Handle->GetActiveResult() == NULL)
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_result_count", "no active cache");
+
+	return static_cast<cell>(Handle->GetActiveResultCount());
+}
+
+// native cache_set_result(result_idx, connectionHandle = 1);
+cell AMX_NATIVE_CALL Native::cache_set_result(AMX* amx, cell* params)
+{
+	int result_idx = params[1];
+	unsigned int connection_id = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "cache_set_result", "result_idx: %d, connection: %d", result_idx, connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("cache_set_result", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	if(Handle->GetActiveResult() == NULL)
+		return CLOG_FUNCTION(LOG_WARNING, "cache_set_result", "no active cache");
+
+	if(result_idx < 0 || !Handle->SetActiveResultIndex(result_idx))
+		return CLOG_FUNCTION(LOG_ERROR, "cache_set_result", "invalid result index ('%d')", result_idx);
+
+	return 1;
+}
+
 // native cache_get_row_count(connectionHandle = 1);
 cell AMX_NATIVE_CALL Native::cache_get_row_count(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_row_count", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_row_count", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_row_count", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_row_count", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_row_count", "no active cache");
 
 	return static_cast<cell>(Result->GetRowCount());
 }
@@ -414,14 +456,14 @@ cell AMX_NATIVE_CALL Native::cache_get_row_count(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::cache_get_field_count(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_field_count", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_count", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_field_count", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_field_count", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_count", "no active cache");
 
 	return static_cast<cell>(Result->GetFieldCount());
 }
@@ -430,14 +472,14 @@ cell AMX_NATIVE_CALL Native::cache_get_field_count(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::cache_get_data(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[3];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_data", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_data", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_data", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_data", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_data", "no active cache");
 
 	cell *amx_address = NULL;
 	amx_GetAddr(amx, params[1], &amx_address);
@@ -452,17 +494,17 @@ cell AMX_NATIVE_CALL Native::cache_get_field_name(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[3];
 	int field_idx = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_field_name", "field_index: %d, connection: %d", field_idx, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_name", "field_index: %d, connection: %d", field_idx, connection_id);
 
 	if(field_idx < 0)
-		return CLog::Get()->LogFunction(LOG_ERROR, "cache_get_field_name", "invalid field index");
+		return CLOG_FUNCTION(LOG_ERROR, "cache_get_field_name", "invalid field index");
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_field_name", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_field_name", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_name", "no active cache");
 	
 	char *field_name = NULL;
 	Result->GetFieldName(field_idx, &field_name);
@@ -471,6 +513,40 @@ cell AMX_NATIVE_CALL Native::cache_get_field_name(AMX* amx, cell* params)
 	return 1;
 }
 
+// native cache_get_field_index(const field_name[], connectionHandle = 1);
+cell AMX_NATIVE_CALL Native::cache_get_field_index(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[2];
+	char *field_name = NULL;
+	amx_StrParam(amx, params[1], field_name);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_index", "field_name: \"%s\", connection: %d", field_name, connection_id);
+
+	if(field_name == NULL)
+	{
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_field_index", "empty field name specified");
+		return -1;
+	}
+
+	if(!CMySQLHandle::IsValid(connection_id))
+	{
+		//0 is a valid field index, so this can't return the macro's value
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_field_index", "invalid connection handle (ID = %d)", connection_id);
+		return -1;
+	}
+	
+	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
+	if(Result == NULL)
+	{
+		CLOG_FUNCTION(LOG_WARNING, "cache_get_field_index", "no active cache");
+		return -1;
+	}
+
+	int field_idx = Result->GetFieldIndex(field_name);
+	if(field_idx < 0)
+		CLOG_FUNCTION(LOG_WARNING, "cache_get_field_index", "field not found (\"%s\")", field_name);
+	return static_cast<cell>(field_idx);
+}
+
 // native cache_get_row(row, field_idx, destination[], connectionHandle = 1, max_len=sizeof(destination));
 cell AMX_NATIVE_CALL Native::cache_get_row(AMX* amx, cell* params)
 {
@@ -479,20 +555,20 @@ cell AMX_NATIVE_CALL Native::cache_get_row(AMX* amx, cell* params)
 		row_idx = params[1],
 		field_idx = params[2],
 		max_len = params[5];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_row", "row: %d, field_idx: %d, connection: %d, max_len: %d", row_idx, field_idx, connection_id, max_len);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_row", "row: %d, field_idx: %d, connection: %d, max_len: %d", row_idx, field_idx, connection_id, max_len);
 
 	if(row_idx < 0)
-		return CLog::Get()->LogFunction(LOG_ERROR, "cache_get_row", "invalid row number");
+		return CLOG_FUNCTION(LOG_ERROR, "cache_get_row", "invalid row number");
 
 	if(field_idx < 0)
-		return CLog::Get()->LogFunction(LOG_ERROR, "cache_get_row", "invalid field index");
+		return CLOG_FUNCTION(LOG_ERROR, "cache_get_row", "invalid field index");
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_row", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_row", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_row", "no active cache");
 
 	char *row_data = NULL;
 	Result->GetRowData(row_idx, field_idx, &row_data);
@@ -508,25 +584,20 @@ cell AMX_NATIVE_CALL Native::cache_get_row_int(AMX* amx, cell* params)
 	int
 		row_idx = params[1],
 		field_idx = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_row_int", "row: %d, field_idx: %d, connection: %d", row_idx, field_idx, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_row_int", "row: %d, field_idx: %d, connection: %d", row_idx, field_idx, connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_row_int", connection_id);
 
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_row_int", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_row_int", "no active cache");
 
-	char *row_data = NULL;
 	int return_val = 0;
-	Result->GetRowData(row_idx, field_idx, &row_data);
-	if(row_data != NULL)
+	if(Result->GetRowDataInt(row_idx, field_idx, return_val) == false)
 	{
-		if(ConvertStrToInt(row_data, return_val) == false)
-		{
-			CLog::Get()->LogFunction(LOG_ERROR, "cache_get_row_int", "invalid datatype");
-			return_val = 0;
-		}
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_row_int", "invalid datatype");
+		return_val = 0;
 	}
 
 	return static_cast<cell>(return_val);
@@ -539,25 +610,20 @@ cell AMX_NATIVE_CALL Native::cache_get_row_float(AMX* amx, cell* params)
 	int
 		row_idx = params[1],
 		field_idx = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_row_float", "row: %d, field_idx: %d, connection: %d", row_idx, field_idx, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_row_float", "row: %d, field_idx: %d, connection: %d", row_idx, field_idx, connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_row_float", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_row_float", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_row_float", "no active cache");
 
 	float return_val = 0.0f;
-	char *row_data = NULL;
-	Result->GetRowData(row_idx, field_idx, &row_data);
-	if(row_data != NULL)
+	if(Result->GetRowDataFloat(row_idx, field_idx, return_val) == false)
 	{
-		if(ConvertStrToFloat(row_data, return_val) == false)
-		{
-			CLog::Get()->LogFunction(LOG_ERROR, "cache_get_row_float", "invalid datatype");
-			return_val = 0.0f;
-		}
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_row_float", "invalid datatype");
+		return_val = 0.0f;
 	}
 	
 	return amx_ftoc(return_val);
@@ -572,20 +638,20 @@ cell AMX_NATIVE_CALL Native::cache_get_field_content(AMX* amx, cell* params)
 		max_len = params[5];
 	char *field_name = NULL;
 	amx_StrParam(amx, params[2], field_name);
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_field_content", "row: %d, field_name: \"%s\", connection: %d, max_len: %d", row_idx, field_name, connection_id, max_len);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_content", "row: %d, field_name: \"%s\", connection: %d, max_len: %d", row_idx, field_name, connection_id, max_len);
 
 	if(row_idx < 0)
-		return CLog::Get()->LogFunction(LOG_ERROR, "cache_get_field_content", "invalid row number");
+		return CLOG_FUNCTION(LOG_ERROR, "cache_get_field_content", "invalid row number");
 
 	if(field_name == NULL)
-		return CLog::Get()->LogFunction(LOG_ERROR, "cache_get_field_content", "empty field name specified");
+		return CLOG_FUNCTION(LOG_ERROR, "cache_get_field_content", "empty field name specified");
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_field_content", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_field_content", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_content", "no active cache");
 	
 	char *field_data = NULL;
 	Result->GetRowDataByName(row_idx, field_name, &field_data);
@@ -601,26 +667,24 @@ cell AMX_NATIVE_CALL Native::cache_get_field_content_int(AMX* amx, cell* params)
 	int row_idx = params[1];
 	char *field_name = NULL;
 	amx_StrParam(amx, params[2], field_name);
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_field_content_int", "row: %d, field_name: \"%s\", connection: %d", row_idx, field_name, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_content_int", "row: %d, field_name: \"%s\", connection: %d", row_idx, field_name, connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_field_content_int", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_field_content_int", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_content_int", "no active cache");
 
 	int return_val = 0;
-	char *field_data = NULL;
-	Result->GetRowDataByName(row_idx, field_name, &field_data);
+	int field_idx = Result->GetFieldIndex(field_name);
+	if(field_idx < 0)
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_content_int", "field not found (\"%s\")", field_name);
 
-	if(field_data != NULL)
+	if(Result->GetRowDataInt(row_idx, field_idx, return_val) == false)
 	{
-		if(ConvertStrToInt(field_data, return_val) == false)
-		{
-			CLog::Get()->LogFunction(LOG_ERROR, "cache_get_field_content_int", "invalid datatype");
-			return_val = 0;
-		}
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_field_content_int", "invalid datatype");
+		return_val = 0;
 	}
 	return static_cast<cell>(return_val);
 }
@@ -632,31 +696,32 @@ cell AMX_NATIVE_CALL Native::cache_get_field_content_float(AMX* amx, cell* param
 	int row_idx = params[1];
 	char *field_name = NULL;
 	amx_StrParam(amx, params[2], field_name);
-	CLog::Get()->LogFunction(LOG_DEBUG, "cache_get_field_content_float", "row: %d, field_name: \"%s\", connection: %d", row_idx, field_name, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "cache_get_field_content_float", "row: %d, field_name: \"%s\", connection: %d", row_idx, field_name, connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("cache_get_field_content_float", connection_id);
 	
 	CMySQLResult *Result = CMySQLHandle::GetHandle(connection_id)->GetActiveResult();
 	if(Result == NULL)
-		return CLog::Get()->LogFunction(LOG_WARNING, "cache_get_field_content_float", "no active cache");
+		return CLOG_FUNCTION(LOG_WARNING, "cache_get_field_content_float", "no active cache");
 
 	float return_val = 0.0f;
-	char *field_data = NULL;
-	Result->GetRowDataByName(params[1], field_name, &field_data);
+	int field_idx = Result->GetFieldIndex(field_name);
+	if(field_idx < 0)
+	{
+		CLOG_FUNCTION(LOG_WARNING, "cache_get_field_content_float", "field not found (\"%s\")", field_name);
+		return amx_ftoc(return_val);
+	}
 
-	if(field_data != NULL)
+	if(Result->GetRowDataFloat(row_idx, field_idx, return_val) == false)
 	{
-		if(ConvertStrToFloat(field_data, return_val) == false)
-		{
-			CLog::Get()->LogFunction(LOG_ERROR, "cache_get_field_content_float", "invalid datatype");
-			return_val = 0.0f;
-		}
+		CLOG_FUNCTION(LOG_ERROR, "cache_get_field_content_float", "invalid datatype");
+		return_val = 0.0f;
 	}
 	return amx_ftoc(return_val);
 }
 
-//native mysql_connect(const host[], const user[], const database[], const password[], port = 3306, bool:autoreconnect = true);
+//native mysql_connect(const host[], const user[], const database[], const password[], port = 3306, bool:autoreconnect = true, pool_size = 1);
 cell AMX_NATIVE_CALL Native::mysql_connect(AMX* amx, cell* params)
 {
 	char
@@ -672,16 +737,19 @@ cell AMX_NATIVE_CALL Native::mysql_connect(AMX* amx, cell* params)
 
 	unsigned int port = params[5];
 	bool auto_reconnect = !!(params[6]);
+	int pool_size = (params[0] / sizeof(cell)) >= 7 ? params[7] : 1; //scripts compiled with an older include don't pass this parameter
 
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_connect", "host: \"%s\", user: \"%s\", database: \"%s\", password: \"****\", port: %d, autoreconnect: %s", host, user, db, port, auto_reconnect == true ? "true" : "false");
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_connect", "host: \"%s\", user: \"%s\", database: \"%s\", password: \"****\", port: %d, autoreconnect: %s, pool_size: %d", host, user, db, port, auto_reconnect == true ? "true" : "false", pool_size);
 
 	if(host == NULL || user == NULL || db == NULL)
-		return CLog::Get()->LogFunction(LOG_ERROR, "mysql_connect", "empty connection data specified");
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_connect", "empty connection data specified");
+
+	if(pool_size < 1 || pool_size > MAX_QUERY_POOL_SIZE)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_connect", "invalid pool size (must be between 1 and %d)", MAX_QUERY_POOL_SIZE);
 	
 
-	CMySQLHandle *Handle = CMySQLHandle::Create(host, user, pass != NULL ? pass : "", db, port, auto_reconnect);
-	Handle->GetMainConnection()->Connect();
-	Handle->GetQueryConnection()->Connect();
+	//the connections are established in the background, OnConnectionStateChange tells the result
+	CMySQLHandle *Handle = CMySQLHandle::Create(host, user, pass != NULL ? pass : "", db, port, auto_reconnect, pool_size);
 	return static_cast<cell>(Handle->GetID());
 }
 
@@ -690,7 +758,7 @@ cell AMX_NATIVE_CALL Native::mysql_close(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
 	bool wait = !!params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_close", "connection: %d, wait: %s", connection_id, wait == true ? "true" : "false");
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_close", "connection: %d, wait: %s", connection_id, wait == true ? "true" : "false");
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_close", connection_id);
@@ -704,8 +772,8 @@ cell AMX_NATIVE_CALL Native::mysql_close(AMX* amx, cell* params)
 	if(wait == true)
 		Handle->WaitForQueryExec();
 
+	//the worker threads close their connections themselves
 	Handle->GetMainConnection()->Disconnect();
-	Handle->GetQueryConnection()->Disconnect();
 	Handle->Destroy();
 	return 1;
 }
@@ -714,22 +782,13 @@ cell AMX_NATIVE_CALL Native::mysql_close(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::mysql_reconnect(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_reconnect", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_reconnect", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_reconnect", connection_id);
 	
 
-	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
-
-	Handle->GetMainConnection()->Disconnect();
-	Handle->GetMainConnection()->Connect();
-
-	//wait until all threaded queries are executed, then reconnect query connection
-	Handle->WaitForQueryExec();
-	Handle->GetQueryConnection()->Disconnect();
-	Handle->GetQueryConnection()->Connect();
-
+	CMySQLHandle::GetHandle(connection_id)->Reconnect();
 	return 1;
 }
 
@@ -738,7 +797,7 @@ cell AMX_NATIVE_CALL Native::mysql_option(AMX* amx, cell* params)
 {
 	unsigned short option_type = params[1];
 	int option_value = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_option", "option: %d, value: %d", option_type, option_value);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_option", "option: %d, value: %d", option_type, option_value);
 
 
 	switch(option_type)
@@ -746,8 +805,31 @@ cell AMX_NATIVE_CALL Native::mysql_option(AMX* amx, cell* params)
 		case DUPLICATE_CONNECTIONS:
 			MySQLOptions.DuplicateConnections = !!option_value;
 			break;
+		case CALLBACK_TIME_BUDGET:
+			if(option_value < 0)
+				return CLOG_FUNCTION(LOG_ERROR, "mysql_option", "invalid callback time budget");
+			MySQLOptions.CallbackTimeBudget = option_value;
+			break;
+		case CALLBACK_COUNT_BUDGET:
+			if(option_value < 0)
+				return CLOG_FUNCTION(LOG_ERROR, "mysql_option", "invalid callback count budget");
+			MySQLOptions.CallbackCountBudget = option_value;
+			break;
+		case QUERY_TIMEOUT:
+			if(option_value < 0)
+				return CLOG_FUNCTION(LOG_ERROR, "mysql_option", "invalid query timeout");
+			MySQLOptions.QueryTimeout = option_value;
+			break;
+		case LOG_MAX_FILE_SIZE:
+			if(option_value < 0 || option_value > 1024 * 1024)
+				return CLOG_FUNCTION(LOG_ERROR, "mysql_option", "invalid log file size (has to be between 0 and 1048576 kilobytes)");
+			CLog::Get()->SetMaxFileSize(option_value * 1024);
+			break;
+		case LOG_FLUSH_ON_ERROR:
+			CLog::Get()->SetFlushOnError(!!option_value);
+			break;
 		default:
-			return CLog::Get()->LogFunction(LOG_ERROR, "mysql_option", "invalid option");
+			return CLOG_FUNCTION(LOG_ERROR, "mysql_option", "invalid option");
 	}
 
 	return 1;
@@ -756,7 +838,7 @@ cell AMX_NATIVE_CALL Native::mysql_option(AMX* amx, cell* params)
 //native mysql_current_handle();
 cell AMX_NATIVE_CALL Native::mysql_current_handle(AMX* amx, cell* params)
 {
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_current_handle", "");
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_current_handle", "");
 
 
 	int HandleID = 0;
@@ -770,7 +852,7 @@ cell AMX_NATIVE_CALL Native::mysql_current_handle(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::mysql_unprocessed_queries(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_unprocessed_queries", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_unprocessed_queries", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_unprocessed_queries", connection_id);
@@ -779,6 +861,324 @@ cell AMX_NATIVE_CALL Native::mysql_unprocessed_queries(AMX* amx, cell* params)
 	return static_cast<cell>(CMySQLHandle::GetHandle(connection_id)->GetUnprocessedQueryCount());
 }
 
+//native mysql_queue_stats(connectionHandle = 1, &high_water = 0, &overflows = 0);
+cell AMX_NATIVE_CALL Native::mysql_queue_stats(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_queue_stats", "connection: %d", connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_queue_stats", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetQueryQueueHighWater());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetQueryQueueOverflows());
+
+	return static_cast<cell>(Handle->GetUnprocessedQueryCount());
+}
+
+//native mysql_query_timeout(connectionHandle, timeout);
+cell AMX_NATIVE_CALL Native::mysql_query_timeout(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	int timeout = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_query_timeout", "connection: %d, timeout: %d", connection_id, timeout);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_query_timeout", connection_id);
+
+	if(timeout < 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_query_timeout", "invalid timeout");
+
+	CMySQLHandle::GetHandle(connection_id)->SetQueryTimeout(timeout);
+	return 1;
+}
+
+//native mysql_query_stats(connectionHandle = 1, &query_count = 0, &max_time = 0, &script_time = 0);
+cell AMX_NATIVE_CALL Native::mysql_query_stats(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_query_stats", "connection: %d", connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_query_stats", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetBlockingQueryCount());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetMaxBlockingTime());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[4], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetBlockingTime(amx));
+
+	return static_cast<cell>(Handle->GetBlockingTime());
+}
+
+//native mysql_metrics_timer(connectionHandle, E_MYSQL_TIMER:timer, &count = 0, &max_time = 0, &p99_time = 0);
+cell AMX_NATIVE_CALL Native::mysql_metrics_timer(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	unsigned int timer_id = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_metrics_timer", "connection: %d, timer: %d", connection_id, timer_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_metrics_timer", connection_id);
+
+	if(timer_id >= TIMER_COUNT)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_metrics_timer", "invalid timer");
+
+	const CHistogram &Timer = CMySQLHandle::GetHandle(connection_id)->GetMetrics().GetTimer(static_cast<E_METRIC_TIMER>(timer_id));
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Timer.GetCount());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[4], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Timer.GetMax());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[5], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Timer.GetPercentile(99));
+
+	return static_cast<cell>(Timer.GetAverage());
+}
+
+//native mysql_metrics_counter(connectionHandle, E_MYSQL_COUNTER:counter);
+cell AMX_NATIVE_CALL Native::mysql_metrics_counter(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	unsigned int counter_id = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_metrics_counter", "connection: %d, counter: %d", connection_id, counter_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_metrics_counter", connection_id);
+
+	if(counter_id >= COUNTER_COUNT)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_metrics_counter", "invalid counter");
+
+	boost::uint64_t value = CMySQLHandle::GetHandle(connection_id)->GetMetrics().GetCounter(static_cast<E_METRIC_COUNTER>(counter_id));
+	//bytes would overflow a cell quickly
+	if(counter_id == COUNTER_BYTES_RECEIVED)
+		value /= 1024;
+	return static_cast<cell>(value);
+}
+
+//native mysql_metrics_errors(connectionHandle, errorid);
+cell AMX_NATIVE_CALL Native::mysql_metrics_errors(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	unsigned int error_id = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_metrics_errors", "connection: %d, errorid: %d", connection_id, error_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_metrics_errors", connection_id);
+
+	return static_cast<cell>(CMySQLHandle::GetHandle(connection_id)->GetMetrics().GetErrorCount(error_id));
+}
+
+//native mysql_metrics_file(const filename[], interval = 15000);
+cell AMX_NATIVE_CALL Native::mysql_metrics_file(AMX* amx, cell* params)
+{
+	char *filename = NULL;
+	amx_StrParam(amx, params[1], filename);
+	int interval = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_metrics_file", "filename: \"%s\", interval: %d", filename != NULL ? filename : "", interval);
+
+	if(interval < 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_metrics_file", "invalid interval");
+	if(filename == NULL && interval > 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_metrics_file", "no file name specified");
+
+	CMetrics::StartWriter(filename != NULL ? filename : "", interval);
+	return 1;
+}
+
+//native mysql_slow_query_log(connectionHandle, threshold, bool:explain = false);
+cell AMX_NATIVE_CALL Native::mysql_slow_query_log(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	int threshold = params[2];
+	bool explain = !!params[3];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_slow_query_log", "connection: %d, threshold: %d, explain: %s", connection_id, threshold, explain == true ? "true" : "false");
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_slow_query_log", connection_id);
+
+	if(threshold < 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_slow_query_log", "invalid threshold");
+
+	CMySQLHandle::GetHandle(connection_id)->GetQueryStats().SetSlowLog(threshold, explain);
+	return 1;
+}
+
+//native mysql_dump_query_stats(connectionHandle, top = 10, bool:clear = false);
+cell AMX_NATIVE_CALL Native::mysql_dump_query_stats(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	int top = params[2];
+	bool clear = !!params[3];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_dump_query_stats", "connection: %d, top: %d, clear: %s", connection_id, top, clear == true ? "true" : "false");
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_dump_query_stats", connection_id);
+
+	if(top < 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_dump_query_stats", "invalid number of fingerprints");
+
+	CQueryStats &Stats = CMySQLHandle::GetHandle(connection_id)->GetQueryStats();
+	unsigned int num_dumped = Stats.Dump(top);
+	if(clear == true)
+		Stats.Clear();
+	return static_cast<cell>(num_dumped);
+}
+
+//native mysql_write_behind(connectionHandle, max_batch_size, max_delay);
+cell AMX_NATIVE_CALL Native::mysql_write_behind(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	int 
+		max_batch_size = params[2],
+		max_delay = params[3];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_write_behind", "connection: %d, max_batch_size: %d, max_delay: %d", connection_id, max_batch_size, max_delay);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_write_behind", connection_id);
+
+	if(max_batch_size < 0 || max_batch_size > MAX_WRITE_BATCH_SIZE)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_write_behind", "invalid batch size (has to be between 0 and %d)", MAX_WRITE_BATCH_SIZE);
+
+	if(max_delay < 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_write_behind", "invalid delay");
+
+	CMySQLHandle::GetHandle(connection_id)->SetWriteBehind(max_batch_size, max_delay);
+	return 1;
+}
+
+//native mysql_write_behind_stats(connectionHandle, &avg_batch_size = 0, &avg_flush_latency = 0, &max_flush_latency = 0);
+cell AMX_NATIVE_CALL Native::mysql_write_behind_stats(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_write_behind_stats", "connection: %d", connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_write_behind_stats", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetAverageWriteBatchSize());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetAverageFlushLatency());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[4], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetMaxFlushLatency());
+
+	return static_cast<cell>(Handle->GetWriteBatchCount());
+}
+
+//native mysql_pool_stats(&query_allocs = 0, &callback_allocs = 0, &result_allocs = 0);
+cell AMX_NATIVE_CALL Native::mysql_pool_stats(AMX* amx, cell* params)
+{
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_pool_stats", "");
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[1], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CObjectPool<CMySQLQuery>::GetAllocCount());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CObjectPool<CCallback>::GetAllocCount());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CObjectPool<CMySQLResult>::GetAllocCount());
+
+	return static_cast<cell>(CObjectPool<CMySQLQuery>::GetAcquireCount());
+}
+
+//native mysql_queue_latency(connectionHandle = 1, &max_latency = 0);
+cell AMX_NATIVE_CALL Native::mysql_queue_latency(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_queue_latency", "connection: %d", connection_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_queue_latency", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(Handle->GetMaxQueueLatency());
+
+	return static_cast<cell>(Handle->GetAverageQueueLatency());
+}
+
+//native mysql_callback_stats(&carryover_ticks = 0, &overrun_ticks = 0, &max_tick_time = 0, &high_water = 0, &overflows = 0);
+cell AMX_NATIVE_CALL Native::mysql_callback_stats(AMX* amx, cell* params)
+{
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_callback_stats", "");
+
+	cell *amx_address = NULL;
+	amx_GetAddr(amx, params[1], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CCallback::GetCarryOverTicks());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[2], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CCallback::GetOverrunTicks());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[3], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CCallback::GetMaxTickTime());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[4], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CCallback::GetHighWater());
+
+	amx_address = NULL;
+	amx_GetAddr(amx, params[5], &amx_address);
+	if(amx_address != NULL)
+		(*amx_address) = static_cast<cell>(CCallback::GetOverflows());
+
+	return static_cast<cell>(CCallback::GetPendingCount());
+}
+
 //native mysql_tquery(conhandle, query[], callback[], format[], {Float,_}:...);
 cell AMX_NATIVE_CALL Native::mysql_tquery(AMX* amx, cell* params)
 {
@@ -786,29 +1186,28 @@ cell AMX_NATIVE_CALL Native::mysql_tquery(AMX* amx, cell* params)
 	unsigned int connection_id = params[1];
 
 	char 
-		*query = NULL,
 		*cb_name = NULL,
 		*cb_format = NULL;
-	amx_StrParam(amx, params[2], query);
 	amx_StrParam(amx, params[3], cb_name);
 	amx_StrParam(amx, params[4], cb_format);
 
 	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
 	{
-		string short_query(query == NULL ? "" : query);
+		string short_query;
+		amx_GetStdString(amx, params[2], short_query);
 		short_query.resize(64);
-		CLog::Get()->LogFunction(LOG_DEBUG, "mysql_tquery", "connection: %d, query: \"%s\", callback: \"%s\", format: \"%s\"", connection_id, short_query.c_str(), cb_name, cb_format);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_tquery", "connection: %d, query: \"%s\", callback: \"%s\", format: \"%s\"", connection_id, short_query.c_str(), cb_name, cb_format);
 	}
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_tquery", connection_id);
 
 	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
-		return CLog::Get()->LogFunction(LOG_ERROR, "mysql_tquery", "callback parameter count does not match format specifier length");
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery", "callback parameter count does not match format specifier length");
 
 
 	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
-	CMySQLQuery *Query = CMySQLQuery::Create(query, Handle, cb_name);
+	CMySQLQuery *Query = CMySQLQuery::Create(amx, params[2], Handle, cb_name);
 	if(Query != NULL)
 	{
 		if(Query->Callback->Name.length() > 0)
@@ -819,28 +1218,177 @@ cell AMX_NATIVE_CALL Native::mysql_tquery(AMX* amx, cell* params)
 			string short_query(Query->Query);
 			if(short_query.length() > 512)
 				short_query.resize(512);
-			CLog::Get()->LogFunction(LOG_DEBUG, "mysql_tquery", "scheduling query \"%s\"..", short_query.c_str());
+			CLOG_FUNCTION(LOG_DEBUG, "mysql_tquery", "scheduling query \"%s\"..", short_query.c_str());
 		}
 
-		Handle->ScheduleQuery(Query);
+		if(!Handle->ScheduleQuery(Query))
+			return 0;
+	}
+	return 1;
+}
+
+
+//native mysql_tquery_format(connectionHandle, const query[], const callback[], const format[], {Float,_}:...);
+cell AMX_NATIVE_CALL Native::mysql_tquery_format(AMX* amx, cell* params)
+{
+	static const int ConstParamCount = 4;
+	unsigned int connection_id = params[1];
+
+	char 
+		*cb_name = NULL,
+		*cb_format = NULL;
+	amx_StrParam(amx, params[3], cb_name);
+	amx_StrParam(amx, params[4], cb_format);
+
+	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
+	{
+		string short_query;
+		amx_GetStdString(amx, params[2], short_query);
+		short_query.resize(64);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_tquery_format", "connection: %d, query: \"%s\", callback: \"%s\", format: \"%s\"", connection_id, short_query.c_str(), cb_name, cb_format);
+	}
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_tquery_format", connection_id);
+
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	CMySQLQuery *Query = CMySQLQuery::Create(amx, params[2], Handle, cb_name);
+	if(Query == NULL) //empty query, already logged
+		return 0;
+
+	//only the values are copied here, the query is built by the worker thread
+	const unsigned int num_args = (params[0]/4) - ConstParamCount;
+	unsigned int num_values = 0;
+	if(!CFormatter::CopyValues(amx, params, ConstParamCount + 1, num_args, Query->Query.c_str(), Query->FormatParams, num_values))
+	{
+		Query->Destroy();
+		return 0;
+	}
+	Query->FormatPending = true;
+
+	const size_t num_cb_params = cb_format != NULL ? strlen(cb_format) : 0;
+	if(num_values + num_cb_params != num_args)
+	{
+		Query->Destroy();
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery_format", "parameter count does not match format specifier length");
+	}
+
+	if(Query->Callback->Name.length() > 0)
+		Query->Callback->FillCallbackParams(amx, params, cb_format, ConstParamCount + num_values);
+
+	if(!Handle->ScheduleQuery(Query))
+		return 0;
+	return 1;
+}
+
+
+//native mysql_tquery_batch(connectionHandle, query[], callback[], format[], {Float,_}:...);
+cell AMX_NATIVE_CALL Native::mysql_tquery_batch(AMX* amx, cell* params)
+{
+	static const int ConstParamCount = 4;
+	unsigned int connection_id = params[1];
+
+	char 
+		*cb_name = NULL,
+		*cb_format = NULL;
+	amx_StrParam(amx, params[3], cb_name);
+	amx_StrParam(amx, params[4], cb_format);
+
+	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
+	{
+		string short_query;
+		amx_GetStdString(amx, params[2], short_query);
+		short_query.resize(64);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_tquery_batch", "connection: %d, query: \"%s\", callback: \"%s\", format: \"%s\"", connection_id, short_query.c_str(), cb_name, cb_format);
+	}
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_tquery_batch", connection_id);
+
+	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery_batch", "callback parameter count does not match format specifier length");
+
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	CMySQLQuery *Query = CMySQLQuery::Create(amx, params[2], Handle, cb_name);
+	if(Query != NULL)
+	{
+		Query->MultiStatement = true;
+		if(Query->Callback->Name.length() > 0)
+			Query->Callback->FillCallbackParams(amx, params, cb_format, ConstParamCount);
+
+		if(!Handle->ScheduleQuery(Query))
+			return 0;
+	}
+	return 1;
+}
+
+//native mysql_tquery_stream(connectionHandle, query[], chunk_size, const chunk_callback[], const callback[], const format[], {Float,_}:...);
+cell AMX_NATIVE_CALL Native::mysql_tquery_stream(AMX* amx, cell* params)
+{
+	static const int ConstParamCount = 6;
+	unsigned int connection_id = params[1];
+	int chunk_size = params[3];
+
+	char 
+		*chunk_cb_name = NULL,
+		*cb_name = NULL,
+		*cb_format = NULL;
+	amx_StrParam(amx, params[4], chunk_cb_name);
+	amx_StrParam(amx, params[5], cb_name);
+	amx_StrParam(amx, params[6], cb_format);
+
+	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
+	{
+		string short_query;
+		amx_GetStdString(amx, params[2], short_query);
+		short_query.resize(64);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_tquery_stream", "connection: %d, query: \"%s\", chunk_size: %d, chunk_callback: \"%s\", callback: \"%s\", format: \"%s\"", connection_id, short_query.c_str(), chunk_size, chunk_cb_name, cb_name, cb_format);
+	}
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_tquery_stream", connection_id);
+
+	if(chunk_size <= 0)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery_stream", "invalid chunk size");
+
+	if(chunk_cb_name == NULL)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery_stream", "empty chunk callback specified");
+
+	if(cb_format != NULL && strlen(cb_format) != ( (params[0]/4) - ConstParamCount ))
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_tquery_stream", "callback parameter count does not match format specifier length");
+
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	CMySQLQuery *Query = CMySQLQuery::Create(amx, params[2], Handle, cb_name);
+	if(Query != NULL)
+	{
+		Query->StreamChunkSize = chunk_size;
+		Query->StreamCallback.assign(chunk_cb_name);
+		Query->Callback->FillCallbackParams(amx, params, cb_format, ConstParamCount);
+
+		if(!Handle->ScheduleQuery(Query))
+			return 0;
 	}
 	return 1;
 }
 
 
-//native Cache:mysql_query(conhandle, query[], bool:use_cache = true);
+//native Cache:mysql_query(conhandle, query[], bool:use_cache = true, timeout = -1);
 cell AMX_NATIVE_CALL Native::mysql_query(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	char *query = NULL;
-	amx_StrParam(amx, params[2], query);
 	bool use_cache = !!params[3];
+	//scripts compiled with an older include don't pass the timeout
+	int timeout = (params[0] / sizeof(cell)) >= 4 ? params[4] : -1;
 
 	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
 	{
-		string ShortenQuery(query == NULL ? "" : query);
+		string ShortenQuery;
+		amx_GetStdString(amx, params[2], ShortenQuery);
 		ShortenQuery.resize(64);
-		CLog::Get()->LogFunction(LOG_DEBUG, "mysql_query", "connection: %d, query: \"%s\", use_cache: %s", connection_id, ShortenQuery.c_str(), use_cache == true ? "true" : "false");
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_query", "connection: %d, query: \"%s\", use_cache: %s", connection_id, ShortenQuery.c_str(), use_cache == true ? "true" : "false");
 	}
 
 	if(!CMySQLHandle::IsValid(connection_id))
@@ -848,10 +1396,19 @@ cell AMX_NATIVE_CALL Native::mysql_query(AMX* amx, cell* params)
 
 	int stored_result_id = 0;
 	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
-	CMySQLQuery *Query = CMySQLQuery::Create(query, Handle, NULL, false);
+	CMySQLQuery *Query = CMySQLQuery::Create(amx, params[2], Handle, NULL, false);
 	if(Query != NULL)
 	{
+		if(timeout < 0)
+			timeout = Handle->GetQueryTimeout();
+
+		const boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+		if(timeout > 0)
+			Handle->WatchQuery(timeout);
 		Query->Execute();
+		if(timeout > 0 && Handle->UnwatchQuery())
+			CLOG_FUNCTION(LOG_ERROR, "mysql_query", "query timed out after %d milliseconds and was killed", timeout);
+		Handle->AddBlockingTime(amx, static_cast<unsigned int>((boost::posix_time::microsec_clock::universal_time() - start_time).total_microseconds()));
 
 		if(use_cache == true)
 		{
@@ -868,251 +1425,155 @@ cell AMX_NATIVE_CALL Native::mysql_query(AMX* amx, cell* params)
 }
 
 
-// native mysql_format(connectionHandle, output[], len, format[], {Float,_}:...);
-cell AMX_NATIVE_CALL Native::mysql_format(AMX* amx, cell* params)
+//native Statement:mysql_stmt_prepare(connectionHandle, const query[]);
+cell AMX_NATIVE_CALL Native::mysql_stmt_prepare(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	size_t dest_len = (size_t)params[3];
-	char *format_str = NULL;
-	amx_StrParam(amx, params[4], format_str);
+	char *query = NULL;
+	amx_StrParam(amx, params[2], query);
 
 	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
 	{
-		string ShortenFormat(format_str == NULL ? "" : format_str);
-		if(ShortenFormat.length() > 128)
-		{
-			ShortenFormat.erase(128, ShortenFormat.length());
-			ShortenFormat.append("...");
-		}
-		CLog::Get()->LogFunction(LOG_DEBUG, "mysql_format", "connection: %d, len: %d, format: \"%s\"", connection_id, dest_len, ShortenFormat.c_str());
+		string short_query(query == NULL ? "" : query);
+		short_query.resize(64);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_stmt_prepare", "connection: %d, query: \"%s\"", connection_id, short_query.c_str());
 	}
 
-	if(format_str == NULL)
-		return 0;
-
 	if(!CMySQLHandle::IsValid(connection_id))
-		return ERROR_INVALID_CONNECTION_HANDLE("mysql_format", connection_id);
-	
-	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_stmt_prepare", connection_id);
 
-	char *output_str = (char *)calloc(dest_len * 2, sizeof(char)); //*2 just for safety, what if user specified wrong DestLen?
-	char *org_output_str = output_str;
+	if(query == NULL)
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_stmt_prepare", "empty query specified");
 
-	const unsigned int first_param_idx = 5;
-	const unsigned int num_args = (params[0] / sizeof(cell));
-	const unsigned int num_dyn_args = num_args - (first_param_idx - 1);
-	unsigned int param_counter = 0;
+	return static_cast<cell>(CMySQLHandle::GetHandle(connection_id)->RegisterStatement(query));
+}
 
-	for( ; *format_str != '\0'; ++format_str)
-	{
-		if(strlen(org_output_str) >= dest_len)
-		{
-			CLog::Get()->LogFunction(LOG_ERROR, "mysql_format", "destination size is too small");
-			break;
-		}
-		
-		if(*format_str == '%')
-		{
-			++format_str;
+//native mysql_stmt_execute(connectionHandle, Statement:statement, const callback[], const param_format[], const format[], {Float,_}:...);
+cell AMX_NATIVE_CALL Native::mysql_stmt_execute(AMX* amx, cell* params)
+{
+	static const int ConstParamCount = 5;
+	unsigned int connection_id = params[1];
+	int statement_id = params[2];
 
-			if(*format_str == '%')
-			{
-				*output_str = '%';
-				++output_str;
-				continue;
-			}
+	char 
+		*cb_name = NULL,
+		*param_format = NULL,
+		*cb_format = NULL;
+	amx_StrParam(amx, params[3], cb_name);
+	amx_StrParam(amx, params[4], param_format);
+	amx_StrParam(amx, params[5], cb_format);
 
-			if(param_counter >= num_dyn_args)
-			{
-				CLog::Get()->LogFunction(LOG_ERROR, "mysql_format", "no value for specifier \"%%%c\" available", *format_str);
-				continue;
-			}
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_stmt_execute", "connection: %d, statement: %d, callback: \"%s\", param_format: \"%s\", format: \"%s\"", connection_id, statement_id, cb_name, param_format, cb_format);
 
-			bool SpaceWidth = true;
-			int Width = -1;
-			int Precision = -1;
-			
-			if(*format_str == '0')
-			{
-				SpaceWidth = false;
-				++format_str;
-			}
-			if(*format_str > '0' && *format_str <= '9')
-			{
-				Width = 0;
-				while(*format_str >= '0' && *format_str <= '9')
-				{
-					Width *= 10;
-					Width += *format_str - '0';
-					++format_str;
-				}
-			}
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_stmt_execute", connection_id);
 
-			if(*format_str == '.')
-			{
-				++format_str;
-				Precision = *format_str - '0';
-				++format_str;
-			}
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	if(!Handle->IsValidStatement(statement_id))
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_stmt_execute", "invalid statement (ID = %d)", statement_id);
 
+	const size_t num_stmt_params = param_format != NULL ? strlen(param_format) : 0;
+	const size_t num_cb_params = cb_format != NULL ? strlen(cb_format) : 0;
+	if(num_stmt_params + num_cb_params != ( (params[0]/4) - ConstParamCount ))
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_stmt_execute", "parameter count does not match format specifier length");
+
+
+	CMySQLQuery *Query = CMySQLQuery::Create(Handle->GetStatementQuery(statement_id).c_str(), Handle, cb_name);
+	if(Query != NULL)
+	{
+		Query->StatementID = statement_id;
+		Query->StatementParams.reserve(num_stmt_params);
+		for(size_t p = 0; p < num_stmt_params; ++p)
+		{
 			cell *amx_address = NULL;
-			amx_GetAddr(amx, params[first_param_idx + param_counter], &amx_address);
-			
-			switch (*format_str)
+			char *str_buf = NULL;
+			switch(param_format[p])
 			{
-				case 'i': 
-				case 'I':
-				case 'd': 
-				case 'D':
-				{
-					char NumBuf[13];
-					ConvertIntToStr<10>(*amx_address, NumBuf);
-					size_t NumBufLen = strlen(NumBuf);
-					for(int len = (int)NumBufLen; Width > len; ++len)
-					{
-						if(SpaceWidth == true)
-							*output_str = ' ';
-						else
-							*output_str = '0';
-						++output_str;
-					}
-					
-					for(size_t c=0; c < NumBufLen; ++c)
-					{
-						*output_str = NumBuf[c];
-						++output_str;
-					}
+				case 'i':
+				case 'd':
+					amx_GetAddr(amx, params[ConstParamCount + 1 + p], &amx_address);
+					Query->StatementParams.push_back(static_cast<int>(*amx_address));
 					break;
-				}
-				case 'z': 
-				case 'Z':
-				case 's': 
-				case 'S':
-				{
-					char *StrBuf = NULL;
-					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
-					if(StrBuf != NULL)
-					{
-						for(size_t c=0, len = strlen(StrBuf); c < len; ++c)
-						{
-							*output_str = StrBuf[c];
-							++output_str;
-						}
-					}
-					
-					break;
-				}
 				case 'f':
-				case 'F':
-				{
-					float FloatVal = amx_ctof(*amx_address);
-					char 
-						FloatBuf[84+1], 
-						SpecBuf[13];
-
-					ConvertIntToStr<10>((int)floor(FloatVal), FloatBuf);
-					for(int len = (int)strlen(FloatBuf); Width > len; ++len)
-					{
-						if(SpaceWidth == true)
-							*output_str = ' ';
-						else
-							*output_str = '0';
-						++output_str;
-					}
-
-					if(Precision <= 6 && Precision >= 0)
-						sprintf(SpecBuf, "%%.%df", Precision);
-					else
-						sprintf(SpecBuf, "%%f");
-					
-					sprintf(FloatBuf, SpecBuf, FloatVal);
-
-					for(size_t c=0, len = strlen(FloatBuf); c < len; ++c)
-					{
-						*output_str = FloatBuf[c];
-						++output_str;
-					}
-					break;
-				}
-				case 'e': 
-				case 'E':
-				{
-					char *StrBuf = NULL;
-					amx_StrParam(amx, params[first_param_idx + param_counter], StrBuf);
-					if(StrBuf != NULL)
-					{
-						string escaped_str;
-						Handle->GetMainConnection()->EscapeString(StrBuf, escaped_str);
-
-						for(size_t c=0, len = escaped_str.length(); c < len; ++c)
-						{
-							*output_str = escaped_str.at(c);
-							++output_str;
-						}
-					}
-					break;
-				}
-				case 'X':
-				{
-					char HexBuf[17];
-					memset(HexBuf, 0, 17);
-					ConvertIntToStr<16>(*amx_address, HexBuf);
-
-					for(size_t c=0, len = strlen(HexBuf); c < len; ++c)
-					{
-						if(HexBuf[c] >= 'a' && HexBuf[c] <= 'f')
-							HexBuf[c] = toupper(HexBuf[c]);
-
-						*output_str = HexBuf[c];
-						++output_str;
-					}
-
-					break;
-				}
-				case 'x':
-				{
-					char HexBuf[17];
-					memset(HexBuf, 0, 17);
-					ConvertIntToStr<16>(*amx_address, HexBuf);
-
-					for(size_t c=0, len = strlen(HexBuf); c < len; ++c)
-					{
-						*output_str = HexBuf[c];
-						++output_str;
-					}
+					amx_GetAddr(amx, params[ConstParamCount + 1 + p], &amx_address);
+					Query->StatementParams.push_back(amx_ctof(*amx_address));
 					break;
-				}
-				case 'b':
-				case 'B':
-				{
-					char BinBuf[33];
-					memset(BinBuf, 0, 33);
-					ConvertIntToStr<2>(*amx_address, BinBuf);
-
-					for(size_t c=0, len = strlen(BinBuf); c < len; ++c)
-					{
-						*output_str = BinBuf[c];
-						++output_str;
-					}
+				case 's':
+				case 'z':
+					amx_StrParam(amx, params[ConstParamCount + 1 + p], str_buf);
+					Query->StatementParams.push_back(string(str_buf != NULL ? str_buf : ""));
 					break;
-				}
 				default:
-					CLog::Get()->LogFunction(LOG_ERROR, "mysql_format", "invalid format specifier \"%%%c\"", *format_str);
-
+					CLOG_FUNCTION(LOG_ERROR, "mysql_stmt_execute", "invalid format specifier \"%c\"", param_format[p]);
+					Query->Destroy();
+					return 0;
 			}
-			param_counter++;
 		}
-		else 
+
+		if(Query->Callback->Name.length() > 0)
+			Query->Callback->FillCallbackParams(amx, params, cb_format, ConstParamCount + num_stmt_params);
+
+		if(!Handle->ScheduleQuery(Query))
+			return 0;
+	}
+	return 1;
+}
+
+//native mysql_stmt_close(connectionHandle, Statement:statement);
+cell AMX_NATIVE_CALL Native::mysql_stmt_close(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	int statement_id = params[2];
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_stmt_close", "connection: %d, statement: %d", connection_id, statement_id);
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_stmt_close", connection_id);
+
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+	if(!Handle->IsValidStatement(statement_id))
+		return CLOG_FUNCTION(LOG_ERROR, "mysql_stmt_close", "invalid statement (ID = %d)", statement_id);
+
+	Handle->CloseStatement(statement_id);
+	return 1;
+}
+
+
+// native mysql_format(connectionHandle, output[], len, format[], {Float,_}:...);
+cell AMX_NATIVE_CALL Native::mysql_format(AMX* amx, cell* params)
+{
+	unsigned int connection_id = params[1];
+	size_t dest_len = (size_t)params[3];
+	char *format_str = NULL;
+	amx_StrParam(amx, params[4], format_str);
+
+	if(CLog::Get()->IsLogLevel(LOG_DEBUG))
+	{
+		string ShortenFormat(format_str == NULL ? "" : format_str);
+		if(ShortenFormat.length() > 128)
 		{
-			*output_str = *format_str;
-			++output_str;
+			ShortenFormat.erase(128, ShortenFormat.length());
+			ShortenFormat.append("...");
 		}
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_format", "connection: %d, len: %d, format: \"%s\"", connection_id, dest_len, ShortenFormat.c_str());
 	}
+
+	if(format_str == NULL)
+		return 0;
+
+	if(!CMySQLHandle::IsValid(connection_id))
+		return ERROR_INVALID_CONNECTION_HANDLE("mysql_format", connection_id);
 	
-	*output_str = '\0';
-	amx_SetCString(amx, params[2], org_output_str, dest_len);
-	free(org_output_str);
-	return static_cast<cell>(output_str-org_output_str);
+	CMySQLHandle *Handle = CMySQLHandle::GetHandle(connection_id);
+
+	if(dest_len == 0)
+		return 0;
+
+	//reused, so its buffer only grows once
+	static string output;
+	CFormatter::Format(amx, params, 5, format_str, Handle->GetMainConnection(), dest_len - 1, output);
+
+	amx_SetCString(amx, params[2], output.c_str(), dest_len);
+	return static_cast<cell>(output.length());
 }
 
 //native mysql_set_charset(charset[], connectionHandle = 1);
@@ -1121,7 +1582,7 @@ cell AMX_NATIVE_CALL Native::mysql_set_charset(AMX* amx, cell* params)
 	unsigned int connection_id = params[2];
 	char *charset = NULL;
 	amx_StrParam(amx, params[1], charset);
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_set_charset", "charset: \"%s\", connection: %d", charset, connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_set_charset", "charset: \"%s\", connection: %d", charset, connection_id);
 
 	if(charset == NULL)
 		return 0;
@@ -1130,7 +1591,7 @@ cell AMX_NATIVE_CALL Native::mysql_set_charset(AMX* amx, cell* params)
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_set_charset", connection_id);
 
 
-	mysql_set_character_set(CMySQLHandle::GetHandle(connection_id)->GetMainConnection()->GetMySQLPointer(), charset);
+	CMySQLHandle::GetHandle(connection_id)->GetMainConnection()->SetCharset(charset);
 
 	return 1;
 }
@@ -1139,7 +1600,7 @@ cell AMX_NATIVE_CALL Native::mysql_set_charset(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::mysql_get_charset(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[2];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_get_charset", "connection: %d, max_len: %d", connection_id, params[3]);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_get_charset", "connection: %d, max_len: %d", connection_id, params[3]);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_get_charset", connection_id);
@@ -1167,7 +1628,7 @@ cell AMX_NATIVE_CALL Native::mysql_escape_string(AMX* amx, cell* params)
 			ShortenSource.erase(128, ShortenSource.length());
 			ShortenSource.append("...");
 		}
-		CLog::Get()->LogFunction(LOG_DEBUG, "mysql_escape_string", "source: \"%s\", connection: %d, max_len: %d", ShortenSource.c_str(), connection_id, dest_len);
+		CLOG_FUNCTION(LOG_DEBUG, "mysql_escape_string", "source: \"%s\", connection: %d, max_len: %d", ShortenSource.c_str(), connection_id, dest_len);
 	}
 
 	if(!CMySQLHandle::IsValid(connection_id))
@@ -1178,7 +1639,7 @@ cell AMX_NATIVE_CALL Native::mysql_escape_string(AMX* amx, cell* params)
 	if(source_str != NULL) 
 	{
 		if(strlen(source_str) >= dest_len)
-			return CLog::Get()->LogFunction(LOG_ERROR, "mysql_escape_string", "destination size is too small (must be at least as big as source)");
+			return CLOG_FUNCTION(LOG_ERROR, "mysql_escape_string", "destination size is too small (must be at least as big as source)");
 		
 		CMySQLHandle::GetHandle(connection_id)->GetMainConnection()->EscapeString(source_str, escaped_str);
 	}
@@ -1192,7 +1653,7 @@ cell AMX_NATIVE_CALL Native::mysql_stat(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[2];
 	size_t dest_len = params[3];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_stat", "connection: %d, max_len: %d", connection_id, dest_len);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_stat", "connection: %d, max_len: %d", connection_id, dest_len);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_stat", connection_id);
@@ -1209,7 +1670,7 @@ cell AMX_NATIVE_CALL Native::mysql_stat(AMX* amx, cell* params)
 cell AMX_NATIVE_CALL Native::mysql_errno(AMX* amx, cell* params)
 {
 	unsigned int connection_id = params[1];
-	CLog::Get()->LogFunction(LOG_DEBUG, "mysql_errno", "connection: %d", connection_id);
+	CLOG_FUNCTION(LOG_DEBUG, "mysql_errno", "connection: %d", connection_id);
 
 	if(!CMySQLHandle::IsValid(connection_id))
 		return ERROR_INVALID_CONNECTION_HANDLE("mysql_errno", connection_id);
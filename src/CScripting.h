@@ -34,14 +34,35 @@ namespace Native
 	cell AMX_NATIVE_CALL mysql_reconnect(AMX* amx, cell* params);
 
 	cell AMX_NATIVE_CALL mysql_unprocessed_queries(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_queue_latency(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_current_handle(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_option(AMX* amx, cell* params);
 
 	cell AMX_NATIVE_CALL mysql_errno(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_escape_string(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_format(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_callback_stats(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_queue_stats(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_pool_stats(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_query_timeout(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_query_stats(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_metrics_timer(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_metrics_counter(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_metrics_errors(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_metrics_file(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_slow_query_log(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_dump_query_stats(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_write_behind(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_write_behind_stats(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_tquery(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_tquery_batch(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_tquery_stream(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_tquery_format(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_query(AMX* amx, cell* params);
+
+	cell AMX_NATIVE_CALL mysql_stmt_prepare(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_stmt_execute(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL mysql_stmt_close(AMX* amx, cell* params);
 	
 	cell AMX_NATIVE_CALL mysql_stat(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL mysql_set_charset(AMX* amx, cell* params);
@@ -51,8 +72,11 @@ namespace Native
 	//Cache natives
 	cell AMX_NATIVE_CALL cache_get_data(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL cache_get_row_count(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL cache_get_result_count(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL cache_set_result(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL cache_get_field_count(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL cache_get_field_name(AMX* amx, cell* params);
+	cell AMX_NATIVE_CALL cache_get_field_index(AMX* amx, cell* params);
 
 	cell AMX_NATIVE_CALL cache_get_row(AMX* amx, cell* params);
 	cell AMX_NATIVE_CALL cache_get_row_int(AMX* amx, cell* params);
@@ -3,8 +3,11 @@
 #include "main.h"
 #include "CScripting.h"
 #include "CMySQLHandle.h"
+#include "CMySQLQuery.h"
+#include "CMySQLResult.h"
 #include "CCallback.h"
 #include "CLog.h"
+#include "CFormatter.h"
 
 //#include <vld.h>
 
@@ -45,8 +48,13 @@ PLUGIN_EXPORT void PLUGIN_CALL Unload()
 {
 	logprintf("plugin.mysql: Unloading plugin...");
 
+	CMetrics::StopWriter();
 	CCallback::ClearAll();
 	CMySQLHandle::ClearAll();
+	CFormatter::ClearCache();
+	CObjectPool<CMySQLQuery>::Clear();
+	CObjectPool<CCallback>::Clear();
+	CObjectPool<CMySQLResult>::Clear();
 	mysql_library_end();
 	CLog::Delete(); //this has to be the last!
 
@@ -55,6 +63,7 @@ PLUGIN_EXPORT void PLUGIN_CALL Unload()
 
 PLUGIN_EXPORT void PLUGIN_CALL ProcessTick() 
 {
+	CMySQLHandle::ProcessWriteBuffers();
 	CCallback::ProcessCallbacks();
 }
 
@@ -88,15 +97,36 @@ const AMX_NATIVE_INFO MySQLNatives[] =
 	{"mysql_reconnect",					Native::mysql_reconnect},
 	
 	{"mysql_unprocessed_queries",		Native::mysql_unprocessed_queries},
+	{"mysql_queue_latency",				Native::mysql_queue_latency},
 	{"mysql_current_handle",			Native::mysql_current_handle},
 	{"mysql_option",					Native::mysql_option},
 	
 	{"mysql_errno",						Native::mysql_errno},
 	{"mysql_escape_string",				Native::mysql_escape_string},
 	{"mysql_format",					Native::mysql_format},
+	{"mysql_callback_stats",			Native::mysql_callback_stats},
+	{"mysql_queue_stats",				Native::mysql_queue_stats},
+	{"mysql_pool_stats",				Native::mysql_pool_stats},
+	{"mysql_query_timeout",				Native::mysql_query_timeout},
+	{"mysql_query_stats",				Native::mysql_query_stats},
+	{"mysql_metrics_timer",				Native::mysql_metrics_timer},
+	{"mysql_metrics_counter",			Native::mysql_metrics_counter},
+	{"mysql_metrics_errors",			Native::mysql_metrics_errors},
+	{"mysql_metrics_file",				Native::mysql_metrics_file},
+	{"mysql_slow_query_log",			Native::mysql_slow_query_log},
+	{"mysql_dump_query_stats",			Native::mysql_dump_query_stats},
+	{"mysql_write_behind",				Native::mysql_write_behind},
+	{"mysql_write_behind_stats",		Native::mysql_write_behind_stats},
 	{"mysql_tquery",					Native::mysql_tquery},
+	{"mysql_tquery_batch",				Native::mysql_tquery_batch},
+	{"mysql_tquery_stream",				Native::mysql_tquery_stream},
+	{"mysql_tquery_format",				Native::mysql_tquery_format},
 	{"mysql_query",						Native::mysql_query},
 
+	{"mysql_stmt_prepare",				Native::mysql_stmt_prepare},
+	{"mysql_stmt_execute",				Native::mysql_stmt_execute},
+	{"mysql_stmt_close",				Native::mysql_stmt_close},
+
 	{"mysql_stat",						Native::mysql_stat},
 	{"mysql_get_charset",				Native::mysql_get_charset},
 	{"mysql_set_charset",				Native::mysql_set_charset},
@@ -104,8 +134,11 @@ const AMX_NATIVE_INFO MySQLNatives[] =
 
 	{"cache_get_data",					Native::cache_get_data},
 	{"cache_get_row_count",				Native::cache_get_row_count},
+	{"cache_get_result_count",			Native::cache_get_result_count},
+	{"cache_set_result",				Native::cache_set_result},
 	{"cache_get_field_count",			Native::cache_get_field_count},
 	{"cache_get_field_name",			Native::cache_get_field_name},
+	{"cache_get_field_index",			Native::cache_get_field_index},
 
 	{"cache_get_row",					Native::cache_get_row},
 	{"cache_get_row_int",				Native::cache_get_row_int},
@@ -134,6 +167,7 @@ PLUGIN_EXPORT int PLUGIN_CALL AmxLoad(AMX *amx)
 PLUGIN_EXPORT int PLUGIN_CALL AmxUnload(AMX *amx) 
 {
 	CCallback::EraseAmx(amx);
+	CMySQLHandle::EraseAmx(amx);
 	return AMX_ERR_NONE;
 }
 
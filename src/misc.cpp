@@ -3,37 +3,289 @@
 #include "misc.h"
 
 #include <cstring>
-#include <boost/spirit/include/qi.hpp>
-#include <boost/spirit/include/karma.hpp>
+#include <limits>
+#include <boost/cstdint.hpp>
 
-using namespace boost::spirit;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define USE_SSE2
+	#include <emmintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+
+//index of the lowest set bit, mask must not be 0
+static inline unsigned int GetLowestBit(int mask)
+{
+	#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, static_cast<unsigned long>(mask));
+		return static_cast<unsigned int>(index);
+	#else
+		return static_cast<unsigned int>(__builtin_ctz(static_cast<unsigned int>(mask)));
+	#endif
+}
+#endif
+
+
+static inline bool IsDigit(char c)
+{
+	return static_cast<unsigned char>(c - '0') < 10;
+}
+
+//case-insensitive match of a lower-case word at src[pos], pos is moved behind it on success
+static bool ParseWord(const char *src, size_t len, size_t &pos, const char *word)
+{
+	size_t i = pos;
+	for( ; *word != '\0'; ++word, ++i)
+	{
+		if(i >= len || (src[i] | 0x20) != *word)
+			return false;
+	}
+	pos = i;
+	return true;
+}
+
+//optional sign and at least one digit, fails on overflow;
+//len can be (size_t)-1 for null terminated strings, parsing always stops at the terminator
+static bool ParseInt(const char *src, size_t len, size_t &pos, int &dest)
+{
+	size_t i = pos;
+	bool negative = false;
+	if(i < len && (src[i] == '-' || src[i] == '+'))
+		negative = (src[i++] == '-');
+	if(i >= len || !IsDigit(src[i]))
+		return false;
+
+	const boost::uint64_t limit = negative ? 2147483648ULL : 2147483647ULL;
+	boost::uint64_t value = 0;
+	do
+	{
+		value = value * 10 + (src[i++] - '0');
+		if(value > limit)
+			return false;
+	} while(i < len && IsDigit(src[i]));
+
+	dest = negative ? static_cast<int>(0U - static_cast<unsigned int>(value)) : static_cast<int>(value);
+	pos = i;
+	return true;
+}
+
+//"nan", "nan(...)", "inf" and "infinity" in any case
+static bool ParseNanInf(const char *src, size_t len, size_t &pos, float &dest)
+{
+	size_t i = pos;
+	if(ParseWord(src, len, i, "nan"))
+	{
+		if(i < len && src[i] == '(')
+		{
+			do
+				++i;
+			while(i < len && src[i] != '\0' && src[i] != ')');
+			if(i >= len || src[i] != ')')
+				return false;
+			++i;
+		}
+		dest = std::numeric_limits<float>::quiet_NaN();
+	}
+	else if(ParseWord(src, len, i, "inf"))
+	{
+		ParseWord(src, len, i, "inity");
+		dest = std::numeric_limits<float>::infinity();
+	}
+	else
+		return false;
+
+	pos = i;
+	return true;
+}
+
+//mantissa * 10^exponent rounded to float
+static float ScaleToFloat(boost::uint64_t mantissa, int exponent)
+{
+	static const float FloatPow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+	static const double DoublePow10[] = 
+	{ 
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 
+	};
+
+	if(mantissa == 0)
+		return 0.0f;
+
+	//both operands are exact, so the result is rounded only once
+	if(mantissa < (1ULL << 24) && exponent >= -10 && exponent <= 10)
+	{
+		const float value = static_cast<float>(mantissa);
+		return exponent >= 0 ? value * FloatPow10[exponent] : value / FloatPow10[-exponent];
+	}
+
+	//the double result is far more precise than a float can hold
+	if(exponent > 400)
+		return std::numeric_limits<float>::infinity();
+	if(exponent < -400)
+		return 0.0f;
+
+	double value = static_cast<double>(mantissa);
+	for( ; exponent > 22; exponent -= 22)
+		value *= DoublePow10[22];
+	for( ; exponent < -22; exponent += 22)
+		value /= DoublePow10[22];
+	value = exponent >= 0 ? value * DoublePow10[exponent] : value / DoublePow10[-exponent];
+	return static_cast<float>(value);
+}
+
+//same grammar as boost::spirit's float_ parser: 
+//optional sign, digits with optional '.' and fraction digits (one side may be empty), optional exponent,
+//or nan/inf; an 'e' without a valid exponent fails
+static bool ParseFloat(const char *src, size_t len, float &dest)
+{
+	//significant digits are collected in an integer, the position of the '.' goes into the exponent
+	static const int MaxMantissaDigits = 19;
+
+	size_t i = 0;
+	bool negative = false;
+	if(i < len && (src[i] == '-' || src[i] == '+'))
+		negative = (src[i++] == '-');
+
+	boost::uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+
+	const size_t int_start = i;
+	for( ; i < len && IsDigit(src[i]); ++i)
+	{
+		if(num_digits < MaxMantissaDigits)
+		{
+			mantissa = mantissa * 10 + (src[i] - '0');
+			if(mantissa != 0)
+				num_digits++;
+		}
+		else
+			exponent++;
+	}
+	const bool got_a_number = (i > int_start);
+
+	float special_value;
+	if(!got_a_number && ParseNanInf(src, len, i, special_value))
+	{
+		dest = negative ? -special_value : special_value;
+		return true;
+	}
+
+	size_t num_frac_digits = 0;
+	if(i < len && src[i] == '.')
+	{
+		const size_t frac_start = ++i;
+		for( ; i < len && IsDigit(src[i]); ++i)
+		{
+			if(num_digits < MaxMantissaDigits)
+			{
+				mantissa = mantissa * 10 + (src[i] - '0');
+				if(mantissa != 0)
+					num_digits++;
+				exponent--;
+			}
+		}
+		num_frac_digits = i - frac_start;
+		if(num_frac_digits == 0 && !got_a_number)
+			return false;
+	}
+	else if(!got_a_number)
+		return false;
+
+	if(i < len && (src[i] == 'e' || src[i] == 'E'))
+	{
+		++i;
+		int exp_value;
+		if(!ParseInt(src, len, i, exp_value))
+			return false;
+		//values this far out are 0 or infinite anyway
+		if(exp_value > 100000)
+			exp_value = 100000;
+		else if(exp_value < -100000)
+			exp_value = -100000;
+		exponent += exp_value;
+	}
+	//spirit reads "1nan" and "1inf" as nan and inf
+	else if(num_frac_digits == 0 && mantissa == 1 && exponent == 0 && ParseNanInf(src, len, i, special_value))
+	{
+		dest = negative ? -special_value : special_value;
+		return true;
+	}
+
+	const float value = ScaleToFloat(mantissa, exponent);
+	dest = negative ? -value : value;
+	return true;
+}
 
 
 bool ConvertStrToInt(const char *src, int &dest) 
 {
-	const char 
-		*first_iter = src,
-		*last_iter = first_iter+strlen(src);
+	size_t pos = 0;
+	return ParseInt(src, static_cast<size_t>(-1), pos, dest);
+}
 
-	return qi::parse(first_iter, last_iter, qi::int_, dest);
+bool ConvertStrToInt(const char *src, size_t len, int &dest) 
+{
+	size_t pos = 0;
+	return ParseInt(src, len, pos, dest);
 }
 
 bool ConvertStrToFloat(const char *src, float &dest) 
 {
-	const char 
-		*first_iter(src),
-		*last_iter(first_iter+strlen(src));
+	return ParseFloat(src, static_cast<size_t>(-1), dest);
+}
 
-	return qi::parse(first_iter, last_iter, qi::float_, dest);
+bool ConvertStrToFloat(const char *src, size_t len, float &dest) 
+{
+	return ParseFloat(src, len, dest);
 }
 
 
 template<unsigned int B> //B = base/radix
 bool ConvertIntToStr(int src, char *dest) 
 {
-	bool ReturnVal = karma::generate(dest, karma::int_generator<int, B>(), src);
-	*dest = 0;
-	return ReturnVal;
+	static const char Digits[] = "0123456789abcdef";
+	static const char DigitPairs[] = 
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	//digits are written backwards into the buffer, negative values get a '-' in front of their magnitude
+	char buf[33];
+	char *digit = buf + sizeof(buf);
+	unsigned int value = src < 0 ? 0U - static_cast<unsigned int>(src) : static_cast<unsigned int>(src);
+	if(B == 10)
+	{
+		for( ; value >= 100; value /= 100)
+		{
+			const char *pair = DigitPairs + (value % 100) * 2;
+			*--digit = pair[1];
+			*--digit = pair[0];
+		}
+		if(value >= 10)
+		{
+			*--digit = DigitPairs[value * 2 + 1];
+			*--digit = DigitPairs[value * 2];
+		}
+		else
+			*--digit = Digits[value];
+	}
+	else
+	{
+		do
+		{
+			*--digit = Digits[value % B];
+			value /= B;
+		} while(value != 0);
+	}
+
+	if(src < 0)
+		*dest++ = '-';
+	const size_t num_digits = static_cast<size_t>(buf + sizeof(buf) - digit);
+	memcpy(dest, digit, num_digits);
+	dest[num_digits] = '\0';
+	return true;
 }
 //instantiate templates
 template bool ConvertIntToStr<16>(int src, char *dest);
@@ -42,16 +294,7 @@ template bool ConvertIntToStr<2>(int src, char *dest);
 
 bool ConvertIntToStr(int src, char *dest) 
 {
-	bool success = karma::generate(dest, karma::int_generator<int>(), src);
-	*dest = 0;
-	return success;
-}
-
-bool ConvertFloatToStr(float src, char *dest) 
-{
-	bool success = karma::generate(dest, double_, src);
-	*dest = 0;
-	return success;
+	return ConvertIntToStr<10>(src, dest);
 }
 
 
@@ -59,5 +302,354 @@ void amx_SetCString(AMX* amx, cell param, const char *str, int len)
 {
 	cell *dest = NULL;
 	amx_GetAddr(amx, param, &dest);
-	amx_SetString(dest, str, 0, 0, (len > 0) ? len : (strlen(str)+1));
-}
\ No newline at end of file
+	amx_SetCString(dest, str, (len > 0) ? len : (strlen(str)+1));
+}
+
+
+//cells are truncated to chars like amx_GetString does
+static void NarrowCells(const cell *src, size_t len, char *dest)
+{
+	size_t i = 0;
+#ifdef USE_SSE2
+	const __m128i char_mask = _mm_set1_epi32(0xFF);
+	for( ; i + 16 <= len; i += 16)
+	{
+		const __m128i *block = reinterpret_cast<const __m128i *>(src + i);
+		const __m128i
+			words_lo = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(block), char_mask), _mm_and_si128(_mm_loadu_si128(block + 1), char_mask)),
+			words_hi = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(block + 2), char_mask), _mm_and_si128(_mm_loadu_si128(block + 3), char_mask));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_packus_epi16(words_lo, words_hi));
+	}
+#endif
+	for( ; i < len; ++i)
+		dest[i] = static_cast<char>(src[i]);
+	dest[len] = '\0';
+}
+
+//chars are sign-extended to cells like amx_SetString does
+static void WidenChars(const char *src, size_t len, cell *dest)
+{
+	size_t i = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for( ; i + 16 <= len; i += 16)
+	{
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		const __m128i sign = _mm_cmpgt_epi8(zero, block);
+		const __m128i
+			words_lo = _mm_unpacklo_epi8(block, sign),
+			words_hi = _mm_unpackhi_epi8(block, sign);
+		const __m128i
+			sign_lo = _mm_srai_epi16(words_lo, 15),
+			sign_hi = _mm_srai_epi16(words_hi, 15);
+		__m128i *out = reinterpret_cast<__m128i *>(dest + i);
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(words_lo, sign_lo));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(words_lo, sign_lo));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(words_hi, sign_hi));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(words_hi, sign_hi));
+	}
+#endif
+	for( ; i < len; ++i)
+		dest[i] = static_cast<cell>(src[i]);
+	dest[len] = 0;
+}
+
+size_t amx_GetCStringLength(const cell *src)
+{
+	if(static_cast<ucell>(*src) > UNPACKEDMAX)
+	{
+		int length = 0;
+		amx_StrLen(src, &length);
+		return static_cast<size_t>(length);
+	}
+
+	const cell *c = src;
+#ifdef USE_SSE2
+	if((reinterpret_cast<size_t>(c) & (sizeof(cell) - 1)) == 0)
+	{
+		//aligned loads never cross a page boundary, so reading past the terminator is safe
+		for( ; (reinterpret_cast<size_t>(c) & 15) != 0; ++c)
+		{
+			if(*c == 0)
+				return static_cast<size_t>(c - src);
+		}
+		const __m128i zero = _mm_setzero_si128();
+		for( ; ; c += 4)
+		{
+			const int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(c)), zero));
+			if(mask != 0)
+				return static_cast<size_t>(c - src) + GetLowestBit(mask) / sizeof(cell);
+		}
+	}
+#endif
+	while(*c != 0)
+		++c;
+	return static_cast<size_t>(c - src);
+}
+
+void amx_GetCString(const cell *src, char *dest, size_t size)
+{
+	if(size == 0)
+		return ;
+
+	if(static_cast<ucell>(*src) > UNPACKEDMAX)
+	{
+		amx_GetString(dest, src, 0, size);
+		return ;
+	}
+
+	size_t len = amx_GetCStringLength(src);
+	if(len >= size)
+		len = size - 1;
+	NarrowCells(src, len, dest);
+}
+
+void amx_SetCString(cell *dest, const char *str, size_t size)
+{
+	if(size == 0)
+		return ;
+
+	size_t len = strlen(str);
+	if(len >= size)
+		len = size - 1;
+	WidenChars(str, len, dest);
+}
+
+size_t amx_GetStdString(AMX* amx, cell param, string &dest)
+{
+	cell *src = NULL;
+	amx_GetAddr(amx, param, &src);
+	if(src == NULL)
+	{
+		dest.clear();
+		return 0;
+	}
+
+	const size_t len = amx_GetCStringLength(src);
+	dest.resize(len);
+	if(len > 0)
+	{
+		if(static_cast<ucell>(*src) > UNPACKEDMAX)
+		{
+			//packed strings need room for the terminator
+			dest.resize(len + 1);
+			amx_GetString(&dest[0], src, 0, len + 1);
+			dest.resize(len);
+		}
+		else
+			NarrowCells(src, len, &dest[0]);
+	}
+	return len;
+}
+
+
+//returns the escape character for c, 0 if c doesn't need to be escaped
+static inline char GetEscapeChar(unsigned char c)
+{
+	switch(c)
+	{
+		case 0: return '0';
+		case '\n': return 'n';
+		case '\r': return 'r';
+		case '\\': return '\\';
+		case '\'': return '\'';
+		case '"': return '"';
+		case '\032': return 'Z';
+	}
+	return 0;
+}
+
+//length of the valid multi-byte character at src (0 if there's none) and the length its first byte announces,
+//the same checks libmysqlclient does (my_ismbchar and my_mbcharlen)
+static inline size_t GetMultiByteLength(const unsigned char *src, const unsigned char *end, e_EscapeCharset charset, size_t &announced_len)
+{
+	const unsigned char c = src[0];
+	if(c < 0xc2)
+		announced_len = 0;
+	else if(c < 0xe0)
+		announced_len = 2;
+	else if(c < 0xf0)
+		announced_len = 3;
+	else if(charset == ESCAPE_CHARSET_UTF8MB4 && c < 0xf8)
+		announced_len = 4;
+	else
+		announced_len = 0;
+
+	if(announced_len == 0 || static_cast<size_t>(end - src) < announced_len)
+		return 0;
+
+	switch(announced_len)
+	{
+		case 2:
+			return ((src[1] ^ 0x80) < 0x40) ? 2 : 0;
+		case 3:
+			return ((src[1] ^ 0x80) < 0x40 && (src[2] ^ 0x80) < 0x40 && (c >= 0xe1 || src[1] >= 0xa0)) ? 3 : 0;
+		case 4:
+			return (c < 0xf5 && (src[1] ^ 0x80) < 0x40 && (src[2] ^ 0x80) < 0x40 && (src[3] ^ 0x80) < 0x40 
+				&& (c >= 0xf1 || src[1] >= 0x90) && (c <= 0xf3 || src[1] <= 0x8f)) ? 4 : 0;
+	}
+	return 0;
+}
+
+size_t EscapeSQLString(const char *src, size_t src_len, char *dest, e_EscapeCharset charset, bool no_backslash_escapes)
+{
+	const unsigned char
+		*from = reinterpret_cast<const unsigned char *>(src),
+		*end = from + src_len;
+	char *to = dest;
+
+	//NO_BACKSLASH_ESCAPES sql mode: quotes are doubled, everything else is copied
+	if(no_backslash_escapes)
+	{
+		for( ; from != end; ++from)
+		{
+			if(*from == '\'')
+				*to++ = '\'';
+			*to++ = static_cast<char>(*from);
+		}
+		*to = '\0';
+		return static_cast<size_t>(to - dest);
+	}
+
+	const bool is_multi_byte = (charset == ESCAPE_CHARSET_UTF8 || charset == ESCAPE_CHARSET_UTF8MB4);
+	while(from != end)
+	{
+#ifdef USE_SSE2
+		//copies blocks without special characters (and without multi-byte characters) at once;
+		//dest always has room for the whole block, even if only a part of it is used
+		const __m128i
+			special_0 = _mm_setzero_si128(),
+			special_n = _mm_set1_epi8('\n'),
+			special_r = _mm_set1_epi8('\r'),
+			special_bs = _mm_set1_epi8('\\'),
+			special_sq = _mm_set1_epi8('\''),
+			special_dq = _mm_set1_epi8('"'),
+			special_z = _mm_set1_epi8('\032');
+		while(end - from >= 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(from));
+			const __m128i matches = _mm_or_si128(
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(block, special_0), _mm_cmpeq_epi8(block, special_n)),
+					_mm_or_si128(_mm_cmpeq_epi8(block, special_r), _mm_cmpeq_epi8(block, special_bs))),
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(block, special_sq), _mm_cmpeq_epi8(block, special_dq)),
+					_mm_cmpeq_epi8(block, special_z)));
+
+			int mask = _mm_movemask_epi8(matches);
+			if(is_multi_byte)
+				mask |= _mm_movemask_epi8(block); //bytes >= 0x80
+
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(to), block);
+			if(mask == 0)
+			{
+				from += 16;
+				to += 16;
+				continue;
+			}
+
+			const unsigned int clean_len = GetLowestBit(mask);
+			from += clean_len;
+			to += clean_len;
+			break;
+		}
+		if(from == end)
+			break;
+#endif
+
+		const unsigned char c = *from;
+		char escape = 0;
+		if(is_multi_byte && c >= 0x80)
+		{
+			size_t announced_len;
+			const size_t mb_len = GetMultiByteLength(from, end, charset, announced_len);
+			if(mb_len > 1)
+			{
+				for(size_t b = 0; b < mb_len; ++b)
+					*to++ = static_cast<char>(*from++);
+				continue;
+			}
+			//invalid multi-byte characters get escaped, so they can't swallow a following quote
+			if(announced_len > 1)
+				escape = static_cast<char>(c);
+		}
+		else
+			escape = GetEscapeChar(c);
+
+		if(escape != 0)
+		{
+			*to++ = '\\';
+			*to++ = escape;
+		}
+		else
+			*to++ = static_cast<char>(c);
+		++from;
+	}
+	*to = '\0';
+	return static_cast<size_t>(to - dest);
+}
+
+
+static bool ScanStatementSeparator(const char *src, size_t len, bool no_backslash_escapes)
+{
+	const char *end = src + len;
+	char quote = 0;
+	for(const char *c = src; c != end; ++c)
+	{
+		if(quote != 0)
+		{
+			if(*c == '\\' && quote != '`' && !no_backslash_escapes)
+			{
+				if(++c == end)
+					break;
+			}
+			else if(*c == quote) //doubled quotes just start a new string
+				quote = 0;
+			continue;
+		}
+
+		switch(*c)
+		{
+			case ';':
+				return true;
+
+			case '\'':
+			case '"':
+			case '`':
+				quote = *c;
+				break;
+
+			case '#':
+				while(c + 1 != end && *(c + 1) != '\n')
+					++c;
+				break;
+
+			case '-':
+				if(end - c >= 2 && c[1] == '-' && (end - c == 2 || static_cast<unsigned char>(c[2]) <= ' '))
+				{
+					while(c + 1 != end && *(c + 1) != '\n')
+						++c;
+				}
+				break;
+
+			case '/':
+				//executable comments (/*! */, /*+ */) are scanned like the rest of the query
+				if(end - c >= 3 && c[1] == '*' && c[2] != '!' && c[2] != '+')
+				{
+					for(c += 2; c + 1 < end && !(c[0] == '*' && c[1] == '/'); ++c);
+					if(c + 1 >= end)
+						return true;
+					++c;
+				}
+				break;
+		}
+	}
+	return quote != 0;
+}
+
+bool HasStatementSeparator(const char *src, size_t len)
+{
+	//whether backslashes escape depends on the server's sql_mode, so a query has to be safe in both modes
+	return ScanStatementSeparator(src, len, false) 
+		|| (memchr(src, '\\', len) != NULL && ScanStatementSeparator(src, len, true));
+}
@@ -3,18 +3,63 @@
 #define INC_MISC_H
 
 
+#include <string>
+using std::string;
+
 #include "main.h"
 
+//parse the number at the start of src (no leading whitespace, trailing characters are ignored),
+//the length versions don't need a null terminated string
 bool ConvertStrToInt(const char *src, int &dest);
+bool ConvertStrToInt(const char *src, size_t len, int &dest);
 bool ConvertStrToFloat(const char *src, float &dest);
+bool ConvertStrToFloat(const char *src, size_t len, float &dest);
 
 template<unsigned int B> //B = base/radix
-bool ConvertIntToStr(int src, char *dest);
+bool ConvertIntToStr(int src, char *dest); //dest needs room for 34 characters (base 2)
 bool ConvertIntToStr(int src, char *dest); //no-template version
-bool ConvertFloatToStr(float src, char *dest);
 
 
 void amx_SetCString(AMX* amx, cell param, const char *str, int len = 0);
 
+//replacements for amx_StrLen, amx_GetString and amx_SetString (no wide characters), 
+//unpacked strings are converted without calls into the server (SSE2)
+size_t amx_GetCStringLength(const cell *src);
+void amx_GetCString(const cell *src, char *dest, size_t size);
+void amx_SetCString(cell *dest, const char *str, size_t size);
+//converts the string straight into dest, returns its length
+size_t amx_GetStdString(AMX* amx, cell param, string &dest);
+
+//replaces the SDK version, which needs two calls into the server for every string
+#undef amx_StrParam
+#define amx_StrParam(amx,param,result) \
+	do { \
+		cell *amx_cstr_ = NULL; size_t amx_length_ = 0; \
+		amx_GetAddr((amx), (param), &amx_cstr_); \
+		if (amx_cstr_ != NULL) \
+			amx_length_ = amx_GetCStringLength(amx_cstr_); \
+		if (amx_length_ > 0 && ((result) = (char *)alloca(amx_length_ + 1)) != NULL) \
+			amx_GetCString(amx_cstr_, (result), amx_length_ + 1); \
+		else (result) = NULL; \
+	} while (0)
+
+
+//character sets the built-in escaper handles; ESCAPE_CHARSET_NONE means only mysql_real_escape_string escapes correctly
+enum e_EscapeCharset
+{
+	ESCAPE_CHARSET_NONE,
+	ESCAPE_CHARSET_SINGLE_BYTE,
+	ESCAPE_CHARSET_UTF8,
+	ESCAPE_CHARSET_UTF8MB4
+};
+
+//escapes src exactly like mysql_real_escape_string does for the given character set;
+//dest has to hold at least src_len*2+1 characters, returns the length of the escaped string
+size_t EscapeSQLString(const char *src, size_t src_len, char *dest, e_EscapeCharset charset, bool no_backslash_escapes);
+
+//true if the query contains a ';' outside of strings and comments, or ends inside a string or comment 
+//(which would swallow a following statement)
+bool HasStatementSeparator(const char *src, size_t len);
+
 
 #endif // INC_MISC_H